@@ -74,7 +74,7 @@ void loop() {
     Serial.printf(
       "Found %s at (x = %d, y = %d) (size %d x %d). "
       "Proba is %.2f\n",
-      fomo.first.label,
+      fomo.first.labelName,
       fomo.first.x,
       fomo.first.y,
       fomo.first.width,
@@ -89,7 +89,7 @@ void loop() {
           "#%d) Found %s at (x = %d, y = %d) (size %d x %d). "
           "Proba is %.2f\n",
           i + 1,
-          bbox.label,
+          bbox.labelName,
           bbox.x,
           bbox.y,
           bbox.width,
@@ -0,0 +1,153 @@
+/**
+ * Compare heap usage of String-based JSON
+ * vs streaming JSON (no intermediate String).
+ *
+ * The sketch fills the face detection results with
+ * fake faces, then serializes them many times both ways,
+ * printing time, heap allocations and largest free block.
+ * Allocations are counted with ESP-IDF heap tracing
+ * (CONFIG_HEAP_TRACING_STANDALONE): if your core is built
+ * without it, the count is reported as unavailable.
+ *
+ * BE SURE TO SET "TOOLS > CORE DEBUG LEVEL = INFO"
+ * to turn on debug messages
+ */
+#include <esp_heap_caps.h>
+#include <esp_heap_trace.h>
+#include <eloquent_esp32cam.h>
+#include <eloquent_esp32cam/face/detection.h>
+#include <eloquent_esp32cam/extra/serialize/print.h>
+
+using eloq::face::detection;
+using Eloquent::Extra::Serialize::CountingPrint;
+
+#define ITERATIONS 1000
+#define TRACE_RECORDS 64
+
+#if defined(CONFIG_HEAP_TRACING_STANDALONE)
+heap_trace_record_t records[TRACE_RECORDS];
+#endif
+
+
+/**
+ * Print that tracks the lowest free heap
+ * seen while data is written into it
+ */
+class HeapProbe : public CountingPrint {
+    public:
+        size_t minFree;
+
+        HeapProbe() : minFree(SIZE_MAX) {}
+
+        size_t write(uint8_t c) override {
+            probe();
+            return CountingPrint::write(c);
+        }
+
+        size_t write(const uint8_t *buffer, size_t size) override {
+            probe();
+            return CountingPrint::write(buffer, size);
+        }
+
+        void probe() {
+            minFree = min(minFree, heap_caps_get_free_size(MALLOC_CAP_8BIT));
+        }
+};
+
+
+/**
+ * Count heap allocations made while running callback
+ * (frees don't decrease the count).
+ * Returns -1 if heap tracing is not available
+ */
+template<typename Callback>
+int countAllocations(Callback callback) {
+#if defined(CONFIG_HEAP_TRACING_STANDALONE)
+    heap_trace_start(HEAP_TRACE_ALL);
+    callback();
+    heap_trace_stop();
+
+    return heap_trace_get_count();
+#else
+    callback();
+
+    return -1;
+#endif
+}
+
+
+/**
+ * Print allocations made by a single publish
+ */
+void printAllocations(int count) {
+    if (count < 0)
+        Serial.println(" > allocations/publish: n/a (heap tracing disabled)");
+    else if (count >= TRACE_RECORDS)
+        Serial.printf(" > allocations/publish: %d or more\n", count);
+    else
+        Serial.printf(" > allocations/publish: %d\n", count);
+}
+
+
+/**
+ *
+ */
+void setup() {
+    delay(3000);
+    Serial.begin(115200);
+    Serial.println("___JSON HEAP BENCHMARK___");
+
+#if defined(CONFIG_HEAP_TRACING_STANDALONE)
+    heap_trace_init_standalone(records, TRACE_RECORDS);
+#endif
+
+    // fake detection results
+    for (uint8_t i = 0; i < MAX_FACES; i++) {
+        detection.faces[i].clear();
+        detection.faces[i].x = detection.faces[i].x0 = 10 * i;
+        detection.faces[i].y = detection.faces[i].y0 = 20 * i;
+        detection.faces[i].width = 30 + i;
+        detection.faces[i].height = 40 + i;
+        detection.faces[i].score = 0.9;
+    }
+
+    detection.first = detection.faces[0];
+}
+
+
+void loop() {
+    multi_heap_info_t before, after;
+    unsigned long start;
+    size_t length = 0;
+
+    // String-based
+    heap_caps_get_info(&before, MALLOC_CAP_8BIT);
+    start = micros();
+
+    for (uint16_t i = 0; i < ITERATIONS; i++)
+        length += detection.toJSON().length();
+
+    Serial.printf("String:    %lu us/publish, %u bytes\n", (micros() - start) / ITERATIONS, length / ITERATIONS);
+    heap_caps_get_info(&after, MALLOC_CAP_8BIT);
+    printAllocations(countAllocations([]() { detection.toJSON(); }));
+    Serial.printf(" > largest free block: %u -> %u\n", before.largest_free_block, after.largest_free_block);
+
+    // streaming
+    CountingPrint counter;
+    HeapProbe probe;
+
+    heap_caps_get_info(&before, MALLOC_CAP_8BIT);
+    start = micros();
+
+    for (uint16_t i = 0; i < ITERATIONS; i++)
+        detection.toJSON(counter);
+
+    Serial.printf("Streaming: %lu us/publish, %u bytes\n", (micros() - start) / ITERATIONS, counter.count / ITERATIONS);
+    heap_caps_get_info(&after, MALLOC_CAP_8BIT);
+    printAllocations(countAllocations([&counter]() { detection.toJSON(counter); }));
+    detection.toJSON(probe);
+    Serial.printf(" > free heap: %u, min while streaming: %u\n", before.total_free_bytes, probe.minFree);
+    Serial.printf(" > largest free block: %u -> %u\n", before.largest_free_block, after.largest_free_block);
+
+    delay(10000);
+}
@@ -40,6 +40,8 @@ namespace Eloquent {
                     RateLimit rateLimit;
                     Mutex mutex;
                     Converter565<Camera> rgb565;
+                    uint32_t seq;
+                    uint32_t capturedAt;
 
                     /**
                      * Constructor
@@ -47,7 +49,9 @@ namespace Eloquent {
                     Camera() :
                         exception("Camera"),
                         mutex("Camera"),
-                        rgb565(this) {
+                        rgb565(this),
+                        seq(0),
+                        capturedAt(0) {
 
                     }
 
@@ -105,6 +109,15 @@ namespace Eloquent {
                         mutex.threadsafe([this]() {
                             free();
                             frame = esp_camera_fb_get();
+
+                            // monotonic frame counter, used to tag
+                            // frames and detections downstream.
+                            // Updated with the frame, so readers holding
+                            // the mutex always see a matching pair
+                            if (frame != NULL) {
+                                seq += 1;
+                                capturedAt = millis();
+                            }
                         }, 1000);
 
                         if (!mutex.isOk())
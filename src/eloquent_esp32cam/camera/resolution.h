@@ -274,11 +274,11 @@ namespace Eloquent {
                 void set(framesize_t resolution) {
                     switch (resolution) {
                         case FRAMESIZE_96X96: _96x96(); break;
-                        case FRAMESIZE_QQVGA: square96(); break;
+                        case FRAMESIZE_QQVGA: qqvga(); break;
                         case FRAMESIZE_QCIF: qcif(); break;
                         case FRAMESIZE_HQVGA: hqvga(); break;
                         case FRAMESIZE_240X240: _240x240(); break;
-                        case FRAMESIZE_QVGA: square240(); break;
+                        case FRAMESIZE_QVGA: qvga(); break;
                         case FRAMESIZE_CIF: cif(); break;
                         case FRAMESIZE_HVGA: hvga(); break;
                         case FRAMESIZE_VGA: vga(); break;
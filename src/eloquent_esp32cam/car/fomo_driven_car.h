@@ -29,7 +29,8 @@ namespace Eloquent {
                  */
                 FomoDrivenCar(Motor& leftMotor, Motor& rightMotor) :
                     TwoWheelsCar(leftMotor, rightMotor),
-                    _reversed(false) {
+                    _reversed(false),
+                    _target(0) {
 
                     _exploration.last = 0;
                     _exploration.state = 0;
@@ -60,22 +61,77 @@ namespace Eloquent {
                  * @param fomo
                  */
                 void follow(FOMO& fomo) {
+                    // when tracking, stick to the same object
+                    // and steer on its smoothed position
+                    if (fomo.isTracking()) {
+                        FOMO::track_t *track = pickTarget(fomo);
+
+                        if (track == NULL) {
+                            ESP_LOGD("FomoDrivenCar", "No track to follow");
+                            _explore();
+                            return;
+                        }
+
+                        ESP_LOGD("FomoDrivenCar", "Following track #%d", track->id);
+                        steer(track->cx());
+                        return;
+                    }
+
                     if (!fomo.found()) {
                         ESP_LOGD("FomoDrivenCar", "No object found");
                         _explore();
                         return;
                     }
 
+                    ESP_LOGD("FomoDrivenCar", "bbox.x=%d, bbox.w=%d", fomo.first.x, fomo.first.width);
+                    steer(fomo.first.x + fomo.first.width / 2.0f);
+                }
+
+            protected:
+                bool _reversed;
+                uint16_t _rotation = 0;
+                uint16_t _target;
+                struct {
+                    size_t last;
+                    uint8_t state;
+                } _exploration;
+
+                /**
+                 * Keep current target while it's tracked,
+                 * otherwise switch to the longest lived track
+                 */
+                FOMO::track_t* pickTarget(FOMO& fomo) {
+                    FOMO::track_t *track = fomo.tracker.get(_target);
+
+                    if (track != NULL && track->confirmed && track->misses == 0)
+                        return track;
+
+                    track = NULL;
+
+                    fomo.tracker.forEach([&track](FOMO::track_t& candidate) {
+                        if (candidate.confirmed && candidate.misses == 0 && (track == NULL || candidate.hits > track->hits))
+                            track = &candidate;
+                    });
+
+                    _target = track != NULL ? track->id : 0;
+
+                    return track;
+                }
+
+                /**
+                 * Turn towards horizontal position x (in model coordinates)
+                 */
+                void steer(float x) {
                     uint16_t cx = 0;
                     uint16_t dimension = 0;
 
                     switch (_rotation) {
                         case 0:
-                            cx = fomo.first.x + fomo.first.width / 2;
+                            cx = x;
                             dimension = EI_CLASSIFIER_INPUT_WIDTH;
                             break;
                         case 180:
-                            cx = EI_CLASSIFIER_INPUT_WIDTH - fomo.first.x - fomo.first.width / 2;
+                            cx = EI_CLASSIFIER_INPUT_WIDTH - x;
                             dimension = EI_CLASSIFIER_INPUT_WIDTH;
                             break;
                         case  90:
@@ -86,7 +142,7 @@ namespace Eloquent {
                             break;
                     }
 
-                    ESP_LOGD("FomoDrivenCar", "bbox.x=%d, bbox.w=%d, cx=%d, dimension=%d", fomo.first.x, fomo.first.width, cx, dimension);
+                    ESP_LOGD("FomoDrivenCar", "cx=%d, dimension=%d", cx, dimension);
 
                     const float band = dimension / 6;
 
@@ -101,14 +157,6 @@ namespace Eloquent {
                     _exploration.state = 0;
                 }
 
-            protected:
-                bool _reversed;
-                uint16_t _rotation = 0;
-                struct {
-                    size_t last;
-                    uint8_t state;
-                } _exploration;
-
                 /**
                  * If no object is detected, look around
                  */
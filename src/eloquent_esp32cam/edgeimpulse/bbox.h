@@ -5,7 +5,10 @@ namespace eloq {
     namespace ei {
         class bbox_t {
             public:
-                String label;
+                // EI category name, not a copy: compare
+                // with is() or label(), not with ==
+                const char *labelName;
+                uint8_t labelIx;
                 float proba;
                 uint16_t x;
                 uint16_t y;
@@ -17,16 +20,51 @@ namespace eloq {
                 uint16_t cy;
                 uint16_t width;
                 uint16_t height;
+                uint16_t id;
+                // set by a second stage classifier (see Cascade)
+                const char *refinedLabel;
+                uint8_t refinedIx;
+                float refinedProba;
 
                 /**
                  * Constructor
                  */
-                bbox_t(String label_, float proba_, uint16_t x_, uint16_t y_, uint16_t width_, uint16_t height_) :
-                    label(label_),
-                    proba(proba_) {
+                bbox_t() :
+                    bbox_t("", 0, 0, 0, 0, 0, 0) {
+
+                    }
+
+                /**
+                 * Constructor
+                 * @param label_ must outlive the box (EI category names do)
+                 * @param labelIx_ index into the model categories
+                 */
+                bbox_t(const char *label_, uint8_t labelIx_, float proba_, uint16_t x_, uint16_t y_, uint16_t width_, uint16_t height_) :
+                    labelName(label_),
+                    labelIx(labelIx_),
+                    proba(proba_),
+                    id(0),
+                    refinedLabel(""),
+                    refinedIx(0),
+                    refinedProba(0) {
                         setDimensions(x_, y_, width_, height_);
                     }
 
+                /**
+                 * Test if box has the given label
+                 */
+                inline bool is(const char *name) const {
+                    return strcmp(labelName, name) == 0;
+                }
+
+                /**
+                 * Get label as String
+                 * (allocates: prefer labelName or is() in hot paths)
+                 */
+                inline String label() const {
+                    return String(labelName);
+                }
+
                 /**
                  * 
                  */
@@ -0,0 +1,182 @@
+#ifndef ELOQUENT_ESP32CAM_EDGEIMPULSE_CASCADE_H
+#define ELOQUENT_ESP32CAM_EDGEIMPULSE_CASCADE_H
+
+#include "../camera/camera.h"
+#include "../transform/resize.h"
+#include "../extra/exception.h"
+#include "../extra/time/benchmark.h"
+#include "./fomo.h"
+
+#ifndef EI_CASCADE_MAX_CROPS
+#define EI_CASCADE_MAX_CROPS 4
+#endif
+
+using eloq::camera;
+using eloq::ei::bbox_t;
+using Eloquent::Error::Exception;
+using Eloquent::Extra::Time::Benchmark;
+using Eloquent::Esp32cam::Transform::Resize;
+
+
+namespace Eloquent {
+    namespace Esp32cam {
+        namespace EdgeImpulse {
+            /**
+             * Two-stage cascade: FOMO finds objects at model
+             * resolution, then a second classifier identifies each
+             * one on a crop of the original high resolution frame.
+             * All crops are decoded in a single JPEG pass.
+             *
+             * Second must expose configure(Resize&), classify(Resize&),
+             * ix, proba and labelOf(ix), like ImageClassifier.
+             * Since a sketch can only link one Edge Impulse model,
+             * the second stage is usually an adapter around another
+             * runtime with the same interface
+             *
+             * @tparam Second
+             */
+            template<typename Second>
+            class Cascade {
+                public:
+                    Exception exception;
+                    Benchmark benchmark;
+                    bbox_t boxes[EI_CASCADE_MAX_CROPS];
+                    Resize crops[EI_CASCADE_MAX_CROPS];
+                    uint8_t count;
+
+                    /**
+                     * Constructor
+                     */
+                    Cascade(FOMO& detector, Second& classifier) :
+                        exception("Cascade"),
+                        count(0),
+                        _detector(detector),
+                        _classifier(classifier),
+                        _padding(0.25f) {
+                            for (uint8_t i = 0; i < EI_CASCADE_MAX_CROPS; i++)
+                                _classifier.configure(crops[i]);
+                        }
+
+                    /**
+                     * Grow each box by this fraction of its
+                     * size on every side before cropping
+                     * (FOMO boxes are tight around the centroid)
+                     */
+                    void padding(float padding) {
+                        _padding = max(0.0f, padding);
+                    }
+
+                    /**
+                     * Test if any object was found
+                     */
+                    inline bool found() const {
+                        return count > 0;
+                    }
+
+                    /**
+                     * Run function on each refined box
+                     */
+                    template<typename Callback>
+                    void forEach(Callback callback) {
+                        for (uint8_t i = 0; i < count; i++)
+                            callback(i, boxes[i]);
+                    }
+
+                    /**
+                     * Run both stages on current frame
+                     */
+                    Exception& run() {
+                        count = 0;
+
+                        if (!_detector.run().isOk())
+                            return exception.propagate(_detector);
+
+                        // frame the detector actually ran on: the camera
+                        // may have moved on while preprocessing
+                        const uint32_t seq = _detector.input.seq;
+
+                        benchmark.benchmark([this, seq]() {
+                            collect();
+
+                            if (count == 0)
+                                return;
+
+                            Resize *targets[EI_CASCADE_MAX_CROPS];
+                            uint8_t decoded = 0;
+
+                            for (uint8_t i = 0; i < count; i++)
+                                targets[i] = &crops[i];
+
+                            camera.mutex.threadsafe([this, seq, &targets, &decoded]() {
+                                // boxes refer to the frame FOMO ran on
+                                if (camera.seq != seq || !camera.hasFrame())
+                                    return;
+
+                                decoded = Resize::decodeAll(camera.frame, targets, count);
+
+                                for (uint8_t i = 0; i < count; i++)
+                                    crops[i].seq = camera.seq;
+                            }, 1000);
+
+                            if (decoded == 0) {
+                                exception.set("Cannot decode crops");
+                                return;
+                            }
+
+                            for (uint8_t i = 0; i < count; i++) {
+                                if (!crops[i].exception.isOk() || !_classifier.classify(crops[i]).isOk())
+                                    continue;
+
+                                boxes[i].refinedIx = _classifier.ix;
+                                boxes[i].refinedProba = _classifier.proba;
+                                boxes[i].refinedLabel = Second::labelOf(_classifier.ix);
+                            }
+
+                            exception.clear();
+                        });
+
+                        return exception;
+                    }
+
+                protected:
+                    FOMO& _detector;
+                    Second& _classifier;
+                    float _padding;
+
+                    /**
+                     * Map FOMO boxes to padded regions of the source frame
+                     */
+                    void collect() {
+                        const Resize& input = _detector.input;
+
+                        _detector.forEach([this, &input](int i, bbox_t& bbox) {
+                            if (count >= EI_CASCADE_MAX_CROPS)
+                                return;
+
+                            const float padX = bbox.width * _padding;
+                            const float padY = bbox.height * _padding;
+                            const int16_t x1 = max<int16_t>(0, input.toSourceX(bbox.x - padX));
+                            const int16_t y1 = max<int16_t>(0, input.toSourceY(bbox.y - padY));
+                            const int16_t x2 = min<int16_t>(input.region.x + input.region.width, input.toSourceX(bbox.x + bbox.width + padX));
+                            const int16_t y2 = min<int16_t>(input.region.y + input.region.height, input.toSourceY(bbox.y + bbox.height + padY));
+
+                            if (x2 <= x1 || y2 <= y1)
+                                return;
+
+                            bbox_t &box = boxes[count];
+
+                            box = bbox;
+                            box.refinedLabel = "";
+                            box.refinedIx = 0;
+                            box.refinedProba = 0;
+                            box.setDimensions(x1, y1, x2 - x1, y2 - y1);
+                            crops[count].crop(x1, y1, x2 - x1, y2 - y1);
+                            count += 1;
+                        });
+                    }
+            };
+        }
+    }
+}
+
+#endif
@@ -3,9 +3,11 @@
 
 #include "../extra/exception.h"
 #include "../extra/time/benchmark.h"
+#include "../extra/esp32/multiprocessing/mutex.h"
 
 using Eloquent::Error::Exception;
 using Eloquent::Extra::Time::Benchmark;
+using Eloquent::Extra::Esp32::Multiprocessing::Mutex;
 using ei::signal_t;
 
 
@@ -22,6 +24,8 @@ namespace Eloquent {
                     EI_IMPULSE_ERROR error;
                     Exception exception;
                     Benchmark benchmark;
+                    Mutex mutex;
+                    uint32_t seq;
                     struct {
                         size_t dsp;
                         size_t anomaly;
@@ -34,6 +38,8 @@ namespace Eloquent {
                      */
                     Classifier(): 
                         exception("EI " EI_CLASSIFIER_PROJECT_NAME),
+                        mutex("EI"),
+                        seq(0),
                         _isDebugEnabled(false) {
                         signal.total_length = EI_CLASSIFIER_RAW_SAMPLE_COUNT;
                     }
@@ -5,8 +5,10 @@
     #include "./image.h"
     #include "./bbox.h"
     #include "./fomo_daemon.h"
+    #include "../extra/tracking/tracker.h"
     
     using eloq::ei::bbox_t;
+    using Eloquent::Extra::Tracking::Tracker;
 
     namespace Eloquent {
         namespace Esp32cam {
@@ -16,16 +18,67 @@
                  */
                 class FOMO : public ImageClassifier {
                 public:
+                    using track_t = Tracker<bbox_t, EI_CLASSIFIER_OBJECT_DETECTION_COUNT>::track_t;
+
                     bbox_t first;
                     FOMODaemon<FOMO> daemon;
+                    Tracker<bbox_t, EI_CLASSIFIER_OBJECT_DETECTION_COUNT> tracker;
 
                     /**
                      *
                      */
                     FOMO() :
                         ImageClassifier(),
-                        first("", 0, 0, 0, 0, 0),
-                        daemon(this) {
+                        first("", 0, 0, 0, 0, 0, 0),
+                        daemon(this),
+                        _isTracking(false) {
+                            memset(_ids, 0, sizeof(_ids));
+                    }
+
+                    /**
+                     * Assign persistent ids to objects across frames.
+                     * FOMO boxes are small and jittery, so
+                     * positions are smoothed by default
+                     */
+                    void track(float smoothing = 0.5f, uint16_t minHits = 2) {
+                        _isTracking = true;
+                        tracker.smoothing(smoothing);
+                        tracker.minHits(minHits);
+                        tracker.clear();
+                    }
+
+                    /**
+                     * Disable tracking
+                     */
+                    void dontTrack() {
+                        _isTracking = false;
+                        tracker.clear();
+                        memset(_ids, 0, sizeof(_ids));
+                    }
+
+                    /**
+                     * Test if tracking is enabled
+                     */
+                    inline bool isTracking() const {
+                        return _isTracking;
+                    }
+
+                    /**
+                     * Get index of label in model categories,
+                     * or EI_CLASSIFIER_LABEL_COUNT if not found.
+                     * Result labels point into the categories array,
+                     * so the pointer check almost always hits
+                     */
+                    static uint8_t labelIndexOf(const char *label) {
+                        for (uint8_t i = 0; i < EI_CLASSIFIER_LABEL_COUNT; i++)
+                            if (label == ei_classifier_inferencing_categories[i])
+                                return i;
+
+                        for (uint8_t i = 0; i < EI_CLASSIFIER_LABEL_COUNT; i++)
+                            if (strcmp(label, ei_classifier_inferencing_categories[i]) == 0)
+                                return i;
+
+                        return EI_CLASSIFIER_LABEL_COUNT;
                     }
 
                     /**
@@ -51,6 +104,7 @@
                             auto bb = result.bounding_boxes[ix];
                             bbox_t bbox(
                                 bb.label,
+                                labelIndexOf(bb.label),
                                 bb.value,
                                 bb.x,
                                 bb.y,
@@ -58,6 +112,9 @@
                                 bb.height
                             );
 
+                            if (ix < EI_CLASSIFIER_OBJECT_DETECTION_COUNT)
+                                bbox.id = _ids[ix];
+
                             if (bbox.proba > 0)
                                 callback(i++, bbox);
                         }
@@ -87,42 +144,27 @@
                     }
 
                     /**
-                     * Convert to JSON string
+                     * Serialize bounding boxes
                      */
-                    String toJSON() {
-                        static char buf[10 * 33] = {' '};
-                        String json(buf);
-                        
-                        json = "[]";
-
-                        if (!found())
-                            return json;
-
-                        json = "[";
-
-                        forEach([&json](uint8_t i, bbox_t bbox) {
-                            if (i > 0)
-                                json += ',';
-
-                            json += '{';
-                            json += "\"label\":\"";
-                            json += bbox.label;
-                            json += "\",\"proba\":";
-                            json += bbox.proba;
-                            json += ",\"x\":";
-                            json += bbox.x;
-                            json += ",\"y\":";
-                            json += bbox.y;
-                            json += ",\"w\":";
-                            json += bbox.width;
-                            json += ",\"h\":";
-                            json += bbox.height;
-                            json += '}';
+                    void serializeTo(Writer& writer) override {
+                        writer.beginArray(count());
+
+                        forEach([this, &writer](uint8_t i, bbox_t& bbox) {
+                            writer.beginObject(isTracking() ? 7 : 6);
+
+                            if (isTracking())
+                                writer.kv("id", bbox.id);
+
+                            writer.kv("label", bbox.labelName);
+                            writer.kv("proba", bbox.proba);
+                            writer.kv("x", bbox.x);
+                            writer.kv("y", bbox.y);
+                            writer.kv("w", bbox.width);
+                            writer.kv("h", bbox.height);
+                            writer.endObject();
                         });
 
-                        json += ']';
-                        
-                        return json;
+                        writer.endArray();
                     }
 
                     /**
@@ -133,18 +175,50 @@
                     }
 
                 protected:
+                    bool _isTracking;
+                    uint16_t _ids[EI_CLASSIFIER_OBJECT_DETECTION_COUNT];
 
                     /**
                      * Run actions after classification results
                      */
                     virtual void afterClassification() {
+                        if (_isTracking)
+                            updateTracks();
+
                         if (found()) {
                             auto bb = result.bounding_boxes[0];
-                            first.label = bb.label;
+                            first.labelName = bb.label;
+                            first.labelIx = labelIndexOf(bb.label);
                             first.proba = bb.value;
+                            first.id = _ids[0];
                             first.setDimensions(bb.x, bb.y, bb.width, bb.height);
                         }
                     }
+
+                    /**
+                     * Associate current boxes to tracks and
+                     * remember the id of each result slot
+                     */
+                    void updateTracks() {
+                        const size_t count = min<size_t>(result.bounding_boxes_count, EI_CLASSIFIER_OBJECT_DETECTION_COUNT);
+                        bbox_t boxes[EI_CLASSIFIER_OBJECT_DETECTION_COUNT];
+
+                        for (size_t ix = 0; ix < count; ix++) {
+                            auto bb = result.bounding_boxes[ix];
+
+                            boxes[ix].labelName = bb.label;
+                            boxes[ix].labelIx = labelIndexOf(bb.label);
+                            boxes[ix].proba = bb.value;
+                            boxes[ix].setDimensions(bb.x, bb.y, bb.width, bb.height);
+                        }
+
+                        tracker.update(boxes, count, [](bbox_t& bbox) {
+                            return bbox.proba > 0;
+                        });
+
+                        for (size_t ix = 0; ix < EI_CLASSIFIER_OBJECT_DETECTION_COUNT; ix++)
+                            _ids[ix] = ix < count && boxes[ix].proba > 0 ? boxes[ix].id : 0;
+                    }
                 };
             }
         }
@@ -1,13 +1,16 @@
 #ifndef ELOQUENT_ESP32CAM_EDGEIMPULSE_FOMO_DAEMON_H
 #define ELOQUENT_ESP32CAM_EDGEIMPULSE_FOMO_DAEMON_H 1
 
+#include <atomic>
 #include <functional>
 #include "../camera/camera.h"
+#include "../transform/resize.h"
 #include "../extra/esp32/multiprocessing/thread.h"
 #include "./bbox.h"
 
 using eloq::camera;
 using eloq::ei::bbox_t;
+using Eloquent::Esp32cam::Transform::Resize;
 using Eloquent::Extra::Esp32::Multiprocessing::Thread;
 using OnObjectCallback = std::function<void(uint8_t, bbox_t&)>;
 using OnNothingCallback = std::function<void()>;
@@ -17,7 +20,11 @@ namespace Eloquent {
     namespace Esp32cam {
         namespace EdgeImpulse {
             /**
-             * Run FOMO in background
+             * Run FOMO in background.
+             * Capture + decode (core 0) and inference (core 1)
+             * run as a two-stage pipeline over a double-buffered
+             * model input, so frame N+1 is prepared while frame N
+             * is being classified
              * 
              * @class FOMODaemon
              * @author Simone
@@ -29,6 +36,12 @@ namespace Eloquent {
             class FOMODaemon {
             public:
                 Thread thread;
+                Thread preprocessor;
+                struct {
+                    uint32_t preprocessed;
+                    uint32_t classified;
+                    uint32_t dropped;
+                } stats;
                 
                 /**
                  * @brief Constructor
@@ -36,9 +49,18 @@ namespace Eloquent {
                  */
                 FOMODaemon(T *fomo) :
                     thread("FOMO"),
-                    _fomo(fomo),
-                    _numListeners(0) {
-                        
+                    preprocessor("FOMO preprocess"),
+                    _fomo(fomo) {
+                        stats.preprocessed = 0;
+                        stats.classified = 0;
+                        stats.dropped = 0;
+                        thread.onCore(1);
+                        preprocessor.onCore(0);
+
+                        for (uint8_t i = 0; i < 2; i++) {
+                            _slots[i].state = FREE;
+                            _slots[i].seq = 0;
+                        }
                     }
             
                 /**
@@ -63,14 +85,20 @@ namespace Eloquent {
                  * @param callback
                  */
                 bool whenYouSee(String label, OnObjectCallback callback) {
-                    if (_numListeners >= EI_CLASSIFIER_LABEL_COUNT + 1) {
-                        ESP_LOGE("FOMO daemon", "Max number of listeners reached");
+                    if (label == "*") {
+                        _onAny = callback;
+                        return true;
+                    }
+
+                    // resolve label once, dispatch by index
+                    const uint8_t ix = T::labelIndexOf(label.c_str());
+
+                    if (ix >= EI_CLASSIFIER_LABEL_COUNT) {
+                        ESP_LOGE("FOMO daemon", "Unknown label: %s", label.c_str());
                         return false;
                     }
                     
-                    _callbacks[_numListeners].label = label;
-                    _callbacks[_numListeners].callback = callback;
-                    _numListeners += 1;
+                    _onLabel[ix] = callback;
                     
                     return true;
                 }
@@ -81,6 +109,11 @@ namespace Eloquent {
                  * @brief 
                  */
                 void start() {
+                    for (uint8_t i = 0; i < 2; i++)
+                        _fomo->configure(_slots[i].buffer);
+
+                    // consumer first, so its handle is
+                    // available to the producer
                     thread
                         .withArgs((void*) this)
                         .withStackSize(4000)
@@ -89,46 +122,141 @@ namespace Eloquent {
                         .run([](void *args) {
                             FOMODaemon *self = (FOMODaemon*) args;
                             
+                            while (true) {
+                                // wait for producer
+                                ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+                                slot_t *slot;
+
+                                while ((slot = self->take()) != NULL) {
+                                    const bool isOk = self->_fomo->classify(slot->buffer).isOk();
+
+                                    slot->state.store(FREE);
+
+                                    if (!isOk)
+                                        continue;
+
+                                    self->stats.classified += 1;
+                                    self->dispatch();
+                                }
+                            }
+                        });
+
+                    preprocessor
+                        .withArgs((void*) this)
+                        .withStackSize(5000)
+                        .withPriority(16)
+                        .run([](void *args) {
+                            FOMODaemon *self = (FOMODaemon*) args;
+                            
                             delay(3000);
                             
                             while (true) {
                                 yield();
                                 delay(1);
                                 
-                                if (!camera.capture().isOk())
-                                    continue;
+                                slot_t *slot = self->reserve();
 
-                                if (!self->_fomo->run().isOk())
+                                if (slot == NULL)
                                     continue;
-                                    
-                                if (!self->_fomo->foundAnyObject()) {
-                                    if (self->_onNothing)
-                                        self->_onNothing();
-                                        
+
+                                if (!camera.capture().isOk() || !self->_fomo->preprocess(slot->buffer).isOk()) {
+                                    slot->state.store(FREE);
                                     continue;
                                 }
-                                    
-                                self->_fomo->forEach([&self](int i, bbox_t& bbox) {
-                                    // run specific label callback
-                                    for (uint8_t i = 0; i < EI_CLASSIFIER_LABEL_COUNT + 1; i++) {
-                                        String label = self->_callbacks[i].label;
-                                        
-                                        if (label == "*" || label == bbox.label)
-                                            self->_callbacks[i].callback(i, bbox);
-                                    }
-                                });
+
+                                slot->seq = camera.seq;
+                                slot->state.store(READY);
+                                self->stats.preprocessed += 1;
+                                xTaskNotifyGive(self->thread.handle);
                             }
                         });
                 }
                 
             protected:
+                enum : uint8_t {
+                    FREE,
+                    FILLING,
+                    READY,
+                    BUSY
+                };
+
+                struct slot_t {
+                    Resize buffer;
+                    uint32_t seq;
+                    std::atomic<uint8_t> state;
+                } _slots[2];
                 T *_fomo;
-                uint8_t _numListeners;
                 OnNothingCallback _onNothing;
-                struct {
-                    String label;
-                    OnObjectCallback callback;
-                } _callbacks[EI_CLASSIFIER_LABEL_COUNT + 1];
+                OnObjectCallback _onAny;
+                OnObjectCallback _onLabel[EI_CLASSIFIER_LABEL_COUNT];
+
+                /**
+                 * Get a slot to decode into (producer side).
+                 * If the consumer is slower than the camera,
+                 * the pending (stale) frame is overwritten
+                 */
+                slot_t* reserve() {
+                    for (uint8_t i = 0; i < 2; i++) {
+                        uint8_t expected = FREE;
+
+                        if (_slots[i].state.compare_exchange_strong(expected, FILLING))
+                            return &_slots[i];
+                    }
+
+                    for (uint8_t i = 0; i < 2; i++) {
+                        uint8_t expected = READY;
+
+                        if (_slots[i].state.compare_exchange_strong(expected, FILLING)) {
+                            stats.dropped += 1;
+                            return &_slots[i];
+                        }
+                    }
+
+                    return NULL;
+                }
+
+                /**
+                 * Get the most recent ready slot (consumer side)
+                 */
+                slot_t* take() {
+                    while (true) {
+                        slot_t *latest = NULL;
+
+                        for (uint8_t i = 0; i < 2; i++)
+                            if (_slots[i].state.load() == READY && (latest == NULL || _slots[i].seq > latest->seq))
+                                latest = &_slots[i];
+
+                        if (latest == NULL)
+                            return NULL;
+
+                        uint8_t expected = READY;
+
+                        // producer may have reclaimed it in the meantime
+                        if (latest->state.compare_exchange_strong(expected, BUSY))
+                            return latest;
+                    }
+                }
+
+                /**
+                 * Run listeners on latest results
+                 */
+                void dispatch() {
+                    if (!_fomo->foundAnyObject()) {
+                        if (_onNothing)
+                            _onNothing();
+                            
+                        return;
+                    }
+                        
+                    _fomo->forEach([this](int i, bbox_t& bbox) {
+                        if (_onAny)
+                            _onAny(i, bbox);
+
+                        if (bbox.labelIx < EI_CLASSIFIER_LABEL_COUNT && _onLabel[bbox.labelIx])
+                            _onLabel[bbox.labelIx](i, bbox);
+                    });
+                }
                 
             };
         }
@@ -4,11 +4,16 @@
 #include <esp_camera.h>
 #include <edge-impulse-sdk/dsp/image/image.hpp>
 #include "../extra/pubsub.h"
+#include "../extra/serialize/json.h"
+#include "../transform/resize.h"
 #include "./classifier.h"
 
 using namespace eloq;
 using eloq::camera;
 using ei::signal_t;
+using Eloquent::Extra::Serialize::Writer;
+using Eloquent::Extra::Serialize::JsonWriter;
+using Eloquent::Esp32cam::Transform::Resize;
 #if defined(ELOQUENT_EXTRA_PUBSUB_H)
 using Eloquent::Extra::PubSub;
 #endif
@@ -16,6 +21,15 @@ using Eloquent::Extra::PubSub;
 
 #define _EI_RGB_ (EI_CLASSIFIER_NN_INPUT_FRAME_SIZE > EI_CLASSIFIER_RAW_SAMPLE_COUNT)
 
+// int8 models: quantize pixels straight into the input tensor
+#ifndef ELOQUENT_EI_QUANTIZED_INPUT
+    #if (defined(EI_CLASSIFIER_QUANTIZATION_ENABLED) && EI_CLASSIFIER_QUANTIZATION_ENABLED == 1) || (defined(EI_CLASSIFIER_TFLITE_INPUT_QUANTIZED) && EI_CLASSIFIER_TFLITE_INPUT_QUANTIZED == 1)
+        #define ELOQUENT_EI_QUANTIZED_INPUT 1
+    #else
+        #define ELOQUENT_EI_QUANTIZED_INPUT 0
+    #endif
+#endif
+
 
 namespace Eloquent {
     namespace Esp32cam {
@@ -30,6 +44,16 @@ namespace Eloquent {
                     float proba;
                     size_t srcWidth;
                     size_t srcHeight;
+                    Resize input;
+                    struct {
+                        uint32_t hits;
+                        uint32_t misses;
+                        uint16_t age;
+                        uint8_t distance;
+                        bool hit;
+                        bool isValid;
+                        uint64_t signature;
+                    } cache;
                     #if defined(ELOQUENT_EXTRA_PUBSUB_H)
                     PubSub<ImageClassifier> mqtt;
                     #endif
@@ -45,44 +69,170 @@ namespace Eloquent {
                         #if defined(ELOQUENT_EXTRA_PUBSUB_H)
                         mqtt(this),
                         #endif
-                        _buf(NULL),
-                        _len(0) {
+                        srcWidth(0),
+                        srcHeight(0),
+                        _signalInput(&input),
+                        _isQuantizedPathSupported(true),
+                        _inference("EI inference") {
+                            memset(&cache, 0, sizeof(cache));
+                            memset(&_cacheConfig, 0, sizeof(_cacheConfig));
+                            configure(input);
                         }
 
                     /**
                      * Detect object from camera frame
                      */
                     virtual Exception& run() {
-                        // run EI model
                         benchmark.benchmark([this]() {
-                            camera.mutex.threadsafe([this]() {
-                                if (!beforeClassification())
-                                    return;
+                            if (!preprocess(input).isOk()) {
+                                exception.propagate(input);
+                                return;
+                            }
 
-                                error = run_classifier(&signal, &result, _isDebugEnabled);
-                            });
+                            classify(input);
                         });
 
-                        if (!exception.isOk())
-                            return exception;
+                        return exception;
+                    }
+
+                    /**
+                     * Get name of class at index
+                     */
+                    static const char* labelOf(uint8_t i) {
+                        return i < EI_CLASSIFIER_LABEL_COUNT ? ei_classifier_inferencing_categories[i] : "";
+                    }
+
+                    /**
+                     * Reuse last result when the model input looks
+                     * (almost) the same as the last classified one.
+                     * Similarity is the Hamming distance of the
+                     * 64 bit dHash of the input
+                     *
+                     * @param maxDistance max differing bits (0-64)
+                     * @param maxAge force a new inference after this many hits in a row
+                     */
+                    void cacheResults(uint8_t maxDistance = 4, uint16_t maxAge = 10) {
+                        _cacheConfig.enabled = true;
+                        _cacheConfig.maxDistance = maxDistance;
+                        _cacheConfig.maxAge = maxAge;
+                        cache.age = 0;
+                        cache.isValid = false;
+                    }
+
+                    /**
+                     * Always run inference
+                     */
+                    void dontCacheResults() {
+                        _cacheConfig.enabled = false;
+                        cache.isValid = false;
+                    }
+
+                    /**
+                     * Configure buffer to hold model input
+                     */
+                    void configure(Resize& buffer) {
+                        buffer.to(EI_CLASSIFIER_INPUT_WIDTH, EI_CLASSIFIER_INPUT_HEIGHT);
+
+                        #if _EI_RGB_
+                        buffer.rgb();
+                        #else
+                        buffer.gray();
+                        #endif
+                    }
+
+                    /**
+                     * Decode current camera frame into buffer.
+                     * Only holds the camera mutex while decoding.
+                     * Errors are reported on the buffer, so this
+                     * can run in a different task than classify()
+                     */
+                    Exception& preprocess(Resize& buffer) {
+                        camera.mutex.threadsafe([this, &buffer]() {
+                            if (!camera.hasFrame()) {
+                                buffer.exception.set("Cannot run EI model on empty frame");
+                                return;
+                            }
+
+                            if (camera.frame->width < EI_CLASSIFIER_INPUT_WIDTH || camera.frame->height < EI_CLASSIFIER_INPUT_HEIGHT) {
+                                buffer.exception.set("Cannot run EI model on resolution lower than model");
+                                return;
+                            }
+
+                            srcWidth = camera.frame->width;
+                            srcHeight = camera.frame->height;
+                            buffer.decode(camera.frame);
+                            buffer.seq = camera.seq;
+                        }, 1000);
 
                         if (!camera.mutex.isOk())
-                            return exception.set("Cannot acquire mutex for camera frame");
+                            return buffer.exception.set("Cannot acquire mutex for camera frame");
+
+                        return buffer.exception;
+                    }
+
+                    /**
+                     * Run model on preprocessed buffer.
+                     * Inference runs without holding mutex: results are
+                     * only swapped in under it, so readers on other
+                     * tasks (telemetry, MQTT) never wait for a whole inference
+                     */
+                    Exception& classify(Resize& buffer) {
+                        // the SDK is not reentrant
+                        _inference.threadsafe([this, &buffer]() {
+                            if (isCached(buffer)) {
+                                mutex.threadsafe([this, &buffer]() {
+                                    afterClassification();
+                                    timing.dsp = timing.classification = timing.anomaly = timing.total = 0;
+                                    seq = buffer.seq;
+                                });
+
+                                exception.clear();
+                                return;
+                            }
+
+                            if (!infer(buffer)) {
+                                cache.isValid = false;
+                                exception.set(String("Failed to run classifier with error code 0x") + error);
+                                return;
+                            }
 
-                        if (error != EI_IMPULSE_OK)
-                            return exception.set(String("Failed to run classifier with error code 0x") + error);
+                            mutex.threadsafe([this, &buffer]() {
+                                keep(_pending);
+                                afterClassification();
+                                breakTiming();
+                                seq = buffer.seq;
+                            });
+
+                            exception.clear();
+                        });
+
+                        return exception;
+                    }
+
+                    /**
+                     * Serialize result
+                     */
+                    virtual void serializeTo(Writer& writer) {
+                        writer.beginObject(2);
+                        writer.kv("label", label);
+                        writer.kv("proba", proba);
+                        writer.endObject();
+                    }
+
+                    /**
+                     * Stream JSON to printer (no heap allocation)
+                     */
+                    void toJSON(Print& printer) {
+                        JsonWriter json(printer);
 
-                        afterClassification();
-                        breakTiming();
-                        
-                        return exception.clear();
+                        serializeTo(json);
                     }
 
                     /**
                      * Convert to JSON string
                      */
-                    virtual String toJSON() {
-                        return String("{\"label\":\"") + label + "\",\"proba\":" + proba + "}";
+                    String toJSON() {
+                        return JsonWriter::stringify(*this);
                     }
 
                     /**
@@ -93,85 +243,131 @@ namespace Eloquent {
                     }
 
                 protected:
-                    uint8_t *_buf;
-                    size_t _len;
-                    float _dx;
-                    float _dy;
+
+                    Resize *_signalInput;
+                    bool _isQuantizedPathSupported;
+                    Mutex _inference;
+                    ei_impulse_result_t _pending;
+                    #if EI_CLASSIFIER_OBJECT_DETECTION == 1
+                    ei_impulse_result_bounding_box_t _boxes[EI_CLASSIFIER_OBJECT_DETECTION_COUNT];
+                    #endif
+                    struct {
+                        bool enabled;
+                        uint8_t maxDistance;
+                        uint16_t maxAge;
+                        uint16_t x;
+                        uint16_t y;
+                        uint16_t width;
+                        uint16_t height;
+                    } _cacheConfig;
 
                     /**
-                     * 
+                     * Run SDK on buffer into pending results.
+                     * Must hold _inference
                      */
-                    bool beforeClassification() {
-                        if (!camera.hasFrame())
-                            return exception.set("Cannot run EI model on empty frame").isOk();
-
-                        if (camera.pixformat.isRGB565()) {
-                            _buf = camera.frame->buf;
-                            _len = camera.frame->len;
-                            srcWidth = camera.resolution.getWidth();
-                            srcHeight = camera.resolution.getHeight();
-
-                            // rgb 565 bytes are swapped!
-                            for (int i = 0; i < _len; i += 2) {
-                                const uint8_t a = _buf[i];
-                                const uint8_t b = _buf[i + 1];
-                                
-                                _buf[i] = b;
-                                _buf[i + 1] = a;
-                            }
-                        }
-                        else if (camera.pixformat.isJpeg()) {
-                            const uint8_t ratioW = camera.resolution.getWidth() / EI_CLASSIFIER_INPUT_WIDTH;
-                            const uint8_t ratioH = camera.resolution.getHeight() / EI_CLASSIFIER_INPUT_HEIGHT;
-                            const uint8_t logScaleW = log(ratioW);
-                            const uint8_t logScaleH = log(ratioH);
-                            const uint8_t logScale  = min(logScaleW, logScaleH) / log(2);
-                            const uint8_t scale = pow(2, logScale);
-                            const uint16_t newWidth = camera.resolution.getWidth() / scale;
-                            const uint16_t newHeight = camera.resolution.getHeight() / scale;
-                            const uint16_t newSize = newWidth * newHeight;
-
-                            if (_len != newSize * 2) {
-                                ESP_LOGI(
-                                    "EI", 
-                                    "(Re)Allocating %d bytes for JPEG decoding into image of size %dx%d. Log scale = %d", 
-                                    newSize * 2, 
-                                    newWidth, 
-                                    newHeight, 
-                                    logScale
-                                );
-                                _len = newSize * 2;
-                                srcWidth = newWidth;
-                                srcHeight = newHeight;
-
-                                if (_buf == NULL) _buf = (uint8_t*) malloc(newSize * 2);
-                                else _buf = (uint8_t*) realloc(_buf, newSize * 2);
+                    bool infer(Resize& buffer) {
+                        _signalInput = &buffer;
+                        signal.get_data = [this](size_t offset, size_t length, float *out) {
+                            return getData(offset, length, out);
+                        };
+
+                        #if ELOQUENT_EI_QUANTIZED_INPUT
+                            // skips the float feature matrix: pixels are
+                            // quantized with the tensor scale / zero point
+                            // while being read from get_data
+                            if (_isQuantizedPathSupported) {
+                                error = run_classifier_image_quantized(&signal, &_pending, _isDebugEnabled);
+
+                                // only give up on the quantized path for good
+                                // if the model can't use it; other errors
+                                // (e.g. out of memory) are reported as is
+                                if (isUnsupported(error)) {
+                                    ESP_LOGW("EI", "Quantized input path not supported (error %d), falling back to float", (int) error);
+                                    _isQuantizedPathSupported = false;
+                                }
                             }
 
-                            if (_buf == NULL)
-                                return exception.set("Cannot allocate buffer memory");
+                            if (!_isQuantizedPathSupported)
+                                error = run_classifier(&signal, &_pending, _isDebugEnabled);
+                        #else
+                            error = run_classifier(&signal, &_pending, _isDebugEnabled);
+                        #endif
 
-                            if (!jpg2rgb565(camera.frame->buf, camera.frame->len, _buf, (jpg_scale_t) logScale))
-                                return exception.set("Cannot convert frame from JPEG to RGB565").isOk();
-                        }
-                        else {
-                            _buf = NULL;
-                            _len = 0;
-                            return exception.set("Unknown image format. Only jpeg and RGB565 are allowed").isOk();
-                        }
+                        return error == EI_IMPULSE_OK;
+                    }
 
-                        if (_buf == NULL)
-                            return exception.set("Error allocating memory buffer");
+                    /**
+                     * Publish pending results.
+                     * The SDK writes bounding boxes into static storage
+                     * that the next inference overwrites, so they're copied.
+                     * Must hold mutex
+                     */
+                    void keep(const ei_impulse_result_t& pending) {
+                        result = pending;
 
-                        if (srcWidth < EI_CLASSIFIER_INPUT_WIDTH || srcHeight < EI_CLASSIFIER_INPUT_HEIGHT)
-                            return exception.set("Cannot run EI model on resolution lower than model").isOk();
+                        #if EI_CLASSIFIER_OBJECT_DETECTION == 1
+                            const size_t count = min<size_t>(pending.bounding_boxes_count, EI_CLASSIFIER_OBJECT_DETECTION_COUNT);
 
-                        _dx = ((float) srcWidth) / EI_CLASSIFIER_INPUT_WIDTH;
-                        _dy = ((float) srcHeight) / EI_CLASSIFIER_INPUT_HEIGHT;
+                            memset(_boxes, 0, sizeof(_boxes));
+                            memcpy(_boxes, pending.bounding_boxes, count * sizeof(ei_impulse_result_bounding_box_t));
+                            result.bounding_boxes = _boxes;
+                            result.bounding_boxes_count = count;
+                        #endif
+                    }
 
-                        signal.get_data = [this](size_t offset, size_t length, float *out) {
-                            return getData(offset, length, out);
-                        };
+                    /**
+                     * Test if error means the quantized input
+                     * path can't be used with this model
+                     */
+                    static bool isUnsupported(EI_IMPULSE_ERROR error) {
+                        return error == EI_IMPULSE_ONLY_SUPPORTED_FOR_IMAGES || error == EI_IMPULSE_UNSUPPORTED_INFERENCING_ENGINE;
+                    }
+
+                    /**
+                     * Test if last result can be reused for buffer.
+                     * Only compares inputs taken from the same region,
+                     * so tiles and crops never share results
+                     */
+                    bool isCached(Resize& buffer) {
+                        cache.hit = false;
+
+                        if (!_cacheConfig.enabled)
+                            return false;
+
+                        const uint64_t signature = buffer.dhash();
+                        const bool isSameRegion =
+                            _cacheConfig.x == buffer.region.x && _cacheConfig.y == buffer.region.y &&
+                            _cacheConfig.width == buffer.region.width && _cacheConfig.height == buffer.region.height;
+
+                        cache.distance = __builtin_popcountll(signature ^ cache.signature);
+
+                        if (cache.isValid && isSameRegion && cache.distance <= _cacheConfig.maxDistance && cache.age < _cacheConfig.maxAge) {
+                            cache.hit = true;
+                            cache.hits += 1;
+                            cache.age += 1;
+
+                            return true;
+                        }
+
+                        // miss: remember this input as reference
+                        cache.misses += 1;
+                        cache.age = 0;
+                        cache.signature = signature;
+                        cache.isValid = true;
+                        _cacheConfig.x = buffer.region.x;
+                        _cacheConfig.y = buffer.region.y;
+                        _cacheConfig.width = buffer.region.width;
+                        _cacheConfig.height = buffer.region.height;
+
+                        return false;
+                    }
+
+                    /**
+                     * Decode frame into model input
+                     */
+                    bool beforeClassification() {
+                        if (!preprocess(input).isOk())
+                            return exception.propagate(input).isOk();
 
                         return true;
                     }
@@ -180,6 +376,8 @@ namespace Eloquent {
                      * 
                      */
                     void afterClassification() {
+                        proba = 0;
+
                         // find most probable class
                         for (uint8_t i = 0; i < EI_CLASSIFIER_LABEL_COUNT; i++) {
                             const float value = result.classification[i].value;
@@ -193,50 +391,26 @@ namespace Eloquent {
                     }
 
                     /**
-                     * Get image data as RGB 24 bit
+                     * Pack decoded pixels as EI expects them (0xRRGGBB float).
+                     * The buffer is already at model size, so it's a linear copy
                      */
                     int getData(size_t offset, size_t length, float *out) {
-                        size_t i = 0;
-                        const size_t end = min((int) EI_CLASSIFIER_RAW_SAMPLE_COUNT, (int) (offset + length));
-
-                        for (uint16_t y = 0; y < EI_CLASSIFIER_INPUT_HEIGHT; y++) {
-                            const size_t offsetY = ((size_t) (y * _dy)) * srcWidth;
-
-                            for (uint16_t x = 0; x < EI_CLASSIFIER_INPUT_WIDTH; x++, i++) {
-                                if (i < offset)
-                                    continue;
-
-                                if (i >= end)
-                                    return 0;
-
-                                const size_t j = offsetY + (x * _dx);
-                                const uint16_t pixel = ((uint16_t*) _buf)[j];
-                                uint32_t r;
-                                uint16_t g;
-                                uint8_t b;
-
-                                toRGB(pixel, &r, &g, &b);
-
-                                #if _EI_RGB_
-                                    out[i - offset] = (r << 16) | (g << 8) | b;
-                                #else
-                                    const uint32_t gray = constrain((r * 38 + g * 75 + b * 15) >> 7, 0, 255);
-                                    out[i - offset] = (gray << 16) | (gray << 8) | gray;
-                                #endif
-                            }
+                        const size_t end = min((size_t) EI_CLASSIFIER_RAW_SAMPLE_COUNT, offset + length);
+                        const uint8_t *p = _signalInput->pixels + offset * _signalInput->channels;
+
+                        for (size_t i = offset; i < end; i++) {
+                            #if _EI_RGB_
+                                *out++ = (p[0] << 16) | (p[1] << 8) | p[2];
+                                p += 3;
+                            #else
+                                const uint32_t gray = *p++;
+
+                                *out++ = (gray << 16) | (gray << 8) | gray;
+                            #endif
                         }
 
                         return 0;
                     }
-
-                    /**
-                     * Convert high/low RGB565 bytes to R, G, B
-                    */
-                    void toRGB(const uint16_t pixel, uint32_t *r, uint16_t *g, uint8_t *b) {
-                        *r = (pixel >> 8) & 0b11111000;
-                        *g = (pixel & 0b11111100000) >> 3;
-                        *b = (pixel & 0b11111) << 3;
-                    }
             };
         }
     }
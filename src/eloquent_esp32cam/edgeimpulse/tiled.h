@@ -0,0 +1,402 @@
+#ifndef ELOQUENT_ESP32CAM_EDGEIMPULSE_TILED_H
+#define ELOQUENT_ESP32CAM_EDGEIMPULSE_TILED_H
+
+#include <functional>
+#include "../camera/camera.h"
+#include "../transform/resize.h"
+#include "../extra/exception.h"
+#include "../extra/time/benchmark.h"
+#include "../extra/tracking/tracker.h"
+#include "./bbox.h"
+
+#ifndef EI_TILED_MAX_TILES
+#define EI_TILED_MAX_TILES 16
+#endif
+
+#ifndef EI_TILED_MAX_DETECTIONS
+#define EI_TILED_MAX_DETECTIONS 32
+#endif
+
+using eloq::camera;
+using eloq::ei::bbox_t;
+using Eloquent::Error::Exception;
+using Eloquent::Extra::Time::Benchmark;
+using Eloquent::Esp32cam::Transform::Resize;
+
+
+namespace Eloquent {
+    namespace Esp32cam {
+        namespace EdgeImpulse {
+            /**
+             * Run a classifier on overlapping model-sized tiles
+             * of a high resolution frame, then merge results with NMS.
+             * Small objects that vanish when the whole frame is
+             * squashed into the model input stay visible.
+             * All tiles are decoded from the frame in a single JPEG pass
+             * (one model-sized buffer per tile), then classified by
+             * priority within a time budget;
+             * tiles skipped in a frame gain priority in the next one.
+             *
+             * Works with FOMO (boxes are mapped back to frame coordinates)
+             * and with image classification (each tile is a box).
+             * Don't enable tracking on the underlying classifier
+             *
+             * @tparam T ImageClassifier subclass
+             */
+            template<typename T>
+            class Tiled {
+                public:
+                    struct tile_t {
+                        uint16_t x;
+                        uint16_t y;
+                        uint16_t width;
+                        uint16_t height;
+                        uint8_t age;
+                        uint8_t hits;
+                        float priority;
+                    };
+
+                    using PriorityHint = std::function<float(const tile_t&)>;
+
+                    Exception exception;
+                    Benchmark benchmark;
+                    Resize inputs[EI_TILED_MAX_TILES];
+                    tile_t tiles[EI_TILED_MAX_TILES];
+                    bbox_t detections[EI_TILED_MAX_DETECTIONS];
+                    uint8_t numTiles;
+                    uint8_t numDetections;
+                    uint8_t processed;
+
+                    /**
+                     * Constructor
+                     */
+                    Tiled(T& classifier) :
+                        exception("Tiled"),
+                        numTiles(0),
+                        numDetections(0),
+                        processed(0),
+                        _classifier(classifier),
+                        _cols(2),
+                        _rows(2),
+                        _overlap(0.2f),
+                        _budget(0),
+                        _threshold(0.5f),
+                        _nmsIoU(0.4f),
+                        _frameWidth(0),
+                        _frameHeight(0) {
+                            for (uint8_t i = 0; i < EI_TILED_MAX_TILES; i++)
+                                _classifier.configure(inputs[i]);
+                        }
+
+                    /**
+                     * Set tile grid.
+                     * Overlap is the fraction of each tile shared with its neighbour
+                     */
+                    void grid(uint8_t cols, uint8_t rows, float overlap = 0.2f) {
+                        if (cols * rows > EI_TILED_MAX_TILES) {
+                            ESP_LOGE("Tiled", "Max %d tiles allowed", EI_TILED_MAX_TILES);
+                            return;
+                        }
+
+                        _cols = max<uint8_t>(1, cols);
+                        _rows = max<uint8_t>(1, rows);
+                        _overlap = constrain(overlap, 0.0f, 0.9f);
+                        _frameWidth = 0;
+                    }
+
+                    /**
+                     * Max time to spend on a frame, in millis (0 = no limit).
+                     * The first tile is always processed
+                     */
+                    void budget(uint16_t ms) {
+                        _budget = ms;
+                    }
+
+                    /**
+                     * Min confidence to keep a detection
+                     */
+                    void confidence(float threshold) {
+                        _threshold = threshold;
+                    }
+
+                    /**
+                     * IoU above which same-label detections are merged
+                     */
+                    void nms(float iou) {
+                        _nmsIoU = iou;
+                    }
+
+                    /**
+                     * Extra priority for each tile (e.g. motion inside the tile)
+                     */
+                    void priority(PriorityHint hint) {
+                        _hint = hint;
+                    }
+
+                    /**
+                     * Test if anything was found
+                     */
+                    inline bool found() const {
+                        return numDetections > 0;
+                    }
+
+                    /**
+                     * Run function on each detection
+                     */
+                    template<typename Callback>
+                    void forEach(Callback callback) {
+                        for (uint8_t i = 0; i < numDetections; i++)
+                            callback(i, detections[i]);
+                    }
+
+                    /**
+                     * Classify current frame tile by tile
+                     */
+                    Exception& run() {
+                        numDetections = 0;
+                        processed = 0;
+
+                        if (!camera.hasFrame())
+                            return exception.set("Cannot run on empty frame");
+
+                        layout(camera.frame->width, camera.frame->height);
+                        sort();
+
+                        benchmark.benchmark([this]() {
+                            // inputs[i] holds the i-th tile in priority order
+                            if (decode() == 0)
+                                return;
+
+                            const size_t startedAt = millis();
+
+                            for (uint8_t i = 0; i < numTiles; i++) {
+                                tile_t &tile = tiles[_order[i]];
+                                Resize &input = inputs[i];
+                                const size_t elapsed = millis() - startedAt;
+
+                                // stop if the next tile won't fit in budget
+                                if (processed > 0 && _budget > 0 && elapsed + elapsed / processed > _budget)
+                                    break;
+
+                                if (!input.exception.isOk() || !_classifier.classify(input).isOk())
+                                    continue;
+
+                                tile.age = 0;
+                                tile.hits = collect(tile, input);
+                                processed += 1;
+                            }
+                        });
+
+                        // skipped tiles get more priority next time
+                        for (uint8_t i = 0; i < numTiles; i++)
+                            if (tiles[i].age < 255)
+                                tiles[i].age += 1;
+
+                        suppress();
+
+                        if (processed == 0)
+                            return exception.set("No tile could be processed");
+
+                        return exception.clear();
+                    }
+
+                protected:
+                    T& _classifier;
+                    uint8_t _cols;
+                    uint8_t _rows;
+                    float _overlap;
+                    uint16_t _budget;
+                    float _threshold;
+                    float _nmsIoU;
+                    uint16_t _frameWidth;
+                    uint16_t _frameHeight;
+                    uint8_t _order[EI_TILED_MAX_TILES];
+                    PriorityHint _hint;
+
+                    /**
+                     * Compute tile positions.
+                     * Only runs when frame size or grid changes
+                     */
+                    void layout(uint16_t width, uint16_t height) {
+                        if (_frameWidth == width && _frameHeight == height)
+                            return;
+
+                        const float tileWidth = width / (_cols - (_cols - 1) * _overlap);
+                        const float tileHeight = height / (_rows - (_rows - 1) * _overlap);
+                        const float strideX = tileWidth * (1 - _overlap);
+                        const float strideY = tileHeight * (1 - _overlap);
+
+                        numTiles = 0;
+
+                        for (uint8_t row = 0; row < _rows; row++) {
+                            for (uint8_t col = 0; col < _cols; col++) {
+                                tile_t &tile = tiles[numTiles++];
+
+                                tile.x = col * strideX;
+                                tile.y = row * strideY;
+                                tile.width = min<uint16_t>(tileWidth, width - tile.x);
+                                tile.height = min<uint16_t>(tileHeight, height - tile.y);
+                                tile.age = 0;
+                                tile.hits = 0;
+                            }
+                        }
+
+                        _frameWidth = width;
+                        _frameHeight = height;
+                        ESP_LOGI("Tiled", "Split %dx%d frame into %d tiles of %dx%d", width, height, numTiles, (int) tileWidth, (int) tileHeight);
+                    }
+
+                    /**
+                     * Decode all tiles of the current frame at once.
+                     * Returns number of tiles decoded
+                     */
+                    uint8_t decode() {
+                        Resize *targets[EI_TILED_MAX_TILES];
+                        uint8_t decoded = 0;
+
+                        for (uint8_t i = 0; i < numTiles; i++) {
+                            const tile_t &tile = tiles[_order[i]];
+
+                            inputs[i].crop(tile.x, tile.y, tile.width, tile.height);
+                            targets[i] = &inputs[i];
+                        }
+
+                        camera.mutex.threadsafe([this, &targets, &decoded]() {
+                            // tiles were laid out for this frame size
+                            if (!camera.hasFrame() || camera.frame->width != _frameWidth || camera.frame->height != _frameHeight)
+                                return;
+
+                            decoded = Resize::decodeAll(camera.frame, targets, numTiles);
+
+                            for (uint8_t i = 0; i < numTiles; i++)
+                                inputs[i].seq = camera.seq;
+                        }, 1000);
+
+                        if (decoded == 0)
+                            exception.set("Cannot decode tiles");
+
+                        return decoded;
+                    }
+
+                    /**
+                     * Order tiles by priority: user hint, then tiles
+                     * that had detections last time, then the ones
+                     * that waited the longest
+                     */
+                    void sort() {
+                        for (uint8_t i = 0; i < numTiles; i++) {
+                            tile_t &tile = tiles[i];
+
+                            tile.priority = (_hint ? _hint(tile) : 0) + (tile.hits > 0 ? 1 : 0) + 0.1f * tile.age;
+                            _order[i] = i;
+                        }
+
+                        // insertion sort, numTiles is tiny
+                        for (uint8_t i = 1; i < numTiles; i++) {
+                            const uint8_t current = _order[i];
+                            int8_t j = i - 1;
+
+                            for (; j >= 0 && tiles[_order[j]].priority < tiles[current].priority; j--)
+                                _order[j + 1] = _order[j];
+
+                            _order[j + 1] = current;
+                        }
+                    }
+
+                    /**
+                     * Append tile results in frame coordinates.
+                     * Returns number of detections found in tile
+                     */
+                    uint8_t collect(const tile_t& tile, const Resize& input) {
+                        uint8_t count = 0;
+                        auto& result = _classifier.result;
+
+                        #if EI_CLASSIFIER_OBJECT_DETECTION == 1
+                            for (size_t ix = 0; ix < result.bounding_boxes_count; ix++) {
+                                auto bb = result.bounding_boxes[ix];
+
+                                if (bb.value < _threshold)
+                                    continue;
+
+                                const int16_t x1 = input.toSourceX(bb.x);
+                                const int16_t y1 = input.toSourceY(bb.y);
+                                const int16_t x2 = input.toSourceX(bb.x + bb.width);
+                                const int16_t y2 = input.toSourceY(bb.y + bb.height);
+
+                                if (!append(bb.label, T::labelIndexOf(bb.label), bb.value, x1, y1, x2 - x1, y2 - y1))
+                                    break;
+
+                                count += 1;
+                            }
+                        #else
+                            uint8_t best = 0;
+
+                            for (uint8_t i = 1; i < EI_CLASSIFIER_LABEL_COUNT; i++)
+                                if (result.classification[i].value > result.classification[best].value)
+                                    best = i;
+
+                            const float proba = result.classification[best].value;
+
+                            if (proba >= _threshold && append(ei_classifier_inferencing_categories[best], best, proba, tile.x, tile.y, tile.width, tile.height))
+                                count += 1;
+                        #endif
+
+                        return count;
+                    }
+
+                    /**
+                     * Add detection, if room is left
+                     */
+                    bool append(const char *label, uint8_t labelIx, float proba, uint16_t x, uint16_t y, uint16_t width, uint16_t height) {
+                        if (numDetections >= EI_TILED_MAX_DETECTIONS) {
+                            ESP_LOGW("Tiled", "Max number of detections reached");
+                            return false;
+                        }
+
+                        detections[numDetections++] = bbox_t(label, labelIx, proba, x, y, width, height);
+
+                        return true;
+                    }
+
+                    /**
+                     * Greedy non maximum suppression (per label)
+                     */
+                    void suppress() {
+                        // sort by descending proba
+                        for (uint8_t i = 1; i < numDetections; i++) {
+                            bbox_t current = detections[i];
+                            int8_t j = i - 1;
+
+                            for (; j >= 0 && detections[j].proba < current.proba; j--)
+                                detections[j + 1] = detections[j];
+
+                            detections[j + 1] = current;
+                        }
+
+                        uint8_t kept = 0;
+
+                        for (uint8_t i = 0; i < numDetections; i++) {
+                            bool isDuplicate = false;
+
+                            for (uint8_t k = 0; k < kept && !isDuplicate; k++)
+                                isDuplicate = detections[k].labelIx == detections[i].labelIx && iou(detections[k], detections[i]) > _nmsIoU;
+
+                            if (!isDuplicate)
+                                detections[kept++] = detections[i];
+                        }
+
+                        numDetections = kept;
+                    }
+
+                    /**
+                     *
+                     */
+                    static float iou(const bbox_t& a, const bbox_t& b) {
+                        return Eloquent::Extra::Tracking::Tracker<bbox_t, 1>::iou(a, b);
+                    }
+            };
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,335 @@
+#ifndef ELOQUENT_EXTRA_ESP32_FS_ASYNC_WRITER
+#define ELOQUENT_EXTRA_ESP32_FS_ASYNC_WRITER
+
+#include <functional>
+#include <FS.h>
+#include "../../exception.h"
+#include "../../serialize/writer.h"
+#include "../multiprocessing/thread.h"
+#include "../multiprocessing/mutex.h"
+
+#ifndef FS_ASYNC_QUEUE_SIZE
+#define FS_ASYNC_QUEUE_SIZE 4
+#endif
+
+using Eloquent::Error::Exception;
+using Eloquent::Extra::Serialize::Writer;
+using Eloquent::Extra::Esp32::Multiprocessing::Thread;
+using Eloquent::Extra::Esp32::Multiprocessing::Mutex;
+
+
+namespace Eloquent {
+    namespace Extra {
+        namespace Esp32 {
+            namespace Fs {
+                /**
+                 * What to do when a write is queued
+                 * and the queue is full
+                 */
+                enum class Overflow : uint8_t {
+                    DROP_OLDEST,
+                    DROP_NEWEST,
+                    BLOCK
+                };
+
+                /**
+                 * Write files on a dedicated task.
+                 * Content is copied into a bounded queue of
+                 * reusable buffers (PSRAM if available), so the
+                 * caller's frame can be released right away and
+                 * slow storage (SD_MMC) never stalls the capture loop
+                 */
+                class AsyncWriter {
+                    public:
+                        using Callback = std::function<void(const String&, bool)>;
+
+                        Exception exception;
+                        Thread thread;
+                        struct {
+                            uint32_t queued;
+                            uint32_t written;
+                            uint32_t dropped;
+                            uint32_t errors;
+                            uint8_t depth;
+                            uint8_t maxDepth;
+                            size_t latency;
+                            float avgLatency;
+                            float throughput;
+                        } stats;
+
+                        /**
+                         * Constructor
+                         */
+                        AsyncWriter(fs::FS *filesystem) :
+                            exception("AsyncWriter"),
+                            thread("AsyncWriter"),
+                            _fs(filesystem),
+                            _mutex("AsyncWriter"),
+                            _ready(NULL),
+                            _isRunning(false),
+                            _overflow(Overflow::DROP_OLDEST),
+                            _head(0),
+                            _count(0) {
+                                memset(&stats, 0, sizeof(stats));
+
+                                for (uint8_t i = 0; i < FS_ASYNC_QUEUE_SIZE; i++) {
+                                    _jobs[i].buf = NULL;
+                                    _jobs[i].capacity = 0;
+                                }
+
+                                _current.buf = NULL;
+                                _current.capacity = 0;
+                            }
+
+                        /**
+                         * Set overflow policy
+                         */
+                        void overflow(Overflow policy) {
+                            _overflow = policy;
+                        }
+
+                        /**
+                         * Run function after each file is written,
+                         * with the file path and the outcome
+                         */
+                        void onComplete(Callback callback) {
+                            _onComplete = callback;
+                        }
+
+                        /**
+                         * Start writer task (once)
+                         */
+                        Exception& begin() {
+                            if (_isRunning)
+                                return exception.clear();
+
+                            _ready = xSemaphoreCreateBinary();
+
+                            if (_ready == NULL)
+                                return exception.set("Cannot create semaphore");
+
+                            _isRunning = true;
+
+                            thread
+                                .withArgs((void*) this)
+                                .withStackSize(4000)
+                                .withPriority(1)
+                                .run([](void *args) {
+                                    AsyncWriter *self = (AsyncWriter*) args;
+
+                                    while (true) {
+                                        xSemaphoreTake(self->_ready, portMAX_DELAY);
+
+                                        while (self->pop())
+                                            self->write();
+                                    }
+                                });
+
+                            return exception.clear();
+                        }
+
+                        /**
+                         * Queue content to be written at path.
+                         * Returns as soon as the content is copied
+                         */
+                        Exception& push(const uint8_t *data, size_t length, String path) {
+                            if (!_isRunning && !begin().isOk())
+                                return exception;
+
+                            bool isQueued = false;
+                            bool isFull = true;
+
+                            while (true) {
+                                _mutex.threadsafe([this, data, length, &path, &isQueued, &isFull]() {
+                                    isFull = _count >= FS_ASYNC_QUEUE_SIZE;
+
+                                    if (isFull) {
+                                        if (_overflow == Overflow::BLOCK)
+                                            return;
+
+                                        stats.dropped += 1;
+
+                                        if (_overflow == Overflow::DROP_NEWEST)
+                                            return;
+
+                                        ESP_LOGW("AsyncWriter", "Queue full, dropping %s", _jobs[_head].path.c_str());
+                                        _head = (_head + 1) % FS_ASYNC_QUEUE_SIZE;
+                                        _count -= 1;
+                                    }
+
+                                    isQueued = enqueue(data, length, path);
+                                });
+
+                                // wait for the writer to make room
+                                if (isFull && _overflow == Overflow::BLOCK && !isQueued) {
+                                    delay(1);
+                                    continue;
+                                }
+
+                                break;
+                            }
+
+                            if (isFull && _overflow == Overflow::DROP_NEWEST)
+                                return exception.set(String("Queue full, dropping ") + path).soft();
+
+                            if (!isQueued)
+                                return exception.set("Cannot allocate buffer");
+
+                            xSemaphoreGive(_ready);
+
+                            return exception.clear();
+                        }
+
+                        /**
+                         * Number of files waiting to be written
+                         */
+                        uint8_t depth() {
+                            uint8_t depth = 0;
+
+                            _mutex.threadsafe([this, &depth]() {
+                                depth = _count;
+                            });
+
+                            return depth;
+                        }
+
+                        /**
+                         * Serialize stats
+                         */
+                        void serializeTo(Writer& writer) {
+                            writer.beginObject(8);
+                            writer.kv("depth", depth());
+                            writer.kv("max_depth", stats.maxDepth);
+                            writer.kv("queued", stats.queued);
+                            writer.kv("written", stats.written);
+                            writer.kv("dropped", stats.dropped);
+                            writer.kv("errors", stats.errors);
+                            writer.kv("latency_ms", stats.avgLatency);
+                            writer.kv("throughput", stats.throughput);
+                            writer.endObject();
+                        }
+
+                    protected:
+                        struct job_t {
+                            uint8_t *buf;
+                            size_t length;
+                            size_t capacity;
+                            size_t queuedAt;
+                            String path;
+                        };
+
+                        fs::FS *_fs;
+                        Mutex _mutex;
+                        SemaphoreHandle_t _ready;
+                        bool _isRunning;
+                        Overflow _overflow;
+                        Callback _onComplete;
+                        uint8_t _head;
+                        uint8_t _count;
+                        job_t _jobs[FS_ASYNC_QUEUE_SIZE];
+                        job_t _current;
+
+                        /**
+                         * Copy content to the tail slot.
+                         * Must hold mutex
+                         */
+                        bool enqueue(const uint8_t *data, size_t length, const String& path) {
+                            job_t &job = _jobs[(_head + _count) % FS_ASYNC_QUEUE_SIZE];
+
+                            if (length > job.capacity) {
+                                ::free(job.buf);
+                                job.capacity = length * 5 / 4;
+                                job.buf = (uint8_t*) (psramFound() ? ps_malloc(job.capacity) : malloc(job.capacity));
+                            }
+
+                            if (job.buf == NULL) {
+                                job.capacity = 0;
+                                return false;
+                            }
+
+                            memcpy(job.buf, data, length);
+                            job.length = length;
+                            job.path = path;
+                            job.queuedAt = millis();
+                            _count += 1;
+                            stats.queued += 1;
+                            stats.depth = _count;
+                            stats.maxDepth = max(stats.maxDepth, _count);
+
+                            return true;
+                        }
+
+                        /**
+                         * Move head job to the writer's own slot.
+                         * Buffers are swapped, not copied, so producers
+                         * can refill the queue while writing
+                         */
+                        bool pop() {
+                            bool isPopped = false;
+
+                            _mutex.threadsafe([this, &isPopped]() {
+                                if (_count == 0)
+                                    return;
+
+                                job_t &job = _jobs[_head];
+                                uint8_t *buf = _current.buf;
+                                const size_t capacity = _current.capacity;
+
+                                _current.buf = job.buf;
+                                _current.capacity = job.capacity;
+                                _current.length = job.length;
+                                _current.queuedAt = job.queuedAt;
+                                _current.path = job.path;
+                                job.buf = buf;
+                                job.capacity = capacity;
+
+                                _head = (_head + 1) % FS_ASYNC_QUEUE_SIZE;
+                                _count -= 1;
+                                stats.depth = _count;
+                                isPopped = true;
+                            });
+
+                            return isPopped;
+                        }
+
+                        /**
+                         * Write current job to file (runs in writer task)
+                         */
+                        void write() {
+                            const size_t startedAt = millis();
+                            bool isOk = false;
+                            File file = _fs->open(_current.path, "wb");
+
+                            if (file) {
+                                isOk = file.write(_current.buf, _current.length) == _current.length;
+                                file.close();
+                            }
+
+                            const size_t now = millis();
+                            const size_t elapsed = now - startedAt;
+
+                            stats.latency = now - _current.queuedAt;
+                            stats.avgLatency = stats.avgLatency > 0 ? 0.9f * stats.avgLatency + 0.1f * stats.latency : stats.latency;
+
+                            if (isOk) {
+                                const float throughput = _current.length * 1000.0f / max<size_t>(elapsed, 1);
+
+                                stats.written += 1;
+                                stats.throughput = stats.throughput > 0 ? 0.9f * stats.throughput + 0.1f * throughput : throughput;
+                                ESP_LOGD("AsyncWriter", "Written %u bytes to %s in %u ms", (unsigned int) _current.length, _current.path.c_str(), (unsigned int) elapsed);
+                            }
+                            else {
+                                stats.errors += 1;
+                                ESP_LOGE("AsyncWriter", "Cannot write file %s", _current.path.c_str());
+                            }
+
+                            if (_onComplete)
+                                _onComplete(_current.path, isOk);
+                        }
+                };
+            }
+        }
+    }
+}
+
+#endif
@@ -4,9 +4,11 @@
 #include <FS.h>
 #include "../../exception.h"
 #include "../nvs/counter.h"
+#include "./async_writer.h"
 
 using Eloquent::Error::Exception;
 using Eloquent::Extra::Esp32::NVS::Counter;
+using Eloquent::Extra::Esp32::Fs::AsyncWriter;
 
 
 namespace Eloquent {
@@ -28,6 +30,7 @@ namespace Eloquent {
                         Exception exception;
                         Counter counter;
                         fs::FS *fsystem;
+                        AsyncWriter async;
 
                         /**
                          * 
@@ -42,7 +45,8 @@ namespace Eloquent {
                             lastFilename(""),
                             lastPath(""),
                             counter("cam_frames"),
-                            exception("WriteSession") {
+                            exception("WriteSession"),
+                            async(filesystem) {
 
                             }
 
@@ -91,23 +95,7 @@ namespace Eloquent {
                             if ((data == NULL || length == 0) && (text == NULL))
                                 return close("Cannot write empty data");
 
-                            if (filename == "")
-                                filename = counter.nextString();
-
-                            if (ext != "")
-                                filename += String(".") + ext;
-
-                            ESP_LOGI("FS::Write", "Filename = %s", filename.c_str());
-
-                            lastFilename = filename;
-                            
-                            if (folder != "") {
-                                filename = folder + '/' + filename;
-                            }
-
-                            folder = "";
-                            filename = toAbs(filename);
-                            filename.replace("//", "/");
+                            filename = resolve(filename, ext);
 
                             // write binary data
                             if (mode == "wb") {
@@ -144,8 +132,63 @@ namespace Eloquent {
                             return close("");
                         }
 
+                        /**
+                         * Like to(), but the file is written by
+                         * the async writer task: content is copied,
+                         * so it can be released right after.
+                         * lastPath is known immediately, the outcome is
+                         * reported to async.onComplete()
+                         */
+                        Exception& enqueue(String filename, String ext = "") {
+                            if ((data == NULL || length == 0) && (text == NULL))
+                                return close("Cannot write empty data");
+
+                            filename = resolve(filename, ext);
+
+                            if (text != NULL)
+                                async.push((const uint8_t*) text, strlen(text), filename);
+                            else
+                                async.push(data, length, filename);
+
+                            data = NULL;
+                            text = NULL;
+                            length = 0;
+
+                            // a full queue with DROP_NEWEST is not severe
+                            if (!async.exception.isOk())
+                                return async.exception.isSevere() ? exception.propagate(async) : exception.propagate(async).soft();
+
+                            return exception.clear();
+                        }
+
                     protected:
 
+                        /**
+                         * Build absolute path of file
+                         */
+                        String resolve(String filename, String ext) {
+                            if (filename == "")
+                                filename = counter.nextString();
+
+                            if (ext != "")
+                                filename += String(".") + ext;
+
+                            ESP_LOGI("FS::Write", "Filename = %s", filename.c_str());
+
+                            lastFilename = filename;
+                            
+                            if (folder != "") {
+                                filename = folder + '/' + filename;
+                            }
+
+                            folder = "";
+                            filename = toAbs(filename);
+                            filename.replace("//", "/");
+                            lastPath = filename;
+
+                            return filename;
+                        }
+
                         /**
                          * 
                          */
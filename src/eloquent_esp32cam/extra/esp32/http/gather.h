@@ -0,0 +1,190 @@
+#ifndef ELOQUENT_EXTRA_ESP32_HTTP_GATHER
+#define ELOQUENT_EXTRA_ESP32_HTTP_GATHER
+
+#include <WiFi.h>
+#include <lwip/sockets.h>
+
+#ifndef HTTP_GATHER_MAX_SEGMENTS
+#define HTTP_GATHER_MAX_SEGMENTS 4
+#endif
+
+
+namespace Eloquent {
+    namespace Extra {
+        namespace Esp32 {
+            namespace Http {
+                /**
+                 * Scatter-gather response writer.
+                 * Collects pointers to header, payload and trailer
+                 * (no copy) and hands them to the socket with a single
+                 * sendmsg(), so small headers share TCP segments
+                 * with the payload instead of going out on their own.
+                 * Segments are referenced, not owned: they must
+                 * outlive the writer
+                 */
+                class Gather {
+                    public:
+                        /**
+                         * Constructor
+                         */
+                        Gather() :
+                            _count(0),
+                            _first(0) {
+
+                            }
+
+                        /**
+                         * Remove all segments
+                         */
+                        Gather& clear() {
+                            _count = 0;
+                            _first = 0;
+
+                            return *this;
+                        }
+
+                        /**
+                         * Append segment
+                         */
+                        Gather& add(const void *data, size_t length) {
+                            if (_count >= HTTP_GATHER_MAX_SEGMENTS) {
+                                ESP_LOGE("Gather", "Too many segments (max %d)", HTTP_GATHER_MAX_SEGMENTS);
+                                return *this;
+                            }
+
+                            if (length == 0)
+                                return *this;
+
+                            _segments[_count].iov_base = (void*) data;
+                            _segments[_count].iov_len = length;
+                            _count += 1;
+
+                            return *this;
+                        }
+
+                        /**
+                         * Append string segment
+                         */
+                        Gather& add(const String& str) {
+                            return add(str.c_str(), str.length());
+                        }
+
+                        /**
+                         * Append C string segment
+                         */
+                        Gather& add(const char *str) {
+                            return add(str, strlen(str));
+                        }
+
+                        /**
+                         * Bytes left to send
+                         */
+                        size_t remaining() const {
+                            size_t length = 0;
+
+                            for (uint8_t i = _first; i < _count; i++)
+                                length += _segments[i].iov_len;
+
+                            return length;
+                        }
+
+                        /**
+                         * Test if everything was sent
+                         */
+                        bool isEmpty() const {
+                            return _first >= _count;
+                        }
+
+                        /**
+                         * Skip the first n bytes
+                         * (already sent)
+                         */
+                        Gather& consume(size_t n) {
+                            while (n > 0 && _first < _count) {
+                                struct iovec &segment = _segments[_first];
+
+                                if (n < segment.iov_len) {
+                                    segment.iov_base = ((uint8_t*) segment.iov_base) + n;
+                                    segment.iov_len -= n;
+                                    break;
+                                }
+
+                                n -= segment.iov_len;
+                                _first += 1;
+                            }
+
+                            return *this;
+                        }
+
+                        /**
+                         * Send as much as the socket accepts in one call.
+                         * Returns the number of bytes sent, 0 if the socket
+                         * would block (with MSG_DONTWAIT), -1 on error
+                         */
+                        int send(int fd, int flags = 0) {
+                            if (isEmpty())
+                                return 0;
+
+                            struct msghdr msg;
+
+                            memset(&msg, 0, sizeof(msg));
+                            msg.msg_iov = _segments + _first;
+                            msg.msg_iovlen = _count - _first;
+
+                            const int sent = ::sendmsg(fd, &msg, flags);
+
+                            if (sent < 0)
+                                return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+
+                            consume(sent);
+
+                            return sent;
+                        }
+
+                        /**
+                         * Block until everything is sent, the connection
+                         * fails or timeout millis elapse (a client that
+                         * stops reading must not stall the server task).
+                         * The connection is closed on failure
+                         */
+                        bool sendAll(WiFiClient& client, size_t timeout = 5000) {
+                            const int fd = client.fd();
+                            const size_t startedAt = millis();
+
+                            if (fd < 0)
+                                return false;
+
+                            while (!isEmpty()) {
+                                const int sent = send(fd, MSG_DONTWAIT);
+
+                                if (sent < 0) {
+                                    ESP_LOGW("Gather", "Send failed (errno %d)", errno);
+                                    client.stop();
+                                    return false;
+                                }
+
+                                if (millis() - startedAt > timeout) {
+                                    ESP_LOGW("Gather", "Send not completed within %u ms, closing", (unsigned int) timeout);
+                                    client.stop();
+                                    return false;
+                                }
+
+                                // socket full
+                                if (sent == 0)
+                                    delay(1);
+                            }
+
+                            return true;
+                        }
+
+                    protected:
+                        uint8_t _count;
+                        uint8_t _first;
+                        struct iovec _segments[HTTP_GATHER_MAX_SEGMENTS];
+                };
+            }
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,407 @@
+#ifndef ELOQUENT_EXTRA_ESP32_HTTP_MULTIPLEXER
+#define ELOQUENT_EXTRA_ESP32_HTTP_MULTIPLEXER
+
+#include <functional>
+#include <WiFi.h>
+#include <WebServer.h>
+#include "../../exception.h"
+#include "../../serialize/print.h"
+#include "../multiprocessing/thread.h"
+#include "./gather.h"
+
+#ifndef HTTP_MAX_PORTS
+#define HTTP_MAX_PORTS 4
+#endif
+
+#ifndef HTTP_MAX_STREAMS
+#define HTTP_MAX_STREAMS 4
+#endif
+
+#ifndef HTTP_MAX_HEADERS
+#define HTTP_MAX_HEADERS 8
+#endif
+
+#ifndef HTTP_MAX_PENDING
+#define HTTP_MAX_PENDING 4
+#endif
+
+#ifndef HTTP_PENDING_BUFFER_SIZE
+#define HTTP_PENDING_BUFFER_SIZE 1024
+#endif
+
+#ifndef HTTP_PENDING_TIMEOUT
+#define HTTP_PENDING_TIMEOUT 5000
+#endif
+
+using Eloquent::Error::Exception;
+using Eloquent::Extra::Serialize::ArrayPrint;
+using Eloquent::Extra::Esp32::Multiprocessing::Thread;
+
+
+namespace Eloquent {
+    namespace Extra {
+        namespace Esp32 {
+            namespace Http {
+                /**
+                 * Serve every HttpServer from a single task.
+                 * Servers on the same port share one WebServer;
+                 * long-lived streams are kept as per-connection state
+                 * and ticked cooperatively between requests, so
+                 * a stream never blocks other routes.
+                 * Responses go through send(): what the socket doesn't
+                 * accept right away is kept as per-connection state
+                 * and finished on later ticks, so a slow client never
+                 * blocks the task either.
+                 * Stream callbacks run on the server task: keep them short
+                 */
+                class Multiplexer {
+                    public:
+                        using StreamTick = std::function<void(WiFiClient&)>;
+
+                        Exception exception;
+                        Thread thread;
+
+                        /**
+                         * Constructor
+                         */
+                        Multiplexer() :
+                            exception("HttpMultiplexer"),
+                            thread("HttpMultiplexer"),
+                            _isRunning(false),
+                            _stackSize(5000),
+                            _numPorts(0) {
+                                for (uint8_t i = 0; i < HTTP_MAX_STREAMS; i++)
+                                    _streams[i].active = false;
+
+                                for (uint8_t i = 0; i < HTTP_MAX_PENDING; i++)
+                                    _pending[i].active = false;
+                            }
+
+                        /**
+                         * Get (or create) the server listening on port
+                         */
+                        WebServer* serverFor(uint16_t port) {
+                            for (uint8_t i = 0; i < _numPorts; i++)
+                                if (_ports[i].port == port)
+                                    return _ports[i].server;
+
+                            if (_numPorts >= HTTP_MAX_PORTS) {
+                                ESP_LOGE("HttpMultiplexer", "Max number of ports reached (%d)", HTTP_MAX_PORTS);
+                                return NULL;
+                            }
+
+                            port_t &p = _ports[_numPorts++];
+
+                            p.port = port;
+                            p.server = new WebServer(port);
+                            p.isListening = false;
+                            p.numHeaders = 0;
+
+                            return p.server;
+                        }
+
+                        /**
+                         * Add header to the ones collected on port.
+                         * WebServer::collectHeaders() replaces the whole
+                         * list, so it's always given the merged one
+                         */
+                        void collectHeader(uint16_t port, const char *header) {
+                            for (uint8_t i = 0; i < _numPorts; i++) {
+                                port_t &p = _ports[i];
+
+                                if (p.port != port)
+                                    continue;
+
+                                for (uint8_t j = 0; j < p.numHeaders; j++)
+                                    if (strcasecmp(p.headers[j], header) == 0)
+                                        return;
+
+                                if (p.numHeaders >= HTTP_MAX_HEADERS) {
+                                    ESP_LOGE("HttpMultiplexer", "Max number of collected headers reached (%d)", HTTP_MAX_HEADERS);
+                                    return;
+                                }
+
+                                p.headers[p.numHeaders++] = header;
+                                p.server->collectHeaders(p.headers, p.numHeaders);
+
+                                return;
+                            }
+                        }
+
+                        /**
+                         * Make sure server task has at least this stack.
+                         * Only effective before the first begin()
+                         */
+                        void reserveStack(uint16_t stackSize) {
+                            _stackSize = max(_stackSize, stackSize);
+                        }
+
+                        /**
+                         * Start listening on port and start server task (once)
+                         */
+                        Exception& begin(uint16_t port) {
+                            for (uint8_t i = 0; i < _numPorts; i++) {
+                                port_t &p = _ports[i];
+
+                                if (p.port != port || p.isListening)
+                                    continue;
+
+                                p.server->begin(port);
+                                p.isListening = true;
+                                ESP_LOGI("HttpMultiplexer", "Listening on port %d", port);
+                            }
+
+                            if (_isRunning)
+                                return exception.clear();
+
+                            _isRunning = true;
+
+                            thread
+                                .withArgs((void*) this)
+                                .withStackSize(_stackSize)
+                                .run([](void *args) {
+                                    Multiplexer *self = (Multiplexer*) args;
+
+                                    while (true) {
+                                        self->tick();
+                                        delay(1);
+                                    }
+                                });
+
+                            return exception.clear();
+                        }
+
+                        /**
+                         * Keep connection open and run tick on it
+                         * until the client disconnects.
+                         * Only call from a route handler
+                         *
+                         * @param client
+                         * @param tick
+                         * @param warmupTime millis to wait before first tick
+                         */
+                        bool attach(WiFiClient client, StreamTick tick, size_t warmupTime = 0) {
+                            for (uint8_t i = 0; i < HTTP_MAX_STREAMS; i++) {
+                                stream_t &stream = _streams[i];
+
+                                if (stream.active)
+                                    continue;
+
+                                stream.client = client;
+                                stream.tick = tick;
+                                stream.startAt = millis() + warmupTime;
+                                stream.active = true;
+
+                                return true;
+                            }
+
+                            ESP_LOGW("HttpMultiplexer", "Max number of streams reached (%d)", HTTP_MAX_STREAMS);
+
+                            return false;
+                        }
+
+                        /**
+                         * Send response without blocking.
+                         * Header is copied, payload is referenced: it must
+                         * stay valid while isSending(payload).
+                         * Returns false if too many responses are pending.
+                         * Only call from a route handler
+                         */
+                        bool send(WiFiClient client, const char *header, const void *payload = NULL, size_t length = 0) {
+                            const size_t headerLength = strlen(header);
+                            pending_t *pending = headerLength <= HTTP_PENDING_BUFFER_SIZE ? reserve(client) : NULL;
+
+                            if (pending == NULL)
+                                return false;
+
+                            memcpy(pending->buf, header, headerLength);
+                            pending->payload = payload;
+                            pending->gather.add(pending->buf, headerLength).add(payload, length);
+                            flush(*pending);
+
+                            return true;
+                        }
+
+                        /**
+                         * Send response written by callback(Print&)
+                         * into the connection's own buffer, without
+                         * blocking nor allocating.
+                         * Returns false if it doesn't fit
+                         * HTTP_PENDING_BUFFER_SIZE bytes or too many
+                         * responses are pending.
+                         * Only call from a route handler
+                         */
+                        template<typename Callback>
+                        bool send(WiFiClient client, size_t length, Callback callback) {
+                            pending_t *pending = length <= HTTP_PENDING_BUFFER_SIZE ? reserve(client) : NULL;
+
+                            if (pending == NULL)
+                                return false;
+
+                            ArrayPrint out(pending->buf, HTTP_PENDING_BUFFER_SIZE);
+
+                            callback(out);
+                            pending->gather.add(pending->buf, out.length);
+                            flush(*pending);
+
+                            return true;
+                        }
+
+                        /**
+                         * Test if payload is still referenced
+                         * by a pending response
+                         */
+                        bool isSending(const void *payload) const {
+                            if (payload == NULL)
+                                return false;
+
+                            for (uint8_t i = 0; i < HTTP_MAX_PENDING; i++)
+                                if (_pending[i].active && _pending[i].payload == payload)
+                                    return true;
+
+                            return false;
+                        }
+
+                        /**
+                         * Count open streams
+                         */
+                        uint8_t countStreams() const {
+                            uint8_t count = 0;
+
+                            for (uint8_t i = 0; i < HTTP_MAX_STREAMS; i++)
+                                if (_streams[i].active)
+                                    count++;
+
+                            return count;
+                        }
+
+                    protected:
+                        struct port_t {
+                            uint16_t port;
+                            WebServer *server;
+                            bool isListening;
+                            uint8_t numHeaders;
+                            const char *headers[HTTP_MAX_HEADERS];
+                        };
+
+                        struct stream_t {
+                            WiFiClient client;
+                            StreamTick tick;
+                            size_t startAt;
+                            bool active;
+                        };
+
+                        struct pending_t {
+                            WiFiClient client;
+                            Gather gather;
+                            const void *payload;
+                            size_t startedAt;
+                            bool active;
+                            uint8_t buf[HTTP_PENDING_BUFFER_SIZE];
+                        };
+
+                        bool _isRunning;
+                        uint16_t _stackSize;
+                        uint8_t _numPorts;
+                        port_t _ports[HTTP_MAX_PORTS];
+                        stream_t _streams[HTTP_MAX_STREAMS];
+                        pending_t _pending[HTTP_MAX_PENDING];
+
+                        /**
+                         * Serve pending requests, then advance each stream
+                         */
+                        void tick() {
+                            for (uint8_t i = 0; i < _numPorts; i++)
+                                if (_ports[i].isListening)
+                                    _ports[i].server->handleClient();
+
+                            for (uint8_t i = 0; i < HTTP_MAX_STREAMS; i++) {
+                                stream_t &stream = _streams[i];
+
+                                if (!stream.active || millis() < stream.startAt)
+                                    continue;
+
+                                if (!stream.client.connected()) {
+                                    stream.client.stop();
+                                    stream.tick = nullptr;
+                                    stream.active = false;
+                                    continue;
+                                }
+
+                                stream.tick(stream.client);
+                            }
+
+                            for (uint8_t i = 0; i < HTTP_MAX_PENDING; i++)
+                                if (_pending[i].active)
+                                    flush(_pending[i]);
+                        }
+
+                        /**
+                         * Get a free pending response for client
+                         */
+                        pending_t* reserve(WiFiClient& client) {
+                            for (uint8_t i = 0; i < HTTP_MAX_PENDING; i++) {
+                                pending_t &pending = _pending[i];
+
+                                if (pending.active)
+                                    continue;
+
+                                pending.client = client;
+                                pending.gather.clear();
+                                pending.payload = NULL;
+                                pending.startedAt = millis();
+                                pending.active = true;
+
+                                return &pending;
+                            }
+
+                            ESP_LOGW("HttpMultiplexer", "Max number of pending responses reached (%d)", HTTP_MAX_PENDING);
+
+                            return NULL;
+                        }
+
+                        /**
+                         * Send as much as the socket accepts.
+                         * Release the connection once done, on error
+                         * or after HTTP_PENDING_TIMEOUT millis
+                         */
+                        void flush(pending_t& pending) {
+                            const int fd = pending.client.fd();
+
+                            while (fd >= 0 && !pending.gather.isEmpty()) {
+                                const int sent = pending.gather.send(fd, MSG_DONTWAIT);
+
+                                if (sent < 0) {
+                                    ESP_LOGW("HttpMultiplexer", "Send failed (errno %d)", errno);
+                                    pending.client.stop();
+                                    break;
+                                }
+
+                                // socket full: retry on next tick
+                                if (sent == 0) {
+                                    if (millis() - pending.startedAt <= HTTP_PENDING_TIMEOUT)
+                                        return;
+
+                                    ESP_LOGW("HttpMultiplexer", "Send not completed within %d ms, closing", HTTP_PENDING_TIMEOUT);
+                                    pending.client.stop();
+                                    break;
+                                }
+                            }
+
+                            pending.client = WiFiClient();
+                            pending.payload = NULL;
+                            pending.active = false;
+                        }
+                };
+            }
+        }
+    }
+}
+
+namespace eloq {
+    namespace http {
+        static Eloquent::Extra::Esp32::Http::Multiplexer multiplexer;
+    }
+}
+
+#endif
@@ -5,11 +5,12 @@
 #include <WebServer.h>
 #include "../../exception.h"
 #include "../wifi/sta.h"
-#include "../multiprocessing/thread.h"
+#include "../../serialize/encoding.h"
+#include "./multiplexer.h"
 
 using namespace eloq;
 using Eloquent::Error::Exception;
-using Eloquent::Extra::Esp32::Multiprocessing::Thread;
+using Eloquent::Extra::Serialize::Encoding;
 
 
 namespace Eloquent {
@@ -17,12 +18,19 @@ namespace Eloquent {
         namespace Esp32 {
             namespace Http {
                 /**
-                 * Improved http server creation
+                 * Improved http server creation.
+                 * All servers are served by eloq::http::multiplexer
+                 * on a single task; servers on the same port share
+                 * the underlying WebServer.
+                 * Since the multiplexer, webServer is a pointer
+                 * (server.webServer->arg(...)) and there is no
+                 * per-server thread: use reserveStack() instead of
+                 * thread.withStackSize()
                  */
                 class HttpServer {
                     public:
-                        WebServer webServer;
-                        Thread thread;
+                        // shared by all servers on the same port
+                        WebServer *webServer;
                         Exception exception;
 
                         /**
@@ -32,7 +40,7 @@ namespace Eloquent {
                             port(serverPort),
                             name(serverName),
                             exception(serverName),
-                            thread(serverName) {
+                            webServer(eloq::http::multiplexer.serverFor(serverPort)) {
 
                             }
 
@@ -57,11 +65,30 @@ namespace Eloquent {
                         }
 
                         /**
-                         * Set web server port
+                         * Set web server port.
+                         * Call before registering routes
                          * @param httpPort
                          */
                         void setPort(uint16_t httpPort) {
                             port = httpPort;
+                            webServer = eloq::http::multiplexer.serverFor(port);
+                        }
+
+                        /**
+                         * Make request header available to handlers
+                         * (web->header(name)).
+                         * Headers of every server on the same port are
+                         * merged, since they share the WebServer
+                         */
+                        void collectHeader(const char *header) {
+                            eloq::http::multiplexer.collectHeader(port, header);
+                        }
+
+                        /**
+                         * Make sure the server task has at least this stack
+                         */
+                        void reserveStack(uint16_t stackSize) {
+                            eloq::http::multiplexer.reserveStack(stackSize);
                         }
 
                         /**
@@ -72,19 +99,11 @@ namespace Eloquent {
                             if (!wifi.isConnected())
                                 return exception.set("Not connected to WiFi");
 
-                            // run server in thread
-                            thread
-                                .withArgs((void*) this)
-                                .run([](void *args) {
-                                    HttpServer *httpServer = (HttpServer*) args;
+                            if (webServer == NULL)
+                                return exception.set("Cannot create server");
 
-                                    while (true) {
-                                        httpServer->handle();
-                                        yield();
-                                    }
-                                });
-
-                            webServer.begin(port);
+                            if (!eloq::http::multiplexer.begin(port).isOk())
+                                return exception.propagate(eloq::http::multiplexer);
 
                             return exception.clear();
                         }
@@ -93,21 +112,12 @@ namespace Eloquent {
                          * 
                          */
                         Exception& beginInThread(Exception& ex) {
-                            thread.withStackSize(5000);
-
                             if (!begin().isOk())
                                 return ex.propagate(*this);
 
                             return ex.clear();
                         }
 
-                        /**
-                         * Handle HTTP client
-                         */
-                        virtual void handle() {
-                            webServer.handleClient();
-                        }
-
                         /**
                          * Add GET route handler (alias to onGET)
                          * @tparam Handler
@@ -129,13 +139,15 @@ namespace Eloquent {
                         void onGET(const char *route, Handler handler) {
                             ESP_LOGI("HttpServer", "Registering route GET %s::%s", name, route);
 
-                            webServer.on(route, HTTP_GET, [this, handler]() {
-                                handler(&webServer);
+                            webServer->on(route, HTTP_GET, [this, handler]() {
+                                handler(webServer);
                             });
                         }
 
                         /**
-                         * Add GET stream route handler
+                         * Add GET stream route handler.
+                         * Handler is called once per server tick
+                         * until the client disconnects
                          * @tparam Handler
                          * @param route
                          * @param handler
@@ -144,20 +156,48 @@ namespace Eloquent {
                         void onStream(const char *route, Handler handler, size_t warmupTime = 0) {
                             ESP_LOGI("HttpServer", "Registering route GET stream %s::%s", name, route);
 
-                            webServer.on(route, HTTP_GET, [this, handler, warmupTime]() {
-                                WiFiClient client = webServer.client();
+                            webServer->on(route, HTTP_GET, [this, handler, warmupTime]() {
+                                const bool isAttached = eloq::http::multiplexer.attach(webServer->client(), [this, handler](WiFiClient& client) {
+                                    client.print("##SOF##");
+                                    handler(webServer, &client);
+                                    client.print("##EOF##");
+                                }, warmupTime);
+
+                                if (!isAttached)
+                                    abort("Too many streams", "text/plain", 503);
+                            });
+                        }
+
+                        /**
+                         * Add GET stream route handler that only
+                         * sends when version() changes (e.g. new results).
+                         * Each connection tracks its own last version
+                         * @tparam Version
+                         * @tparam Handler
+                         * @param route
+                         * @param version
+                         * @param handler
+                         */
+                        template<typename Version, typename Handler>
+                        void onStreamOnChange(const char *route, Version version, Handler handler) {
+                            ESP_LOGI("HttpServer", "Registering route GET stream %s::%s", name, route);
+
+                            webServer->on(route, HTTP_GET, [this, version, handler]() {
+                                uint32_t lastVersion = 0;
+                                const bool isAttached = eloq::http::multiplexer.attach(webServer->client(), [this, version, handler, lastVersion](WiFiClient& client) mutable {
+                                    const uint32_t currentVersion = version();
 
-                                if (warmupTime > 0)
-                                    delay(warmupTime);
+                                    if (currentVersion == lastVersion)
+                                        return;
 
-                                while (true) {
-                                    delay(5);
-                                    yield();
+                                    lastVersion = currentVersion;
                                     client.print("##SOF##");
-                                    handler(&webServer, &client);
+                                    handler(webServer, &client);
                                     client.print("##EOF##");
-                                    client.flush();
-                                }
+                                });
+
+                                if (!isAttached)
+                                    abort("Too many streams", "text/plain", 503);
                             });
                         }
 
@@ -170,7 +210,7 @@ namespace Eloquent {
                         template<typename Handler>
                         void onPOST(const char *route, Handler handler) {
                             ESP_LOGI("HttpServer", "Registering route POST %s::%s", name, route);
-                            webServer.on(route, HTTP_POST, handler);
+                            webServer->on(route, HTTP_POST, handler);
                         }
 
                         /**
@@ -193,24 +233,25 @@ namespace Eloquent {
                          */
                         template<typename Handler>
                         void addMultipartGetHandler(const char* route, Handler handler) {
-                            on(route, [this, handler]() {
-                                WiFiClient client = webServer.client();
+                            webServer->on(route, HTTP_GET, [this, handler]() {
+                                WiFiClient client = webServer->client();
+
+                                // streams tick on this same task, so the
+                                // header is out before the first frame
+                                const bool isAttached = eloq::http::multiplexer.attach(client, [handler](WiFiClient& client) {
+                                    handler(client);
+                                    client.println(F("\r\n--frame"));
+                                });
+
+                                if (!isAttached) {
+                                    abort("Too many streams", "text/plain", 503);
+                                    return;
+                                }
 
                                 client.println(F("HTTP/1.1 200 OK"));
                                 client.println(F("Content-Type: multipart/x-mixed-replace;boundary=frame"));
                                 client.println(F("Access-Control-Allow-Origin: *"));
                                 client.println(F("\r\n--frame"));
-
-                                while (true) {
-                                    if (!client.connected())
-                                        continue;
-
-                                    handler(client);
-
-                                    client.println(F("\r\n--frame"));
-                                    delay(1);
-                                    yield();
-                                }
                             });
                         }
 
@@ -219,25 +260,58 @@ namespace Eloquent {
                          */
                         template<typename TextGenerator>
                         void textStream(TextGenerator textGenerator) {
-                            webServer.setContentLength(CONTENT_LENGTH_UNKNOWN);
-                            webServer.send(200, "text/plain", "");
-                            textGenerator(webServer);
-                            webServer.sendContent("");
+                            webServer->setContentLength(CONTENT_LENGTH_UNKNOWN);
+                            webServer->send(200, "text/plain", "");
+                            textGenerator(*webServer);
+                            webServer->sendContent("");
                         }
 
                         /**
-                         * Send Gzipped content
+                         * Send Gzipped content.
+                         * Sent on the next ticks if the socket is full,
+                         * so contents must be static
                          */
                         void sendGzip(const uint8_t* contents, const size_t length) {
-                            WiFiClient client = webServer.client();
-
-                            client.println(F("HTTP/1.1 200 OK"));
-                            client.println(F("Content-Type: text/html"));
-                            client.print(F("Content-Length: "));
-                            client.println(length);
-                            client.println(F("Content-Encoding: gzip\r\n"));
-                            client.write(contents, length);
-                            client.flush();
+                            char header[128];
+
+                            snprintf(
+                                header,
+                                sizeof(header),
+                                "HTTP/1.1 200 OK\r\n"
+                                "Content-Type: text/html\r\n"
+                                "Content-Length: %u\r\n"
+                                "Content-Encoding: gzip\r\n\r\n",
+                                (unsigned int) length
+                            );
+
+                            if (!eloq::http::multiplexer.send(webServer->client(), header, contents, length))
+                                abort("Too many pending responses", "text/plain", 503);
+                        }
+
+                        /**
+                         * Send serializable object.
+                         * Encoding is picked from the ?format= query arg
+                         * (json or msgpack), so each client chooses its own.
+                         * The payload is measured, then streamed: subject
+                         * must not change in the meantime
+                         */
+                        template<typename T>
+                        void sendEncoded(T& subject, Encoding fallback = Encoding::JSON) {
+                            streamEncoded(subject, encodingOf(fallback));
+                        }
+
+                        /**
+                         * Send detector results with frame metadata.
+                         * Measuring and streaming happen in the same
+                         * locked section; answers 503 if the results
+                         * are busy for too long
+                         */
+                        template<typename T>
+                        void sendEncoded(Eloquent::Extra::Serialize::Envelope<T>& envelope, Encoding fallback = Encoding::JSON) {
+                            const Encoding encoding = encodingOf(fallback);
+
+                            if (!envelope.threadsafe([this, &envelope, encoding]() { streamEncoded(envelope, encoding); }))
+                                abort("Results busy", "text/plain", 503);
                         }
 
                         /**
@@ -251,7 +325,7 @@ namespace Eloquent {
 
                             ESP_LOGE("HttpServer", "Aborting request (%d): %s", statusCode, msg);
 
-                            webServer.send(statusCode, contentType, message);
+                            webServer->send(statusCode, contentType, message);
                         }
 
                         /**
@@ -295,7 +369,7 @@ namespace Eloquent {
                          * Return success response
                          */
                         void ok(String message = "OK") {
-                            webServer.send(200, "text/plain", message);
+                            webServer->send(200, "text/plain", message);
                         }
 
                         /**
@@ -314,7 +388,7 @@ namespace Eloquent {
                          */
                         template<typename T, typename... Args>
                         void sendChunks(T first, Args... args) {
-                            webServer.sendContent(String(first));
+                            webServer->sendContent(String(first));
                             sendChunks(args...);
                         }
 
@@ -322,7 +396,7 @@ namespace Eloquent {
                          * Check if argument is present in the request
                          */
                         bool hasArg(const char* name) {
-                            return webServer.hasArg(name);
+                            return webServer->hasArg(name);
                         }
 
                         /**
@@ -335,7 +409,7 @@ namespace Eloquent {
                             if (!hasArg(name))
                                 return fallback;
 
-                            return webServer.arg(name).toInt();
+                            return webServer->arg(name).toInt();
                         }
 
                         /**
@@ -348,10 +422,63 @@ namespace Eloquent {
                             if (!hasArg(name))
                                 return fallback;
 
-                            return webServer.arg(name);
+                            return webServer->arg(name);
                         }
 
                     protected:
+
+                        /**
+                         * Get encoding requested by ?format=
+                         */
+                        Encoding encodingOf(Encoding fallback) {
+                            const String format = webServer->arg("format");
+
+                            if (format == "msgpack")
+                                return Encoding::MSGPACK;
+
+                            if (format == "json")
+                                return Encoding::JSON;
+
+                            return fallback;
+                        }
+
+                        /**
+                         * Write header + payload, without allocating.
+                         * Payloads that fit the connection's buffer are
+                         * sent without blocking; larger ones are streamed
+                         */
+                        template<typename T>
+                        void streamEncoded(T& subject, Encoding encoding) {
+                            WiFiClient client = webServer->client();
+                            const size_t length = Eloquent::Extra::Serialize::encodedLength(subject, encoding);
+                            char header[160];
+
+                            snprintf(
+                                header,
+                                sizeof(header),
+                                "HTTP/1.1 200 OK\r\n"
+                                "Content-Type: %s\r\n"
+                                "Content-Length: %u\r\n"
+                                "Access-Control-Allow-Origin: *\r\n\r\n",
+                                Eloquent::Extra::Serialize::mimeType(encoding),
+                                (unsigned int) length
+                            );
+
+                            const bool isQueued = eloq::http::multiplexer.send(client, strlen(header) + length, [&header, &subject, encoding](Print& out) {
+                                out.print(header);
+                                Eloquent::Extra::Serialize::encode(out, subject, encoding);
+                            });
+
+                            if (isQueued)
+                                return;
+
+                            Eloquent::Extra::Serialize::BufferedPrint out(client);
+
+                            out.print(header);
+                            Eloquent::Extra::Serialize::encode(out, subject, encoding);
+                            out.flush();
+                        }
+
                         const char* name;
                         uint16_t port;
                 };
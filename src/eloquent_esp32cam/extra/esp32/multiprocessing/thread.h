@@ -10,18 +10,20 @@ namespace Eloquent {
                  */
                 class Thread {
                 public:
+                    TaskHandle_t handle;
 
                     /**
                      *
                      * @param name
                      */
                     Thread(const char* threadName) :
+                        handle(NULL),
                         name(threadName),
+                        core(tskNO_AFFINITY),
                         priority(0),
                         stackSize(1000),
                         args(NULL) {
 
-                        core = xPortGetCoreID();
                     }
 
                     /**
@@ -70,7 +72,8 @@ namespace Eloquent {
                      * @return
                      */
                     Thread& onCore(uint8_t core) {
-                        this->core = core;
+                        // single core chips only have core 0
+                        this->core = min<BaseType_t>(core, portNUM_PROCESSORS - 1);
 
                         return *this;
                     }
@@ -85,19 +88,20 @@ namespace Eloquent {
                     void run(Task task) {
                         ESP_LOGI(name, "Starting thread with stack size %d bytes on core %d", (int) stackSize, (int) core);
 
-                        xTaskCreate(
+                        xTaskCreatePinnedToCore(
                             task,      // Function to implement the task
                             name,      // Name of the task
                             stackSize, // Stack size in bytes
                             args,      // Task input parameter
                             priority,  // Priority of the task
-                            NULL       // Task handle.
+                            &handle,   // Task handle.
+                            core       // Pinned core (or tskNO_AFFINITY)
                         );
                     }
 
                 private:
                     const char *name;
-                    uint8_t core;
+                    BaseType_t core;
                     void *args;
                     uint8_t priority;
                     uint16_t stackSize;
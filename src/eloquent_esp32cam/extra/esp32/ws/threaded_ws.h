@@ -1,7 +1,8 @@
 #pragma once
 
+#include <functional>
 #include <WebSocketsServer.h>
-#include "../multiprocessing/Thread.h"
+#include "../multiprocessing/thread.h"
 
 using Eloquent::Extra::Esp32::Multiprocessing::Thread;
 
@@ -18,13 +19,12 @@ namespace Eloquent {
                         Thread thread;
 
                         /**
-                         * 
+                         *
                          */
                         ThreadedWs(const char* threadName = "WebSocket", const uint8_t port = 82) :
                             thread(threadName),
                             stackSize(1000),
-                            webSocket(port),
-                            isConnected(false) {
+                            webSocket(port) {
 
                         }
 
@@ -32,36 +32,44 @@ namespace Eloquent {
                          * Set stack size
                          */
                         ThreadedWs& withStackSize(uint16_t stackSize) {
-                            thread.withStackSize(stackSize);
+                            this->stackSize = stackSize;
 
                             return *this;
                         }
 
                         /**
-                         * Start thread with WebSocket request handler
+                         * Run function on each loop iteration,
+                         * in the WebSocket thread (sending from other
+                         * threads is not safe)
+                         */
+                        void onLoop(std::function<void()> callback) {
+                            _onLoop = callback;
+                        }
+
+                        /**
+                         * Start thread with WebSocket request handler.
+                         * Handler receives every event, including
+                         * each client's connection and disconnection
                         */
                         template<typename Handler>
                         void begin(Handler handler) {
                             webSocket.begin();
-                            webSocket.onEvent([this, handler](uint8_t num, WStype_t type, uint8_t * payload, size_t length) {
-                                if (type == WStype_CONNECTED)
-                                    isConnected = true;
-
-                                if (type == WStype_DISCONNECTED)
-                                    isConnected = false;
-
-                                if (isConnected)
-                                    handler(num, type, payload, length);
+                            webSocket.onEvent([handler](uint8_t num, WStype_t type, uint8_t * payload, size_t length) {
+                                handler(num, type, payload, length);
                             });
 
                             thread
-                                .withArgs((void*) &webSocket)
+                                .withArgs((void*) this)
                                 .withStackSize(stackSize)
                                 .run([](void *args) {
-                                    WebSocketsServer *webSocket = (WebSocketsServer*) args;
+                                    ThreadedWs *self = (ThreadedWs*) args;
 
                                     while (true) {
-                                        webSocket->loop();
+                                        self->webSocket.loop();
+
+                                        if (self->_onLoop)
+                                            self->_onLoop();
+
                                         yield();
                                     }
                                 });
@@ -69,9 +77,9 @@ namespace Eloquent {
 
                     protected:
                         uint16_t stackSize;
-                        bool isConnected;
+                        std::function<void()> _onLoop;
                 };
             }
         }
     }
-}
\ No newline at end of file
+}
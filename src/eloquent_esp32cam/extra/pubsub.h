@@ -6,8 +6,16 @@
 #include <WiFi.h>
 #include <PubSubClient.h>
 #include "./exception.h"
+#include "./serialize/encoding.h"
+#include "../camera/camera.h"
 
+using eloq::camera;
 using Eloquent::Error::Exception;
+using Eloquent::Extra::Serialize::Encoding;
+using Eloquent::Extra::Serialize::Envelope;
+using Eloquent::Extra::Serialize::BufferedPrint;
+using Eloquent::Extra::Serialize::encode;
+using Eloquent::Extra::Serialize::encodedLength;
 
 
 namespace Eloquent {
@@ -35,6 +43,7 @@ namespace Eloquent {
                 _subject(subject),
                 _server(""),
                 _port(1883),
+                _encoding(Encoding::JSON),
                 mqtt(client),
                 exception("PubSub") {
                     // generate client id based on MAC address
@@ -70,6 +79,21 @@ namespace Eloquent {
                 _pass = pass;
             }
             
+            /**
+             * @brief Publish plain JSON (default)
+             */
+            void json() {
+                _encoding = Encoding::JSON;
+            }
+
+            /**
+             * @brief Publish MessagePack, wrapped into
+             * a {seq, ms, data} envelope
+             */
+            void msgpack() {
+                _encoding = Encoding::MSGPACK;
+            }
+
             /**
              * @brief Connect to MQTT client
              */
@@ -97,7 +121,10 @@ namespace Eloquent {
             }
         
             /**
-             * @brief Send MQTT message
+             * @brief Send MQTT message.
+             * The payload is measured and streamed while holding
+             * the subject's results mutex, so the announced length
+             * always matches the bytes sent
              * @param topic
              */
             Exception& publish(String topic) {
@@ -106,19 +133,46 @@ namespace Eloquent {
                     
                 if (!connect().isOk())
                     return exception;
-                   
-                if (!mqtt.publish(topic.c_str(), _subject->toJSON().c_str()))
-                    return exception.set("Cannot send MQTT message");
-                    
-                return exception.clear();
+
+                Envelope<T> envelope(*_subject);
+
+                if (!envelope.threadsafe([this, &topic, &envelope]() {
+                    if (_encoding == Encoding::MSGPACK)
+                        send(topic, envelope);
+                    else
+                        send(topic, *_subject);
+                }))
+                    return exception.set("Results busy, MQTT message not sent").soft();
+
+                return exception;
             }
             
         protected:
             T *_subject;
             uint16_t _port;
+            Encoding _encoding;
             String _server;
             String _user;
             String _pass;
+
+            /**
+             * @brief Stream payload into client
+             */
+            template<typename Payload>
+            Exception& send(String& topic, Payload& payload) {
+                BufferedPrint out(mqtt);
+
+                if (!mqtt.beginPublish(topic.c_str(), encodedLength(payload, _encoding), false))
+                    return exception.set("Cannot send MQTT message");
+
+                encode(out, payload, _encoding);
+                out.flush();
+
+                if (!out.isOk() || !mqtt.endPublish())
+                    return exception.set("Cannot send MQTT message");
+                    
+                return exception.clear();
+            }
         };
     }
 }
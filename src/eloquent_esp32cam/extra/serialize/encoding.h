@@ -0,0 +1,108 @@
+#ifndef ELOQUENT_EXTRA_SERIALIZE_ENCODING_H
+#define ELOQUENT_EXTRA_SERIALIZE_ENCODING_H
+
+#include "./json.h"
+#include "./msgpack.h"
+
+#ifndef ENVELOPE_LOCK_TIMEOUT
+#define ENVELOPE_LOCK_TIMEOUT 250
+#endif
+
+
+namespace Eloquent {
+    namespace Extra {
+        namespace Serialize {
+            /**
+             * Wire format of a sink
+             */
+            enum class Encoding {
+                JSON,
+                MSGPACK
+            };
+
+            /**
+             * Wrap a detector's results with frame metadata.
+             * Wire schema (map, string keys):
+             *  - seq: counter of the camera frame the results
+             *    were computed on (uint)
+             *  - ms: detector processing time in millis (uint)
+             *  - data: detector payload, same shape as its JSON
+             * Serialize it inside threadsafe(), so seq and data
+             * always match and the length measured before
+             * sending is the length actually sent
+             */
+            template<typename T>
+            class Envelope {
+                public:
+                    T& subject;
+
+                    /**
+                     * Constructor
+                     */
+                    Envelope(T& obj) :
+                        subject(obj) {
+
+                        }
+
+                    /**
+                     * Run callback holding the subject's results mutex.
+                     * Gives up (returns false) after timeout millis,
+                     * so a busy detector can't stall the caller
+                     */
+                    template<typename Callback>
+                    bool threadsafe(Callback callback, size_t timeout = ENVELOPE_LOCK_TIMEOUT) {
+                        return subject.mutex.threadsafe(callback, timeout);
+                    }
+
+                    /**
+                     * Must be called inside threadsafe()
+                     */
+                    void serializeTo(Writer& writer) {
+                        writer.beginObject(3);
+                        writer.kv("seq", subject.seq);
+                        writer.kv("ms", subject.benchmark.millis());
+                        writer.key("data");
+                        subject.serializeTo(writer);
+                        writer.endObject();
+                    }
+            };
+
+            /**
+             * Serialize subject with the given encoding
+             */
+            template<typename T>
+            void encode(Print& out, T& subject, Encoding encoding) {
+                if (encoding == Encoding::MSGPACK) {
+                    MsgPackWriter writer(out);
+                    subject.serializeTo(writer);
+                }
+                else {
+                    JsonWriter writer(out);
+                    subject.serializeTo(writer);
+                }
+            }
+
+            /**
+             * Get length of the encoded subject without
+             * allocating anything
+             */
+            template<typename T>
+            size_t encodedLength(T& subject, Encoding encoding) {
+                CountingPrint counter;
+
+                encode(counter, subject, encoding);
+
+                return counter.count;
+            }
+
+            /**
+             * Get MIME type of encoding
+             */
+            inline const char* mimeType(Encoding encoding) {
+                return encoding == Encoding::MSGPACK ? "application/msgpack" : "application/json";
+            }
+        }
+    }
+}
+
+#endif
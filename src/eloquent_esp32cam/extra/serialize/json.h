@@ -0,0 +1,193 @@
+#ifndef ELOQUENT_EXTRA_SERIALIZE_JSON_H
+#define ELOQUENT_EXTRA_SERIALIZE_JSON_H
+
+#include "./writer.h"
+#include "./print.h"
+
+#ifndef JSON_WRITER_MAX_DEPTH
+#define JSON_WRITER_MAX_DEPTH 8
+#endif
+
+
+namespace Eloquent {
+    namespace Extra {
+        namespace Serialize {
+            /**
+             * Allocation-free JSON writer
+             */
+            class JsonWriter : public Writer {
+                public:
+
+                    /**
+                     * Constructor
+                     */
+                    JsonWriter(Print& printer) :
+                        Writer(printer),
+                        _depth(0),
+                        _isAfterKey(false) {
+                            memset(_hasItems, 0, sizeof(_hasItems));
+                        }
+
+                    /**
+                     * Serialize subject into a String.
+                     * Length is computed first, so the String
+                     * is allocated exactly once
+                     */
+                    template<typename T>
+                    static String stringify(T& subject) {
+                        String json;
+                        CountingPrint counter;
+                        JsonWriter dry(counter);
+
+                        subject.serializeTo(dry);
+                        json.reserve(counter.count);
+
+                        StringPrint printer(json);
+                        JsonWriter writer(printer);
+
+                        subject.serializeTo(writer);
+
+                        return json;
+                    }
+
+                    /**
+                     *
+                     */
+                    void beginArray(size_t size) override {
+                        open('[');
+                    }
+
+                    /**
+                     *
+                     */
+                    void endArray() override {
+                        close(']');
+                    }
+
+                    /**
+                     *
+                     */
+                    void beginObject(size_t size) override {
+                        open('{');
+                    }
+
+                    /**
+                     *
+                     */
+                    void endObject() override {
+                        close('}');
+                    }
+
+                    /**
+                     *
+                     */
+                    void key(const char *k) override {
+                        separate();
+                        quote(k);
+                        out.print(':');
+                        _isAfterKey = true;
+                    }
+
+                    /**
+                     *
+                     */
+                    void value(const char *v) override {
+                        separate();
+                        quote(v);
+                    }
+
+                    /**
+                     *
+                     */
+                    void value(long v) override {
+                        separate();
+                        out.print(v);
+                    }
+
+                    /**
+                     *
+                     */
+                    void value(float v) override {
+                        separate();
+                        out.print(v, 2);
+                    }
+
+                    /**
+                     *
+                     */
+                    void value(bool v) override {
+                        separate();
+                        out.print(v ? "true" : "false");
+                    }
+
+                    using Writer::value;
+
+                protected:
+                    uint8_t _depth;
+                    bool _isAfterKey;
+                    bool _hasItems[JSON_WRITER_MAX_DEPTH];
+
+                    /**
+                     * Print comma if needed
+                     */
+                    void separate() {
+                        if (_isAfterKey) {
+                            _isAfterKey = false;
+                            return;
+                        }
+
+                        if (_depth == 0)
+                            return;
+
+                        if (_hasItems[_depth - 1])
+                            out.print(',');
+
+                        _hasItems[_depth - 1] = true;
+                    }
+
+                    /**
+                     * Open array or object
+                     */
+                    void open(char c) {
+                        separate();
+                        out.print(c);
+
+                        if (_depth >= JSON_WRITER_MAX_DEPTH) {
+                            ESP_LOGE("JsonWriter", "Max depth exceeded");
+                            return;
+                        }
+
+                        _hasItems[_depth++] = false;
+                    }
+
+                    /**
+                     * Close array or object
+                     */
+                    void close(char c) {
+                        if (_depth > 0)
+                            _depth -= 1;
+
+                        out.print(c);
+                    }
+
+                    /**
+                     * Print escaped string
+                     */
+                    void quote(const char *s) {
+                        out.print('"');
+
+                        for (; s != NULL && *s; s++) {
+                            if (*s == '"' || *s == '\\')
+                                out.print('\\');
+
+                            out.print(*s);
+                        }
+
+                        out.print('"');
+                    }
+            };
+        }
+    }
+}
+
+#endif
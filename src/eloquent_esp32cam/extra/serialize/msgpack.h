@@ -0,0 +1,161 @@
+#ifndef ELOQUENT_EXTRA_SERIALIZE_MSGPACK_H
+#define ELOQUENT_EXTRA_SERIALIZE_MSGPACK_H
+
+#include "./writer.h"
+#include "./print.h"
+
+
+namespace Eloquent {
+    namespace Extra {
+        namespace Serialize {
+            /**
+             * Allocation-free MessagePack writer.
+             * Object keys are encoded as strings,
+             * floats as float32
+             */
+            class MsgPackWriter : public Writer {
+                public:
+
+                    /**
+                     * Constructor
+                     */
+                    MsgPackWriter(Print& printer) :
+                        Writer(printer) {
+
+                        }
+
+                    /**
+                     *
+                     */
+                    void beginArray(size_t size) override {
+                        if (size < 16)
+                            byte(0x90 | size);
+                        else if (size <= 0xFFFF)
+                            header(0xdc, size, 2);
+                        else
+                            header(0xdd, size, 4);
+                    }
+
+                    /**
+                     *
+                     */
+                    void endArray() override {
+
+                    }
+
+                    /**
+                     *
+                     */
+                    void beginObject(size_t size) override {
+                        if (size < 16)
+                            byte(0x80 | size);
+                        else if (size <= 0xFFFF)
+                            header(0xde, size, 2);
+                        else
+                            header(0xdf, size, 4);
+                    }
+
+                    /**
+                     *
+                     */
+                    void endObject() override {
+
+                    }
+
+                    /**
+                     *
+                     */
+                    void key(const char *k) override {
+                        value(k);
+                    }
+
+                    /**
+                     *
+                     */
+                    void value(const char *v) override {
+                        const size_t length = v == NULL ? 0 : strlen(v);
+
+                        if (length < 32)
+                            byte(0xa0 | length);
+                        else if (length <= 0xFF)
+                            header(0xd9, length, 1);
+                        else if (length <= 0xFFFF)
+                            header(0xda, length, 2);
+                        else
+                            header(0xdb, length, 4);
+
+                        if (length > 0)
+                            out.write((const uint8_t*) v, length);
+                    }
+
+                    /**
+                     *
+                     */
+                    void value(long v) override {
+                        if (v >= 0) {
+                            if (v < 128)
+                                byte(v);
+                            else if (v <= 0xFF)
+                                header(0xcc, v, 1);
+                            else if (v <= 0xFFFF)
+                                header(0xcd, v, 2);
+                            else
+                                header(0xce, v, 4);
+                        }
+                        else {
+                            if (v >= -32)
+                                byte(0xe0 | (v + 32));
+                            else if (v >= -128)
+                                header(0xd0, (uint8_t) v, 1);
+                            else if (v >= -32768)
+                                header(0xd1, (uint16_t) v, 2);
+                            else
+                                header(0xd2, (uint32_t) v, 4);
+                        }
+                    }
+
+                    /**
+                     *
+                     */
+                    void value(float v) override {
+                        uint32_t bits;
+
+                        memcpy(&bits, &v, 4);
+                        header(0xca, bits, 4);
+                    }
+
+                    /**
+                     *
+                     */
+                    void value(bool v) override {
+                        byte(v ? 0xc3 : 0xc2);
+                    }
+
+                    using Writer::value;
+
+                protected:
+
+                    /**
+                     *
+                     */
+                    inline void byte(uint8_t b) {
+                        out.write(b);
+                    }
+
+                    /**
+                     * Write type byte followed by big endian integer
+                     */
+                    void header(uint8_t type, uint32_t v, uint8_t length) {
+                        uint8_t buf[5] = {type};
+
+                        for (uint8_t i = 0; i < length; i++)
+                            buf[1 + i] = v >> (8 * (length - 1 - i));
+
+                        out.write(buf, 1 + length);
+                    }
+            };
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,194 @@
+#ifndef ELOQUENT_EXTRA_SERIALIZE_PRINT_H
+#define ELOQUENT_EXTRA_SERIALIZE_PRINT_H
+
+#include <Arduino.h>
+#include <Print.h>
+
+#ifndef ELOQUENT_BUFFERED_PRINT_SIZE
+#define ELOQUENT_BUFFERED_PRINT_SIZE 256
+#endif
+
+
+namespace Eloquent {
+    namespace Extra {
+        namespace Serialize {
+            /**
+             * Print that only counts bytes.
+             * Used to compute payload length before streaming
+             */
+            class CountingPrint : public Print {
+                public:
+                    size_t count;
+
+                    /**
+                     * Constructor
+                     */
+                    CountingPrint() : count(0) {
+
+                    }
+
+                    /**
+                     *
+                     */
+                    size_t write(uint8_t c) override {
+                        count += 1;
+
+                        return 1;
+                    }
+
+                    /**
+                     *
+                     */
+                    size_t write(const uint8_t *buffer, size_t size) override {
+                        count += size;
+
+                        return size;
+                    }
+            };
+
+            /**
+             * Batch small writes into a fixed buffer before
+             * forwarding them (writers emit a token at a time,
+             * sockets prefer fewer, larger writes).
+             * Call flush() when done
+             */
+            class BufferedPrint : public Print {
+                public:
+                    Print& out;
+
+                    /**
+                     * Constructor
+                     */
+                    BufferedPrint(Print& target) :
+                        out(target),
+                        _length(0),
+                        _isOk(true) {
+
+                        }
+
+                    /**
+                     * Test if every byte was forwarded
+                     */
+                    bool isOk() const {
+                        return _isOk;
+                    }
+
+                    /**
+                     *
+                     */
+                    size_t write(uint8_t c) override {
+                        return write(&c, 1);
+                    }
+
+                    /**
+                     *
+                     */
+                    size_t write(const uint8_t *buffer, size_t size) override {
+                        for (size_t i = 0; i < size; ) {
+                            if (_length == sizeof(_buf))
+                                flush();
+
+                            const size_t chunk = min(size - i, sizeof(_buf) - _length);
+
+                            memcpy(_buf + _length, buffer + i, chunk);
+                            _length += chunk;
+                            i += chunk;
+                        }
+
+                        return size;
+                    }
+
+                    /**
+                     * Forward buffered bytes
+                     */
+                    void flush() {
+                        if (_length > 0 && out.write(_buf, _length) != _length)
+                            _isOk = false;
+
+                        _length = 0;
+                    }
+
+                protected:
+                    uint8_t _buf[ELOQUENT_BUFFERED_PRINT_SIZE];
+                    size_t _length;
+                    bool _isOk;
+            };
+
+            /**
+             * Print into a fixed, caller owned buffer.
+             * Bytes that don't fit are dropped (isOk() turns false)
+             */
+            class ArrayPrint : public Print {
+                public:
+                    uint8_t *buf;
+                    size_t length;
+                    size_t capacity;
+
+                    /**
+                     * Constructor
+                     */
+                    ArrayPrint(uint8_t *target, size_t size) :
+                        buf(target),
+                        length(0),
+                        capacity(size) {
+
+                        }
+
+                    /**
+                     * Test if every write fit in the buffer
+                     */
+                    bool isOk() {
+                        return getWriteError() == 0;
+                    }
+
+                    /**
+                     *
+                     */
+                    size_t write(uint8_t c) override {
+                        return write(&c, 1);
+                    }
+
+                    /**
+                     *
+                     */
+                    size_t write(const uint8_t *buffer, size_t size) override {
+                        if (size > capacity - length) {
+                            setWriteError();
+                            return 0;
+                        }
+
+                        memcpy(buf + length, buffer, size);
+                        length += size;
+
+                        return size;
+                    }
+            };
+
+            /**
+             * Print into an Arduino String
+             */
+            class StringPrint : public Print {
+                public:
+                    String& str;
+
+                    /**
+                     * Constructor
+                     */
+                    StringPrint(String& s) : str(s) {
+
+                    }
+
+                    /**
+                     *
+                     */
+                    size_t write(uint8_t c) override {
+                        str += (char) c;
+
+                        return 1;
+                    }
+            };
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,88 @@
+#ifndef ELOQUENT_EXTRA_SERIALIZE_WRITER_H
+#define ELOQUENT_EXTRA_SERIALIZE_WRITER_H
+
+#include <Print.h>
+
+
+namespace Eloquent {
+    namespace Extra {
+        namespace Serialize {
+            /**
+             * Structured writer that streams to a Print.
+             * Detectors serialize through this interface,
+             * so the output format is chosen by the sink
+             */
+            class Writer {
+                public:
+                    Print& out;
+
+                    /**
+                     * Constructor
+                     */
+                    Writer(Print& printer) : out(printer) {
+
+                    }
+
+                    /**
+                     * Container sizes are required by binary formats
+                     * (MessagePack) and ignored by JSON
+                     */
+                    virtual void beginArray(size_t size) = 0;
+                    virtual void endArray() = 0;
+                    virtual void beginObject(size_t size) = 0;
+                    virtual void endObject() = 0;
+                    virtual void key(const char *k) = 0;
+                    virtual void value(const char *v) = 0;
+                    virtual void value(long v) = 0;
+                    virtual void value(float v) = 0;
+                    virtual void value(bool v) = 0;
+
+                    /**
+                     *
+                     */
+                    inline void value(const String& v) {
+                        value(v.c_str());
+                    }
+
+                    /**
+                     *
+                     */
+                    inline void value(int v) {
+                        value((long) v);
+                    }
+
+                    /**
+                     *
+                     */
+                    inline void value(unsigned int v) {
+                        value((long) v);
+                    }
+
+                    /**
+                     *
+                     */
+                    inline void value(unsigned long v) {
+                        value((long) v);
+                    }
+
+                    /**
+                     *
+                     */
+                    inline void value(double v) {
+                        value((float) v);
+                    }
+
+                    /**
+                     * Write key + value
+                     */
+                    template<typename T>
+                    void kv(const char *k, T v) {
+                        key(k);
+                        value(v);
+                    }
+            };
+        }
+    }
+}
+
+#endif
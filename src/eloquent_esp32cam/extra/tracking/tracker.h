@@ -0,0 +1,367 @@
+#ifndef ELOQUENT_EXTRA_TRACKING_TRACKER_H
+#define ELOQUENT_EXTRA_TRACKING_TRACKER_H
+
+#include <functional>
+
+namespace Eloquent {
+    namespace Extra {
+        namespace Tracking {
+            /**
+             * IoU / centroid tracker.
+             * Assigns persistent ids to boxes across frames,
+             * keeps an exponentially smoothed box for each track
+             * and reports enter / exit events.
+             * T must expose x, y, width, height and a writable id
+             *
+             * @tparam T
+             * @tparam capacity max number of tracks
+             */
+            template<typename T, uint8_t capacity>
+            class Tracker {
+            public:
+                struct track_t {
+                    T object;
+                    uint16_t id;
+                    uint16_t hits;
+                    uint8_t misses;
+                    bool active;
+                    bool confirmed;
+                    struct {
+                        float x;
+                        float y;
+                        float width;
+                        float height;
+                    } smooth;
+
+                    /**
+                     * Smoothed center x
+                     */
+                    inline float cx() const {
+                        return smooth.x + smooth.width / 2;
+                    }
+
+                    /**
+                     * Smoothed center y
+                     */
+                    inline float cy() const {
+                        return smooth.y + smooth.height / 2;
+                    }
+                } tracks[capacity];
+                bool lost;
+                using TrackCallback = std::function<void(track_t&)>;
+
+                /**
+                 * Constructor
+                 */
+                Tracker() :
+                    lost(false),
+                    _nextId(1),
+                    _minIoU(0.3f),
+                    _maxDistance(0.5f),
+                    _maxMisses(3),
+                    _minHits(1),
+                    _smoothing(1) {
+                        clear();
+                    }
+
+                /**
+                 * Min IoU to associate a detection to a track
+                 */
+                void minIoU(float iou) {
+                    _minIoU = iou;
+                }
+
+                /**
+                 * Max centroid distance (as a fraction of track size)
+                 * to associate a detection that has no overlap with a track
+                 */
+                void maxDistance(float distance) {
+                    _maxDistance = distance;
+                }
+
+                /**
+                 * How many frames a track can go undetected before being dropped
+                 */
+                void maxMisses(uint8_t misses) {
+                    _maxMisses = misses;
+                }
+
+                /**
+                 * How many frames a track must be seen
+                 * before it's reported as entered
+                 */
+                void minHits(uint16_t hits) {
+                    _minHits = max<uint16_t>(1, hits);
+                }
+
+                /**
+                 * Weight of the new detection in the smoothed box.
+                 * 1 = no smoothing, lower = smoother but laggier
+                 */
+                void smoothing(float alpha) {
+                    _smoothing = constrain(alpha, 0.01f, 1.0f);
+                }
+
+                /**
+                 * Run function when a track is confirmed
+                 */
+                void onEnter(TrackCallback callback) {
+                    _onEnter = callback;
+                }
+
+                /**
+                 * Run function when a confirmed track is dropped
+                 */
+                void onExit(TrackCallback callback) {
+                    _onExit = callback;
+                }
+
+                /**
+                 * Count tracks that have been confirmed
+                 */
+                uint8_t countConfirmed() const {
+                    uint8_t n = 0;
+
+                    for (uint8_t i = 0; i < capacity; i++)
+                        if (tracks[i].active && tracks[i].confirmed)
+                            n++;
+
+                    return n;
+                }
+
+                /**
+                 * Get track by id, or NULL
+                 */
+                track_t* get(uint16_t id) {
+                    for (uint8_t i = 0; i < capacity; i++)
+                        if (tracks[i].active && tracks[i].id == id)
+                            return &tracks[i];
+
+                    return NULL;
+                }
+
+                /**
+                 * Remove all tracks
+                 */
+                void clear() {
+                    for (uint8_t i = 0; i < capacity; i++)
+                        tracks[i].active = false;
+                }
+
+                /**
+                 * Count active tracks
+                 */
+                uint8_t count() const {
+                    uint8_t n = 0;
+
+                    for (uint8_t i = 0; i < capacity; i++)
+                        if (tracks[i].active)
+                            n++;
+
+                    return n;
+                }
+
+                /**
+                 * Run function on each active track
+                 */
+                template<typename Callback>
+                void forEach(Callback callback) {
+                    for (uint8_t i = 0; i < capacity; i++)
+                        if (tracks[i].active)
+                            callback(tracks[i]);
+                }
+
+                /**
+                 * Associate new detections to tracks.
+                 * Writes the track id into each accepted detection.
+                 * Sets lost = true if any track was dropped
+                 *
+                 * @param objects
+                 * @param length
+                 * @param accept filter for valid detections
+                 */
+                template<typename Filter>
+                void update(T *objects, uint8_t length, Filter accept) {
+                    bool matched[capacity] = {false};
+                    bool used[length];
+
+                    memset(used, 0, length);
+                    lost = false;
+
+                    // greedy association by best score
+                    while (true) {
+                        int8_t bestTrack = -1;
+                        int8_t bestObject = -1;
+                        float bestScore = 0;
+
+                        for (uint8_t t = 0; t < capacity; t++) {
+                            if (!tracks[t].active || matched[t])
+                                continue;
+
+                            for (uint8_t o = 0; o < length; o++) {
+                                if (used[o] || !accept(objects[o]))
+                                    continue;
+
+                                const float score = similarity(tracks[t].object, objects[o]);
+
+                                if (score > bestScore) {
+                                    bestScore = score;
+                                    bestTrack = t;
+                                    bestObject = o;
+                                }
+                            }
+                        }
+
+                        if (bestTrack < 0)
+                            break;
+
+                        track_t &track = tracks[bestTrack];
+
+                        matched[bestTrack] = true;
+                        used[bestObject] = true;
+                        objects[bestObject].id = track.id;
+                        track.object = objects[bestObject];
+                        track.hits += 1;
+                        track.misses = 0;
+                        smooth(track);
+                        confirm(track);
+                    }
+
+                    // age unmatched tracks
+                    for (uint8_t t = 0; t < capacity; t++) {
+                        if (!tracks[t].active || matched[t])
+                            continue;
+
+                        if (++tracks[t].misses > _maxMisses) {
+                            tracks[t].active = false;
+                            lost = true;
+
+                            if (tracks[t].confirmed && _onExit)
+                                _onExit(tracks[t]);
+                        }
+                    }
+
+                    // spawn new tracks
+                    for (uint8_t o = 0; o < length; o++) {
+                        if (used[o] || !accept(objects[o]))
+                            continue;
+
+                        track_t *track = spawn();
+
+                        if (track == NULL) {
+                            ESP_LOGW("Tracker", "Max number of tracks reached");
+                            break;
+                        }
+
+                        objects[o].id = track->id;
+                        track->object = objects[o];
+                        track->smooth.x = track->object.x;
+                        track->smooth.y = track->object.y;
+                        track->smooth.width = track->object.width;
+                        track->smooth.height = track->object.height;
+                        confirm(*track);
+                    }
+                }
+
+                /**
+                 * Intersection over union of two boxes
+                 */
+                static float iou(const T& a, const T& b) {
+                    const int32_t x1 = max<int32_t>(a.x, b.x);
+                    const int32_t y1 = max<int32_t>(a.y, b.y);
+                    const int32_t x2 = min<int32_t>(a.x + a.width, b.x + b.width);
+                    const int32_t y2 = min<int32_t>(a.y + a.height, b.y + b.height);
+
+                    if (x2 <= x1 || y2 <= y1)
+                        return 0;
+
+                    const float intersection = (x2 - x1) * (y2 - y1);
+                    const float area = ((float) a.width) * a.height + ((float) b.width) * b.height - intersection;
+
+                    return area > 0 ? intersection / area : 0;
+                }
+
+            protected:
+                uint16_t _nextId;
+                float _minIoU;
+                float _maxDistance;
+                uint8_t _maxMisses;
+                uint16_t _minHits;
+                float _smoothing;
+                TrackCallback _onEnter;
+                TrackCallback _onExit;
+
+                /**
+                 * Exponential moving average of the box
+                 */
+                void smooth(track_t& track) {
+                    const float a = _smoothing;
+
+                    track.smooth.x += a * (track.object.x - track.smooth.x);
+                    track.smooth.y += a * (track.object.y - track.smooth.y);
+                    track.smooth.width += a * (track.object.width - track.smooth.width);
+                    track.smooth.height += a * (track.object.height - track.smooth.height);
+                }
+
+                /**
+                 * Fire enter event once a track has enough hits
+                 */
+                void confirm(track_t& track) {
+                    if (track.confirmed || track.hits < _minHits)
+                        return;
+
+                    track.confirmed = true;
+
+                    if (_onEnter)
+                        _onEnter(track);
+                }
+
+                /**
+                 * Association score in (0, 2]: IoU-based matches
+                 * always win over centroid-based ones
+                 */
+                float similarity(const T& track, const T& object) {
+                    const float overlap = iou(track, object);
+
+                    if (overlap >= _minIoU)
+                        return 1 + overlap;
+
+                    const float dx = (track.x + track.width / 2.0f) - (object.x + object.width / 2.0f);
+                    const float dy = (track.y + track.height / 2.0f) - (object.y + object.height / 2.0f);
+                    const float size = max<float>(1, max<float>(track.width, track.height));
+                    const float distance = sqrtf(dx * dx + dy * dy) / size;
+
+                    if (distance > _maxDistance)
+                        return 0;
+
+                    return 1 - distance / _maxDistance;
+                }
+
+                /**
+                 * Get a free track slot
+                 */
+                track_t* spawn() {
+                    for (uint8_t t = 0; t < capacity; t++) {
+                        if (tracks[t].active)
+                            continue;
+
+                        tracks[t].active = true;
+                        tracks[t].id = _nextId++;
+                        tracks[t].hits = 1;
+                        tracks[t].misses = 0;
+                        tracks[t].confirmed = false;
+
+                        if (_nextId == 0)
+                            _nextId = 1;
+
+                        return &tracks[t];
+                    }
+
+                    return NULL;
+                }
+            };
+        }
+    }
+}
+
+#endif
@@ -7,6 +7,10 @@
 #include "../extra/exception.h"
 #include "../extra/time/benchmark.h"
 #include "../extra/pubsub.h"
+#include "../transform/resize.h"
+#include "../extra/tracking/tracker.h"
+#include "../extra/serialize/json.h"
+#include "../extra/esp32/multiprocessing/mutex.h"
 #include "./msr_config.h"
 #include "./mnp_config.h"
 #include "./face_t.h"
@@ -16,6 +20,11 @@ using eloq::camera;
 using eloq::face_t;
 using Eloquent::Error::Exception;
 using Eloquent::Extra::Time::Benchmark;
+using Eloquent::Esp32cam::Transform::Resize;
+using Eloquent::Extra::Tracking::Tracker;
+using Eloquent::Extra::Serialize::Writer;
+using Eloquent::Extra::Serialize::JsonWriter;
+using Eloquent::Extra::Esp32::Multiprocessing::Mutex;
 #if defined(ELOQUENT_EXTRA_PUBSUB_H)
 using Eloquent::Extra::PubSub;
 #endif
@@ -24,6 +33,10 @@ using Eloquent::Extra::PubSub;
 #define MAX_FACES 10
 #endif
 
+#ifndef FACE_DETECTION_INPUT_SIZE
+#define FACE_DETECTION_INPUT_SIZE 240
+#endif
+
 
 namespace Eloquent {
     namespace Esp32cam {
@@ -41,9 +54,16 @@ namespace Eloquent {
                     #if defined(ELOQUENT_EXTRA_PUBSUB_H)
                     PubSub<FaceDetection> mqtt;
                     #endif
-                    uint8_t image[240 * 240 * 3];
+                    Resize input;
+                    Mutex mutex;
+                    uint32_t seq;
+                    Tracker<face_t, MAX_FACES> tracker;
                     face_t first;
                     face_t faces[MAX_FACES];
+                    struct {
+                        size_t full;
+                        size_t local;
+                    } scans;
 
                     /**
                      * Constructor
@@ -54,10 +74,21 @@ namespace Eloquent {
                         #if defined(ELOQUENT_EXTRA_PUBSUB_H)
                         mqtt(this),
                         #endif
+                        mutex("FaceDetection"),
+                        seq(0),
                         _twoStages(false),
-                        _confidence(0.5)
+                        _confidence(0.5),
+                        _inputSize(FACE_DETECTION_INPUT_SIZE),
+                        _fullScanEvery(0),
+                        _framesSinceFullScan(0),
+                        _windowScale(2),
+                        _window(NULL),
+                        _windowLength(0),
+                        _source(&input)
                     {
-                        memset(image, 0, sizeof(image));
+                        input.bgr();
+                        scans.full = 0;
+                        scans.local = 0;
                     }
 
                     /**
@@ -83,69 +114,152 @@ namespace Eloquent {
                         _confidence = constrain(confidence_, 0.1, 1);
                     }
 
+                    /**
+                     * Set max side of the image fed to the detector.
+                     * Frames larger than this are downscaled
+                     * (keeping aspect ratio) before detection
+                     */
+                    inline void inputSize(uint16_t maxSide) {
+                        _inputSize = maxSide;
+                    }
+
+                    /**
+                     * Enable face tracking.
+                     * Faces get a persistent id and, between full scans,
+                     * detection only runs in a window around each tracked face.
+                     * A full scan is forced every fullScanEvery frames
+                     * or when a track is lost
+                     *
+                     * @param fullScanEvery
+                     * @param windowScale size of local search window, relative to face box
+                     */
+                    void track(uint8_t fullScanEvery = 5, float windowScale = 2) {
+                        _fullScanEvery = fullScanEvery;
+                        _windowScale = max(1.0f, windowScale);
+                        _framesSinceFullScan = 0;
+                        tracker.clear();
+                    }
+
+                    /**
+                     * Disable face tracking
+                     */
+                    void dontTrack() {
+                        _fullScanEvery = 0;
+                        tracker.clear();
+                    }
+
+                    /**
+                     * Test if tracking is enabled
+                     */
+                    inline bool isTracking() const {
+                        return _fullScanEvery > 0;
+                    }
+
                     /**
                      * Perform detection
                      */
                     Exception& run() {
-                        // assert 240x240
-                        if (camera.resolution.getWidth() != 240 || camera.resolution.getHeight() != 240)
-                            return exception.set("Face detection only works at 240x240");
+                        benchmark.benchmark([this]() {
+                            if (!preprocess(input).isOk()) {
+                                mutex.threadsafe([this]() {
+                                    clear();
+                                });
 
-                        clear();
+                                exception.propagate(input);
+                                return;
+                            }
 
-                        benchmark.benchmark([this]() {
-                            camera.mutex.threadsafe([this]() {
-                                camera_fb_t *fb = camera.frame;
-
-                                if (!camera.hasFrame()) {
-                                    exception.set("Cannot detect faces in empty frame");
-                                    return;
-                                }
-
-                                if (!fmt2rgb888(fb->buf, fb->len, fb->format, image)) {
-                                    exception.set("Cannot convert JPG frame to RGB888");
-                                    return;
-                                }
-
-                                std::vector<int> shape = {(int) fb->width, (int) fb->height, 3};
-
-                                if (_twoStages) {
-                                    HumanFaceDetectMSR01 s1(
-                                        msr.config.score_thresh,
-                                        msr.config.nms_thresh,
-                                        msr.config.top_k,
-                                        msr.config.resize_scale
-                                    );
-                                    HumanFaceDetectMNP01 s2(
-                                        mnp.config.score_thresh,
-                                        mnp.config.nms_thresh,
-                                        mnp.config.top_k
-                                    );
-
-                                    std::list<dl::detect::result_t> &cand = s1.infer(image, shape);
-                                    std::list<dl::detect::result_t> &results = s2.infer(image, shape, cand);
-                                    copy(results);
-                                }
-                                else {
-                                    HumanFaceDetectMSR01 s1(
-                                        msr.config.score_thresh,
-                                        msr.config.nms_thresh,
-                                        msr.config.top_k,
-                                        msr.config.resize_scale
-                                    );
-
-                                    std::list<dl::detect::result_t> &results = s1.infer((uint8_t*) image, shape);
-                                    copy(results);
-                                }
-                            }, 1000);
+                            classify(input);
                         });
 
-                        if (!exception.isOk())
-                            return exception;
+                        return exception;
+                    }
+
+                    /**
+                     * Configure buffer to hold detector input
+                     */
+                    void configure(Resize& buffer) {
+                        buffer.bgr();
+                        buffer.fit(camera.resolution.getWidth(), camera.resolution.getHeight(), _inputSize);
+                    }
+
+                    /**
+                     * Decode + resize current frame into buffer,
+                     * holding the camera only while decoding
+                     */
+                    Exception& preprocess(Resize& buffer) {
+                        camera.mutex.threadsafe([this, &buffer]() {
+                            camera_fb_t *fb = camera.frame;
+
+                            if (!camera.hasFrame()) {
+                                buffer.exception.set("Cannot detect faces in empty frame");
+                                return;
+                            }
+
+                            buffer.fit(fb->width, fb->height, _inputSize);
+                            buffer.decode(fb);
+                            buffer.seq = camera.seq;
+                        }, 1000);
 
                         if (!camera.mutex.isOk())
-                            return exception.set("Cannot acquire camera mutex");
-                        
+                            return buffer.exception.set("Cannot acquire camera mutex");
+
+                        return buffer.exception;
+                    }
+
+                    /**
+                     * Detect faces in preprocessed BGR buffer.
+                     * Inference runs unlocked; results are swapped in
+                     * under mutex, tagged with the frame seq of buffer.
+                     * Readers on other tasks (telemetry, MQTT) must
+                     * hold mutex while serializing
+                     */
+                    Exception& classify(Resize& buffer) {
+                        if (buffer.channels != 3 || buffer.pixels == NULL) {
+                            mutex.threadsafe([this]() {
+                                clear();
+                            });
+
+                            return exception.set("Face detection needs a BGR888 input");
+                        }
+
+                        std::list<dl::detect::result_t> results;
+
+                        _source = &buffer;
+
+                        if (shouldScanLocally()) {
+                            results = scanLocally();
+                            _framesSinceFullScan += 1;
+                            scans.local += 1;
+                        }
+                        else {
+                            std::vector<int> shape = {(int) buffer.height, (int) buffer.width, 3};
+
+                            results = detect(buffer.pixels, shape);
+                            _framesSinceFullScan = 0;
+                            scans.full += 1;
+                        }
+
+                        mutex.threadsafe([this, &buffer, &results]() {
+                            clear();
+                            copy(results);
+                            seq = buffer.seq;
+
+                            if (!isTracking())
+                                return;
+
+                            tracker.update(faces, MAX_FACES, [this](face_t& face) {
+                                return face.isValid() && face.score >= _confidence;
+                            });
+
+                            // keep first in sync with the tracked id
+                            if (found())
+                                forEach([this](int i, face_t& face) {
+                                    if (i == 0)
+                                        first = face;
+                                });
+                        });
+
                         return exception.clear();
                     }
 
@@ -195,43 +309,45 @@ namespace Eloquent {
                         }
                     }
                     
+                    /**
+                     * @brief Serialize faces
+                     */
+                    void serializeTo(Writer& writer) {
+                        writer.beginArray(found() ? count() : 0);
+
+                        forEach([this, &writer](int i, face_t& face) {
+                            writer.beginObject(isTracking() ? 6 : 5);
+
+                            if (isTracking())
+                                writer.kv("id", face.id);
+
+                            writer.kv("x", face.x);
+                            writer.kv("y", face.y);
+                            writer.kv("w", face.width);
+                            writer.kv("h", face.height);
+                            writer.kv("proba", face.score);
+                            writer.endObject();
+                        });
+
+                        writer.endArray();
+                    }
+
+                    /**
+                     * @brief Stream JSON to printer (no heap allocation)
+                     */
+                    void toJSON(Print& printer) {
+                        JsonWriter json(printer);
+
+                        serializeTo(json);
+                    }
+
                     /**
                      * @brief Convert to JSON
                      */
                     String toJSON() {
-                        static char buf[MAX_FACES * 33] = {' '};
-                        String json(buf);
-                        
-                        json = "[]";
-                        
-                        if (notFound())
-                            return json;
-                            
-                        json = '[';
-                        
-                        forEach([&json](int i, face_t face) {
-                            if (i > 0)
-                                json += ',';
-                                
-                            json += "{\"x\":";
-                            json += face.x;
-                            json += ",\"y\":";
-                            json += face.y;
-                            json += ",\"w\":";
-                            json += face.width;
-                            json += ",\"h\":";
-                            json += face.height;
-                            json += ",\"proba\":";
-                            json += face.score;
-                            json += "}";
-                        });
-                        
-                        json += ']';
-                        
-                        return json;
-                            
+                        return JsonWriter::stringify(*this);
                     }
-                    
+
                     /**
                      * @brief Test if an MQTT message should be published
                      */
@@ -242,6 +358,13 @@ namespace Eloquent {
                 protected:
                     bool _twoStages;
                     float _confidence;
+                    uint16_t _inputSize;
+                    uint8_t _fullScanEvery;
+                    uint8_t _framesSinceFullScan;
+                    float _windowScale;
+                    uint8_t *_window;
+                    size_t _windowLength;
+                    Resize *_source;
 
                     /**
                      * Clear faces data
@@ -253,22 +376,144 @@ namespace Eloquent {
                             faces[i].clear();
                     }
 
+                    /**
+                     * Test if current frame can skip full detection
+                     */
+                    bool shouldScanLocally() {
+                        if (!isTracking())
+                            return false;
+
+                        if (tracker.lost || tracker.count() == 0)
+                            return false;
+
+                        return _framesSinceFullScan + 1 < _fullScanEvery;
+                    }
+
+                    /**
+                     * Re-detect each tracked face in an enlarged
+                     * window around its last position
+                     */
+                    std::list<dl::detect::result_t> scanLocally() {
+                        std::list<dl::detect::result_t> results;
+
+                        tracker.forEach([this, &results](typename Tracker<face_t, MAX_FACES>::track_t& track) {
+                            // track box in input coordinates
+                            const face_t &face = track.object;
+                            const float cx = (face.x + face.width / 2.0f - _source->region.x) / _source->dx();
+                            const float cy = (face.y + face.height / 2.0f - _source->region.y) / _source->dy();
+                            const float side = max(face.width / _source->dx(), face.height / _source->dy()) * _windowScale;
+                            const int16_t x1 = constrain((int) (cx - side / 2), 0, _source->width - 1);
+                            const int16_t y1 = constrain((int) (cy - side / 2), 0, _source->height - 1);
+                            const int16_t x2 = constrain((int) (cx + side / 2), x1 + 1, (int) _source->width);
+                            const int16_t y2 = constrain((int) (cy + side / 2), y1 + 1, (int) _source->height);
+                            const uint16_t w = x2 - x1;
+                            const uint16_t h = y2 - y1;
+
+                            if (!crop(x1, y1, w, h))
+                                return;
+
+                            // the window is a crop at frame scale: the full scan's
+                            // resize scale keeps the face at the same scale
+                            std::vector<int> shape = {(int) h, (int) w, 3};
+                            std::list<dl::detect::result_t> found = detect(_window, shape);
+
+                            if (found.empty())
+                                return;
+
+                            // keep the best candidate only, in input coordinates
+                            dl::detect::result_t best = found.front();
+
+                            for (const auto& res : found)
+                                if (res.score > best.score)
+                                    best = res;
+
+                            for (uint8_t i = 0; i < best.box.size(); i++)
+                                best.box[i] += (i % 2 == 0) ? x1 : y1;
+
+                            for (uint8_t i = 0; i < best.keypoint.size(); i++)
+                                best.keypoint[i] += (i % 2 == 0) ? x1 : y1;
+
+                            results.push_back(best);
+                        });
+
+                        return results;
+                    }
+
+                    /**
+                     * Copy window of input image into contiguous buffer
+                     */
+                    bool crop(uint16_t x, uint16_t y, uint16_t w, uint16_t h) {
+                        const size_t required = ((size_t) w) * h * 3;
+
+                        if (required > _windowLength) {
+                            ::free(_window);
+                            _window = (uint8_t*) (psramFound() ? ps_malloc(required) : malloc(required));
+                            _windowLength = _window == NULL ? 0 : required;
+                        }
+
+                        if (_window == NULL) {
+                            ESP_LOGE("FaceDetection", "Cannot allocate tracking window");
+                            return false;
+                        }
+
+                        for (uint16_t i = 0; i < h; i++)
+                            memcpy(
+                                _window + ((size_t) i) * w * 3,
+                                _source->pixels + (((size_t) y + i) * _source->width + x) * 3,
+                                w * 3
+                            );
+
+                        return true;
+                    }
+
+                    /**
+                     * Run MSR01 (+ MNP01) on RGB888 image
+                     */
+                    std::list<dl::detect::result_t> detect(uint8_t *image, std::vector<int>& shape) {
+                        HumanFaceDetectMSR01 s1(
+                            msr.config.score_thresh,
+                            msr.config.nms_thresh,
+                            msr.config.top_k,
+                            msr.config.resize_scale
+                        );
+
+                        std::list<dl::detect::result_t> &candidates = s1.infer(image, shape);
+
+                        if (!_twoStages)
+                            return candidates;
+
+                        HumanFaceDetectMNP01 s2(
+                            mnp.config.score_thresh,
+                            mnp.config.nms_thresh,
+                            mnp.config.top_k
+                        );
+
+                        return s2.infer(image, shape, candidates);
+                    }
+
                     /**
                      * Copy results into face_t structures
                      */
-                    void copy(std::list<dl::detect::result_t> &results) {
+                    void copy(const std::list<dl::detect::result_t> &results) {
                         bool isFirst = true;
                         int i = 0;
 
                         for (const auto& res : results) {
-                            faces[i++].copyFrom(res);
+                            if (i >= MAX_FACES)
+                                break;
+
+                            face_t &face = faces[i++];
+
+                            // map boxes back to source frame coordinates
+                            face.copyFrom(res);
+                            face.map(_source->dx(), _source->dy(), _source->region.x, _source->region.y);
 
                             if (res.score < _confidence)
                                 continue;
 
                             if (isFirst) {
                                 isFirst = false;
-                                first.copyFrom(res);
+                                first = face;
                             }
                         }
                     }
@@ -38,7 +38,7 @@ namespace Eloquent {
                      * 
                      */
                     Exception& begin() {
-                        http.thread.withStackSize(5000);
+                        http.reserveStack(5000);
 
                         // HTTP endpoints
                         // render static files
@@ -19,6 +19,7 @@ namespace Eloquent {
                     uint16_t width;
                     uint16_t height;
                     float score;
+                    uint16_t id;
                     struct {
                         int16_t x;
                         int16_t y;
@@ -69,6 +70,33 @@ namespace Eloquent {
                         }
                     }
 
+                    /**
+                     * Map coordinates from detection input
+                     * back to source frame
+                     */
+                    void map(float dx, float dy, int16_t offsetX = 0, int16_t offsetY = 0) {
+                        x = x0 = offsetX + x0 * dx;
+                        y = y0 = offsetY + y0 * dy;
+                        x1 = offsetX + x1 * dx;
+                        y1 = offsetY + y1 * dy;
+                        width = x1 - x0 + 1;
+                        height = y1 - y0 + 1;
+
+                        if (!hasKeypoints())
+                            return;
+
+                        leftEye.x = offsetX + leftEye.x * dx;
+                        leftEye.y = offsetY + leftEye.y * dy;
+                        rightEye.x = offsetX + rightEye.x * dx;
+                        rightEye.y = offsetY + rightEye.y * dy;
+                        nose.x = offsetX + nose.x * dx;
+                        nose.y = offsetY + nose.y * dy;
+                        leftMouth.x = offsetX + leftMouth.x * dx;
+                        leftMouth.y = offsetY + leftMouth.y * dy;
+                        rightMouth.x = offsetX + rightMouth.x * dx;
+                        rightMouth.y = offsetY + rightMouth.y * dy;
+                    }
+
                     /**
                      * Clear all coordinates
                      */
@@ -79,6 +107,7 @@ namespace Eloquent {
                         y1 = 0;
                         width = 0;
                         height = 0;
+                        id = 0;
 
                         leftEye.x = 0;
                         leftEye.y = 0;
@@ -6,12 +6,17 @@
 #include "../extra/time/benchmark.h"
 #include "../extra/time/rate_limit.h"
 #include "../extra/pubsub.h"
+#include "../extra/serialize/json.h"
+#include "../extra/esp32/multiprocessing/mutex.h"
 #include "./daemon.h"
 
 using eloq::camera;
 using Eloquent::Error::Exception;
 using Eloquent::Extra::Time::Benchmark;
 using Eloquent::Extra::Time::RateLimit;
+using Eloquent::Extra::Serialize::Writer;
+using Eloquent::Extra::Serialize::JsonWriter;
+using Eloquent::Extra::Esp32::Multiprocessing::Mutex;
 #if defined(ELOQUENT_EXTRA_PUBSUB_H)
 using Eloquent::Extra::PubSub;
 #endif
@@ -29,6 +34,8 @@ namespace Eloquent {
                     Exception exception;
                     Benchmark benchmark;
                     RateLimit rate;
+                    Mutex mutex;
+                    uint32_t seq;
                     Daemon<Detection> daemon;
                     #if defined(ELOQUENT_EXTRA_PUBSUB_H)
                     PubSub<Detection> mqtt;
@@ -44,6 +51,8 @@ namespace Eloquent {
                         _prev(NULL),
                         _skip(5),
                         movingRatio(0),
+                        mutex("MotionDetection"),
+                        seq(0),
                         daemon(this),
                         #if defined(ELOQUENT_EXTRA_PUBSUB_H)
                         mqtt(this),
@@ -118,7 +127,10 @@ namespace Eloquent {
                             return exception.set("First frame, can't detect motion").soft();
                         }
 
-                        benchmark.timeit([this]() {
+                        // seq of the frame rgb565 was converted from
+                        const uint32_t frameSeq = camera.seq;
+
+                        benchmark.timeit([this, frameSeq]() {
                             int movingPoints = dl::image::get_moving_point_number(
                                 camera.rgb565.data, 
                                 _prev, 
@@ -128,7 +140,11 @@ namespace Eloquent {
                                 _threshold
                             );
 
-                            movingRatio = ((float) movingPoints) / camera.rgb565.length * _stride * _stride;
+                            mutex.threadsafe([this, movingPoints, frameSeq]() {
+                                movingRatio = ((float) movingPoints) / camera.rgb565.length * _stride * _stride;
+                                seq = frameSeq;
+                            });
+
                             copy(camera.rgb565);
                         });
 
@@ -144,11 +160,29 @@ namespace Eloquent {
                         return exception.clear();
                     }
                     
+                    /**
+                     * @brief Serialize result
+                     */
+                    void serializeTo(Writer& writer) {
+                        writer.beginObject(1);
+                        writer.kv("motion", triggered());
+                        writer.endObject();
+                    }
+
+                    /**
+                     * @brief Stream JSON to printer (no heap allocation)
+                     */
+                    void toJSON(Print& printer) {
+                        JsonWriter json(printer);
+
+                        serializeTo(json);
+                    }
+
                     /**
                      * @brief Convert to JSON
                      */
                     String toJSON() {
-                        return String("{\"motion\":") + (triggered() ? "true" : "false") + "}";
+                        return JsonWriter::stringify(*this);
                     }
                     
                     /**
@@ -0,0 +1,247 @@
+#ifndef ELOQUENT_ESP32CAM_SCHEDULER_SCHEDULER_H
+#define ELOQUENT_ESP32CAM_SCHEDULER_SCHEDULER_H
+
+#include <functional>
+#include "../camera/camera.h"
+#include "../transform/resize.h"
+#include "../extra/exception.h"
+#include "../extra/time/benchmark.h"
+#include "../extra/time/rate_limit.h"
+#include "../extra/serialize/writer.h"
+
+#ifndef SCHEDULER_MAX_MODELS
+#define SCHEDULER_MAX_MODELS 4
+#endif
+
+using eloq::camera;
+using Eloquent::Error::Exception;
+using Eloquent::Extra::Time::Benchmark;
+using Eloquent::Extra::Time::RateLimit;
+using Eloquent::Extra::Serialize::Writer;
+using Eloquent::Esp32cam::Transform::Resize;
+
+
+namespace Eloquent {
+    namespace Esp32cam {
+        namespace Scheduler {
+            /**
+             * Run many models on the same camera frame.
+             * The frame is decoded once per distinct input format
+             * (in a single JPEG pass) and models with the same
+             * format share the decoded buffer.
+             * Model must expose configure(Resize&) and
+             * classify(Resize&), like ImageClassifier, FOMO and
+             * FaceDetection do
+             */
+            class Scheduler {
+                public:
+                    struct model_t {
+                        const char *name;
+                        RateLimit rate;
+                        Resize input;
+                        std::function<void(Resize&)> configure;
+                        std::function<Exception&(Resize&)> classify;
+                        struct {
+                            uint32_t runs;
+                            uint32_t errors;
+                            size_t lastMs;
+                            size_t maxMs;
+                            size_t totalMs;
+                        } stats;
+
+                        /**
+                         * Average inference time
+                         */
+                        inline float avgMs() const {
+                            return stats.runs > 0 ? ((float) stats.totalMs) / stats.runs : 0;
+                        }
+                    } models[SCHEDULER_MAX_MODELS];
+                    uint8_t numModels;
+                    Exception exception;
+                    Benchmark decoding;
+                    Benchmark benchmark;
+
+                    /**
+                     * Constructor
+                     */
+                    Scheduler() :
+                        numModels(0),
+                        exception("Scheduler"),
+                        _perFrame(0),
+                        _next(0) {
+
+                        }
+
+                    /**
+                     * Add model.
+                     * Models run in the order they're added
+                     *
+                     * @param name used in stats
+                     * @param model
+                     * @param atMostOnceEvery min millis between two runs (0 = every frame)
+                     */
+                    template<typename Model>
+                    bool add(const char *name, Model& model, size_t atMostOnceEvery = 0) {
+                        if (numModels >= SCHEDULER_MAX_MODELS) {
+                            ESP_LOGE("Scheduler", "Max number of models reached (%d)", SCHEDULER_MAX_MODELS);
+                            return false;
+                        }
+
+                        model_t &m = models[numModels++];
+
+                        m.name = name;
+                        m.rate.atMostOnceEvery(atMostOnceEvery);
+                        m.configure = [&model](Resize& buffer) { model.configure(buffer); };
+                        m.classify = [&model](Resize& buffer) -> Exception& { return model.classify(buffer); };
+                        memset(&m.stats, 0, sizeof(m.stats));
+
+                        return true;
+                    }
+
+                    /**
+                     * Run every due model on every frame (default)
+                     */
+                    void all() {
+                        _perFrame = 0;
+                    }
+
+                    /**
+                     * Run at most n due models per frame, round robin
+                     */
+                    void rotate(uint8_t n = 1) {
+                        _perFrame = n;
+                    }
+
+                    /**
+                     * Decode current frame once and run due models
+                     */
+                    Exception& run() {
+                        model_t *due[SCHEDULER_MAX_MODELS];
+                        Resize *shared[SCHEDULER_MAX_MODELS];
+                        Resize *unique[SCHEDULER_MAX_MODELS];
+                        const uint8_t numDue = pick(due);
+                        uint8_t numUnique = 0;
+
+                        if (numDue == 0)
+                            return exception.soft().set("No model is due");
+
+                        // one buffer per distinct input format
+                        for (uint8_t i = 0; i < numDue; i++) {
+                            due[i]->configure(due[i]->input);
+                            shared[i] = NULL;
+
+                            for (uint8_t j = 0; j < numUnique && shared[i] == NULL; j++)
+                                if (unique[j]->isSameAs(due[i]->input))
+                                    shared[i] = unique[j];
+
+                            if (shared[i] == NULL)
+                                shared[i] = unique[numUnique++] = &due[i]->input;
+                        }
+
+                        benchmark.benchmark([this, &due, &shared, &unique, numDue, numUnique]() {
+                            decoding.benchmark([this, &unique, numUnique]() {
+                                camera.mutex.threadsafe([this, &unique, numUnique]() {
+                                    if (!camera.hasFrame()) {
+                                        exception.set("Cannot run models on empty frame");
+                                        return;
+                                    }
+
+                                    Resize::decodeAll(camera.frame, unique, numUnique);
+
+                                    for (uint8_t i = 0; i < numUnique; i++)
+                                        unique[i]->seq = camera.seq;
+
+                                    exception.clear();
+                                }, 1000);
+                            });
+
+                            if (!camera.mutex.isOk())
+                                exception.set("Cannot acquire camera mutex");
+
+                            if (!exception.isOk())
+                                return;
+
+                            for (uint8_t i = 0; i < numDue; i++) {
+                                model_t &m = *due[i];
+                                Benchmark timer;
+
+                                if (!shared[i]->exception.isOk()) {
+                                    m.stats.errors += 1;
+                                    continue;
+                                }
+
+                                timer.start();
+                                const bool isOk = m.classify(*shared[i]).isOk();
+                                timer.stop();
+
+                                m.rate.touch();
+                                m.stats.runs += 1;
+                                m.stats.lastMs = timer.millis();
+                                m.stats.maxMs = max(m.stats.maxMs, m.stats.lastMs);
+                                m.stats.totalMs += m.stats.lastMs;
+
+                                if (!isOk)
+                                    m.stats.errors += 1;
+                            }
+                        });
+
+                        return exception;
+                    }
+
+                    /**
+                     * Serialize per-model stats
+                     */
+                    void serializeTo(Writer& writer) {
+                        writer.beginArray(numModels);
+
+                        for (uint8_t i = 0; i < numModels; i++) {
+                            model_t &m = models[i];
+
+                            writer.beginObject(6);
+                            writer.kv("name", m.name);
+                            writer.kv("runs", m.stats.runs);
+                            writer.kv("errors", m.stats.errors);
+                            writer.kv("last_ms", m.stats.lastMs);
+                            writer.kv("max_ms", m.stats.maxMs);
+                            writer.kv("avg_ms", m.avgMs());
+                            writer.endObject();
+                        }
+
+                        writer.endArray();
+                    }
+
+                protected:
+                    uint8_t _perFrame;
+                    uint8_t _next;
+
+                    /**
+                     * Select models to run on this frame
+                     */
+                    uint8_t pick(model_t **due) {
+                        uint8_t count = 0;
+                        const uint8_t limit = _perFrame > 0 ? _perFrame : numModels;
+
+                        for (uint8_t k = 0; k < numModels && count < limit; k++) {
+                            const uint8_t i = _perFrame > 0 ? (_next + k) % numModels : k;
+
+                            if (!models[i].rate)
+                                continue;
+
+                            due[count++] = &models[i];
+
+                            if (_perFrame > 0)
+                                _next = (i + 1) % numModels;
+                        }
+
+                        return count;
+                    }
+            };
+        }
+    }
+}
+
+namespace eloq {
+    static Eloquent::Esp32cam::Scheduler::Scheduler scheduler;
+}
+
+#endif
@@ -0,0 +1,588 @@
+#ifndef ELOQUENT_ESP32CAM_TRANSFORM_RESIZE_H_
+#define ELOQUENT_ESP32CAM_TRANSFORM_RESIZE_H_
+
+#include <algorithm>
+#include <esp_camera.h>
+#include <esp_jpg_decode.h>
+#include "../extra/exception.h"
+
+using Eloquent::Error::Exception;
+
+
+namespace Eloquent {
+    namespace Esp32cam {
+        namespace Transform {
+            /**
+             * Decode camera frame straight into a fixed-size
+             * RGB888 (or gray) buffer.
+             * JPEG frames are decoded at the nearest JPEG scale (1/2/4/8)
+             * and nearest-sampled while decoding, so no full-size
+             * intermediate buffer is ever allocated.
+             */
+            class Resize {
+                public:
+                    Exception exception;
+                    uint8_t *pixels;
+                    size_t length;
+                    uint16_t width;
+                    uint16_t height;
+                    uint8_t channels;
+                    jpg_scale_t scale;
+                    uint32_t seq;
+                    struct {
+                        uint16_t x;
+                        uint16_t y;
+                        uint16_t width;
+                        uint16_t height;
+                    } region;
+
+                    /**
+                     * Constructor
+                     */
+                    Resize() :
+                        exception("Resize"),
+                        pixels(NULL),
+                        length(0),
+                        width(0),
+                        height(0),
+                        channels(3),
+                        scale(JPG_SCALE_NONE),
+                        seq(0),
+                        _bgr(false),
+                        _isCrop(false),
+                        _xmap(NULL),
+                        _ymap(NULL) {
+                            region.x = 0;
+                            region.y = 0;
+                            region.width = 0;
+                            region.height = 0;
+                            memset(&_maps, 0, sizeof(_maps));
+                            memset(&_allocated, 0, sizeof(_allocated));
+                        }
+
+                    /**
+                     * Destructor
+                     */
+                    ~Resize() {
+                        ::free(pixels);
+                        ::free(_xmap);
+                        ::free(_ymap);
+                    }
+
+                    // owns its buffers: copies would free them twice
+                    Resize(const Resize&) = delete;
+                    Resize& operator=(const Resize&) = delete;
+
+                    /**
+                     * Set output size
+                     */
+                    Resize& to(uint16_t w, uint16_t h) {
+                        width = w;
+                        height = h;
+
+                        return *this;
+                    }
+
+                    /**
+                     * Set output size so that the longest side is maxSide,
+                     * keeping the aspect ratio of the source
+                     */
+                    Resize& fit(uint16_t srcWidth, uint16_t srcHeight, uint16_t maxSide) {
+                        if (srcWidth <= maxSide && srcHeight <= maxSide)
+                            return to(srcWidth, srcHeight);
+
+                        if (srcWidth >= srcHeight)
+                            return to(maxSide, ((uint32_t) srcHeight) * maxSide / srcWidth);
+
+                        return to(((uint32_t) srcWidth) * maxSide / srcHeight, maxSide);
+                    }
+
+                    /**
+                     * Output RGB888
+                     */
+                    Resize& rgb() {
+                        channels = 3;
+                        _bgr = false;
+
+                        return *this;
+                    }
+
+                    /**
+                     * Output BGR888 (same layout as fmt2rgb888)
+                     */
+                    Resize& bgr() {
+                        channels = 3;
+                        _bgr = true;
+
+                        return *this;
+                    }
+
+                    /**
+                     * Output grayscale
+                     */
+                    Resize& gray() {
+                        channels = 1;
+
+                        return *this;
+                    }
+
+                    /**
+                     * Only sample the given region of the source frame
+                     */
+                    Resize& crop(uint16_t x, uint16_t y, uint16_t w, uint16_t h) {
+                        _isCrop = true;
+                        region.x = x;
+                        region.y = y;
+                        region.width = w;
+                        region.height = h;
+
+                        return *this;
+                    }
+
+                    /**
+                     * Sample the whole source frame
+                     */
+                    Resize& full() {
+                        _isCrop = false;
+
+                        return *this;
+                    }
+
+                    /**
+                     * Test if other produces the same output
+                     * (size, pixel format and region)
+                     */
+                    bool isSameAs(const Resize& other) const {
+                        if (width != other.width || height != other.height || channels != other.channels)
+                            return false;
+
+                        if (channels == 3 && _bgr != other._bgr)
+                            return false;
+
+                        if (_isCrop != other._isCrop)
+                            return false;
+
+                        return !_isCrop || (
+                            region.x == other.region.x && region.y == other.region.y &&
+                            region.width == other.region.width && region.height == other.region.height
+                        );
+                    }
+
+                    /**
+                     * Horizontal scale factor from output to source
+                     */
+                    inline float dx() const {
+                        return ((float) region.width) / width;
+                    }
+
+                    /**
+                     * Vertical scale factor from output to source
+                     */
+                    inline float dy() const {
+                        return ((float) region.height) / height;
+                    }
+
+                    /**
+                     * Map output x coordinate to source frame
+                     */
+                    inline int16_t toSourceX(float x) const {
+                        return region.x + x * dx();
+                    }
+
+                    /**
+                     * Map output y coordinate to source frame
+                     */
+                    inline int16_t toSourceY(float y) const {
+                        return region.y + y * dy();
+                    }
+
+                    /**
+                     * 64 bit difference hash of the output.
+                     * The image is averaged into a 9x8 luma grid and
+                     * each bit tells if a cell is darker than its right
+                     * neighbour: similar images have a small Hamming distance
+                     */
+                    uint64_t dhash() const {
+                        uint32_t sums[8][9] = {{0}};
+                        uint16_t counts[8][9] = {{0}};
+                        uint64_t hash = 0;
+                        const uint8_t *p = pixels;
+
+                        if (p == NULL)
+                            return 0;
+
+                        for (uint16_t y = 0; y < height; y++) {
+                            const uint8_t row = ((uint32_t) y) * 8 / height;
+
+                            for (uint16_t x = 0; x < width; x++, p += channels) {
+                                const uint8_t col = ((uint32_t) x) * 9 / width;
+
+                                sums[row][col] += channels == 1 ? p[0] : (p[0] + 2 * p[1] + p[2]) >> 2;
+                                counts[row][col] += 1;
+                            }
+                        }
+
+                        for (uint8_t row = 0; row < 8; row++) {
+                            for (uint8_t col = 0; col < 8; col++) {
+                                // compare averages without dividing
+                                const uint64_t left = ((uint64_t) sums[row][col]) * max<uint16_t>(1, counts[row][col + 1]);
+                                const uint64_t right = ((uint64_t) sums[row][col + 1]) * max<uint16_t>(1, counts[row][col]);
+
+                                hash = (hash << 1) | (left < right ? 1 : 0);
+                            }
+                        }
+
+                        return hash;
+                    }
+
+                    /**
+                     * Decode frame into pixels
+                     */
+                    Exception& decode(camera_fb_t *fb) {
+                        if (!prepare(fb).isOk())
+                            return exception;
+
+                        switch (fb->format) {
+                            case PIXFORMAT_JPEG:
+                                return decodeJpeg(fb);
+                            case PIXFORMAT_RGB565:
+                            case PIXFORMAT_GRAYSCALE:
+                                return sampleRaw(fb);
+                            default:
+                                return exception.set("Unsupported pixel format. Only JPEG, RGB565 and grayscale are allowed");
+                        }
+                    }
+
+                    /**
+                     * Decode many regions of the same frame.
+                     * JPEG frames are decoded once, at the largest scale
+                     * that satisfies all targets, and every decoded block
+                     * is scattered to the targets that need it.
+                     * Each target keeps its own exception
+                     *
+                     * @return number of targets successfully decoded
+                     */
+                    static uint8_t decodeAll(camera_fb_t *fb, Resize **targets, uint8_t count) {
+                        if (fb == NULL || fb->format != PIXFORMAT_JPEG) {
+                            uint8_t decoded = 0;
+
+                            for (uint8_t i = 0; i < count; i++)
+                                if (targets[i]->decode(fb).isOk())
+                                    decoded++;
+
+                            return decoded;
+                        }
+
+                        Resize *ready[count];
+                        Batch batch = {ready, 0, fb->buf};
+                        uint8_t s = 3;
+
+                        // prepare all, then pick a common scale
+                        for (uint8_t i = 0; i < count; i++) {
+                            if (!targets[i]->prepare(fb).isOk())
+                                continue;
+
+                            ready[batch.count++] = targets[i];
+                            s = min<uint8_t>(s, targets[i]->pickScale());
+                        }
+
+                        if (batch.count == 0)
+                            return 0;
+
+                        for (uint8_t i = 0; i < batch.count; i++) {
+                            ready[i]->scale = (jpg_scale_t) s;
+                            ready[i]->buildMaps(s);
+                        }
+
+                        const bool isOk = esp_jpg_decode(fb->len, (jpg_scale_t) s, &Resize::readBatch, &Resize::writeBatch, (void*) &batch) == ESP_OK;
+
+                        for (uint8_t i = 0; i < batch.count; i++) {
+                            if (isOk)
+                                ready[i]->exception.clear();
+                            else
+                                ready[i]->exception.set("Cannot decode JPEG frame");
+                        }
+
+                        return isOk ? batch.count : 0;
+                    }
+
+                protected:
+                    /**
+                     * State for batched decoding
+                     */
+                    struct Batch {
+                        Resize **targets;
+                        uint8_t count;
+                        const uint8_t *jpeg;
+                    };
+
+                    bool _bgr;
+                    bool _isCrop;
+                    uint16_t *_xmap;
+                    uint16_t *_ymap;
+                    struct {
+                        uint16_t x;
+                        uint16_t y;
+                        uint16_t width;
+                        uint16_t height;
+                        uint16_t outWidth;
+                        uint16_t outHeight;
+                        uint8_t scale;
+                    } _maps;
+                    struct {
+                        uint16_t width;
+                        uint16_t height;
+                    } _allocated;
+                    const uint8_t *_jpeg;
+
+                    /**
+                     * Validate region and allocate output.
+                     * Crops are grown outward to the 8 px block grid,
+                     * so no decoded block is only partially used
+                     */
+                    Exception& prepare(camera_fb_t *fb) {
+                        if (fb == NULL || fb->len == 0)
+                            return exception.set("Cannot resize empty frame");
+
+                        if (!width || !height)
+                            return exception.set("Output size not set");
+
+                        if (!_isCrop) {
+                            region.x = 0;
+                            region.y = 0;
+                            region.width = fb->width;
+                            region.height = fb->height;
+                        }
+
+                        if (region.width == 0 || region.height == 0 || region.x + region.width > fb->width || region.y + region.height > fb->height)
+                            return exception.set("Crop region is outside of frame");
+
+                        if (_isCrop && fb->format == PIXFORMAT_JPEG) {
+                            const uint16_t x2 = min<uint16_t>(fb->width, (region.x + region.width + 7) & ~7);
+                            const uint16_t y2 = min<uint16_t>(fb->height, (region.y + region.height + 7) & ~7);
+
+                            region.x &= ~7;
+                            region.y &= ~7;
+                            region.width = x2 - region.x;
+                            region.height = y2 - region.y;
+                        }
+
+                        if (!allocate())
+                            return exception.set("Cannot allocate memory for resized image");
+
+                        return exception.clear();
+                    }
+
+                    /**
+                     * (Re)allocate output buffer and index maps.
+                     * Output lives in PSRAM when available
+                     */
+                    bool allocate() {
+                        const size_t required = ((size_t) width) * height * channels;
+
+                        if (pixels != NULL && length == required && _allocated.width == width && _allocated.height == height)
+                            return true;
+
+                        ESP_LOGI("Resize", "(Re)Allocating %d bytes for %dx%dx%d image", required, width, height, channels);
+                        ::free(pixels);
+                        ::free(_xmap);
+                        ::free(_ymap);
+                        pixels = (uint8_t*) (psramFound() ? ps_malloc(required) : malloc(required));
+                        _xmap = (uint16_t*) malloc(width * sizeof(uint16_t));
+                        _ymap = (uint16_t*) malloc(height * sizeof(uint16_t));
+                        length = pixels == NULL ? 0 : required;
+                        _allocated.width = width;
+                        _allocated.height = height;
+                        memset(&_maps, 0, sizeof(_maps));
+
+                        return pixels != NULL && _xmap != NULL && _ymap != NULL;
+                    }
+
+                    /**
+                     * Pick the largest JPEG scale that keeps the
+                     * region at least as big as the output
+                     */
+                    jpg_scale_t pickScale() {
+                        for (uint8_t s = 3; s > 0; s--) {
+                            if ((region.width >> s) >= width && (region.height >> s) >= height)
+                                return (jpg_scale_t) s;
+                        }
+
+                        return JPG_SCALE_NONE;
+                    }
+
+                    /**
+                     * Precompute output -> (scaled) source indices.
+                     * Only runs when geometry changes
+                     */
+                    void buildMaps(uint8_t s) {
+                        if (
+                            _maps.x == region.x && _maps.y == region.y &&
+                            _maps.width == region.width && _maps.height == region.height &&
+                            _maps.outWidth == width && _maps.outHeight == height &&
+                            _maps.scale == s
+                        )
+                            return;
+
+                        for (uint16_t x = 0; x < width; x++)
+                            _xmap[x] = (region.x + (((uint32_t) 2 * x + 1) * region.width) / (2 * width)) >> s;
+
+                        for (uint16_t y = 0; y < height; y++)
+                            _ymap[y] = (region.y + (((uint32_t) 2 * y + 1) * region.height) / (2 * height)) >> s;
+
+                        _maps.x = region.x;
+                        _maps.y = region.y;
+                        _maps.width = region.width;
+                        _maps.height = region.height;
+                        _maps.outWidth = width;
+                        _maps.outHeight = height;
+                        _maps.scale = s;
+                    }
+
+                    /**
+                     * Write one RGB pixel to output
+                     */
+                    inline void put(uint8_t *out, uint8_t r, uint8_t g, uint8_t b) {
+                        if (channels == 1) {
+                            *out = (r * 38 + g * 75 + b * 15) >> 7;
+                        }
+                        else if (_bgr) {
+                            out[0] = b;
+                            out[1] = g;
+                            out[2] = r;
+                        }
+                        else {
+                            out[0] = r;
+                            out[1] = g;
+                            out[2] = b;
+                        }
+                    }
+
+                    /**
+                     * Decode JPEG with fused nearest resize
+                     */
+                    Exception& decodeJpeg(camera_fb_t *fb) {
+                        scale = pickScale();
+                        buildMaps(scale);
+                        _jpeg = fb->buf;
+
+                        if (esp_jpg_decode(fb->len, scale, &Resize::read, &Resize::write, (void*) this) != ESP_OK)
+                            return exception.set("Cannot decode JPEG frame");
+
+                        return exception.clear();
+                    }
+
+                    /**
+                     * Nearest-sample RGB565 or grayscale frames
+                     */
+                    Exception& sampleRaw(camera_fb_t *fb) {
+                        scale = JPG_SCALE_NONE;
+                        buildMaps(0);
+
+                        const bool isGray = fb->format == PIXFORMAT_GRAYSCALE;
+                        uint8_t *out = pixels;
+
+                        for (uint16_t y = 0; y < height; y++) {
+                            const uint8_t *row = fb->buf + ((size_t) _ymap[y]) * fb->width * (isGray ? 1 : 2);
+
+                            for (uint16_t x = 0; x < width; x++, out += channels) {
+                                if (isGray) {
+                                    const uint8_t v = row[_xmap[x]];
+
+                                    put(out, v, v, v);
+                                    continue;
+                                }
+
+                                // rgb565 bytes are big endian
+                                const uint8_t *p = row + _xmap[x] * 2;
+                                const uint16_t pixel = (p[0] << 8) | p[1];
+
+                                put(out, (pixel >> 8) & 0xF8, (pixel >> 3) & 0xFC, (pixel << 3) & 0xF8);
+                            }
+                        }
+
+                        return exception.clear();
+                    }
+
+                    /**
+                     * esp_jpg_decode input callback
+                     */
+                    static size_t read(void *arg, size_t index, uint8_t *buf, size_t len) {
+                        Resize *self = (Resize*) arg;
+
+                        if (buf != NULL)
+                            memcpy(buf, self->_jpeg + index, len);
+
+                        return len;
+                    }
+
+                    /**
+                     * esp_jpg_decode output callback.
+                     * Receives a decoded RGB block and copies the
+                     * pixels that fall on the output grid
+                     */
+                    static bool write(void *arg, uint16_t x, uint16_t y, uint16_t w, uint16_t h, uint8_t *data) {
+                        // header callback
+                        if (data == NULL)
+                            return true;
+
+                        ((Resize*) arg)->scatter(x, y, w, h, data);
+
+                        return true;
+                    }
+
+                    /**
+                     * esp_jpg_decode input callback (batch)
+                     */
+                    static size_t readBatch(void *arg, size_t index, uint8_t *buf, size_t len) {
+                        Batch *batch = (Batch*) arg;
+
+                        if (buf != NULL)
+                            memcpy(buf, batch->jpeg + index, len);
+
+                        return len;
+                    }
+
+                    /**
+                     * esp_jpg_decode output callback (batch)
+                     */
+                    static bool writeBatch(void *arg, uint16_t x, uint16_t y, uint16_t w, uint16_t h, uint8_t *data) {
+                        Batch *batch = (Batch*) arg;
+
+                        if (data == NULL)
+                            return true;
+
+                        for (uint8_t i = 0; i < batch->count; i++)
+                            batch->targets[i]->scatter(x, y, w, h, data);
+
+                        return true;
+                    }
+
+                    /**
+                     * Copy the pixels of a decoded RGB block
+                     * that fall on the output grid
+                     */
+                    void scatter(uint16_t x, uint16_t y, uint16_t w, uint16_t h, const uint8_t *data) {
+                        const uint16_t *ymap = _ymap;
+                        const uint16_t *xmap = _xmap;
+                        const uint16_t y0 = std::lower_bound(ymap, ymap + height, y) - ymap;
+                        const uint16_t x0 = std::lower_bound(xmap, xmap + width, x) - xmap;
+                        const uint8_t c = channels;
+
+                        for (uint16_t oy = y0; oy < height && ymap[oy] < y + h; oy++) {
+                            const uint8_t *row = data + ((size_t) (ymap[oy] - y)) * w * 3;
+                            uint8_t *out = pixels + (((size_t) oy) * width + x0) * c;
+
+                            for (uint16_t ox = x0; ox < width && xmap[ox] < x + w; ox++, out += c) {
+                                const uint8_t *p = row + (xmap[ox] - x) * 3;
+
+                                put(out, p[0], p[1], p[2]);
+                            }
+                        }
+                    }
+            };
+        }
+    }
+}
+
+#endif
@@ -5,6 +5,7 @@
 #include "../extra/esp32/http/server.h"
 #include "../extra/car/car2wd.h"
 #include "./mjpeg.h"
+#include "./stream/udp_stream.h"
 
 using namespace eloq;
 using Eloquent::Error::Exception;
@@ -30,7 +31,8 @@ namespace Eloquent {
                      */
                     CarStreamServer() :
                         exception("CarStreamServer"),
-                        server("CarStreamServer") {
+                        server("CarStreamServer"),
+                        _udp(false) {
 
                         }
 
@@ -48,6 +50,15 @@ namespace Eloquent {
                         this->car = &car;
                     }
 
+                    /**
+                     * Also stream frames over UDP.
+                     * Lower latency than MJPEG on lossy links,
+                     * since lost packets only drop one frame
+                     */
+                    void withUdp(bool enabled = true) {
+                        _udp = enabled;
+                    }
+
                     /**
                      * Start server
                      */
@@ -55,6 +66,9 @@ namespace Eloquent {
                         if (!viz::mjpeg.begin().isOk())
                             return exception.propagate(viz::mjpeg);
 
+                        if (_udp && !viz::udpStream.begin().isOk())
+                            return exception.propagate(viz::udpStream);
+
                         onIndex();
                         onCommand();
 
@@ -62,6 +76,7 @@ namespace Eloquent {
                     }
 
                 protected:
+                    bool _udp;
 
                     /**
                      * Display main page
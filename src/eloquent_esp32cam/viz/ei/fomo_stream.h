@@ -8,12 +8,16 @@
 #include "../../extra/esp32/http/server.h"
 #include "../../edgeimpulse/fomo.h"
 #include "../mjpeg.h"
+#include "../stream/annotation_daemon.h"
 
 using eloq::camera;
 using eloq::viz::mjpeg;
 using eloq::ei::fomo;
 using Eloquent::Error::Exception;
 using Eloquent::Extra::Esp32::Http::HttpServer;
+using Eloquent::Extra::Serialize::Encoding;
+using Eloquent::Extra::Serialize::Envelope;
+using Eloquent::Esp32cam::Viz::Stream::AnnotationDaemon;
 
 namespace Eloquent {
     namespace Esp32cam {
@@ -27,13 +31,15 @@ namespace Eloquent {
                     public:
                         Exception exception;
                         HttpServer server;
+                        AnnotationDaemon annotations;
 
                         /**
                          * Constructor
                          */
                         FOMOStream() :
                             exception("FOMO Stream"),
-                            server("FOMO Stream") {
+                            server("FOMO Stream"),
+                            annotations("FOMO Stream") {
 
                             }
 
@@ -48,74 +54,101 @@ namespace Eloquent {
                          * Start server
                          */
                         Exception& begin() {
+                            annotate();
+
                             if (!mjpeg.begin().isOk())
                                 return exception.propagate(mjpeg);
 
                             onIndex();
                             onEventStream();
+                            onTelemetry();
 
                             return server.beginInThread(exception);
                         }
 
                     protected:
 
+                        /**
+                         * Latest results with frame metadata.
+                         * MessagePack by default, ?format=json for text
+                         */
+                        void onTelemetry() {
+                            server.onGET("/telemetry", [this](WebServer *web) {
+                                Envelope<Eloquent::Esp32cam::EdgeImpulse::FOMO> envelope(fomo);
+
+                                server.sendEncoded(envelope, Encoding::MSGPACK);
+                            });
+                        }
+
                         /**
                          * Display main page
                          */
                         void onIndex() {
                         server.onGET("/", [this](WebServer *web) {
-                            static const uint8_t index[4851] = {31, 139, 8, 0, 0, 0, 0, 0, 0, 19, 149, 87, 109, 111, 226, 56, 16, 254, 222, 95, 97, 193, 158, 146, 116, 33, 105, 87, 251, 225, 196, 2, 171, 147, 110, 43, 157, 180, 167, 158, 218, 187, 79, 171, 213, 53, 56, 19, 226, 214, 177, 35, 219, 1, 34, 142, 255, 126, 126, 73, 10, 180, 129, 132, 145, 90, 96, 226, 121, 230, 153, 241, 204, 216, 153, 102, 42, 167, 243, 43, 164, 101, 154, 65, 156, 184, 175, 246, 167, 34, 138, 194, 252, 238, 254, 207, 123, 244, 168, 4, 196, 57, 122, 4, 177, 2, 49, 141, 220, 147, 253, 74, 137, 5, 41, 20, 146, 2, 207, 6, 153, 82, 133, 156, 68, 17, 78, 88, 168, 98, 66, 215, 132, 37, 88, 202, 16, 243, 124, 48, 159, 70, 110, 105, 237, 48, 218, 123, 156, 46, 120, 82, 161, 205, 56, 137, 85, 60, 27, 252, 86, 20, 126, 48, 64, 152, 198, 82, 206, 6, 41, 133, 13, 34, 10, 114, 57, 198, 192, 20, 8, 244, 92, 74, 69, 210, 170, 254, 57, 56, 160, 146, 144, 85, 99, 38, 128, 198, 138, 172, 224, 224, 177, 93, 66, 242, 37, 154, 88, 174, 249, 115, 1, 203, 1, 138, 222, 44, 208, 158, 10, 109, 10, 154, 78, 202, 197, 108, 176, 88, 112, 237, 159, 33, 243, 9, 114, 128, 38, 47, 80, 57, 109, 72, 146, 55, 232, 13, 137, 247, 90, 251, 164, 104, 200, 197, 11, 201, 105, 169, 125, 16, 70, 9, 131, 241, 130, 114, 252, 130, 214, 227, 207, 40, 211, 127, 11, 46, 18, 16, 227, 79, 205, 151, 56, 95, 232, 255, 159, 111, 110, 208, 88, 137, 152, 73, 195, 110, 188, 25, 223, 70, 159, 14, 21, 149, 85, 8, 94, 178, 4, 146, 113, 90, 82, 170, 185, 74, 85, 81, 152, 13, 182, 20, 82, 53, 65, 79, 31, 182, 150, 55, 222, 236, 126, 121, 26, 33, 197, 139, 3, 93, 165, 117, 59, 179, 73, 69, 23, 251, 140, 36, 9, 48, 212, 30, 132, 227, 124, 58, 134, 147, 164, 90, 56, 85, 86, 181, 38, 137, 202, 246, 202, 181, 85, 102, 64, 150, 217, 129, 117, 118, 134, 253, 52, 122, 183, 37, 186, 138, 235, 109, 62, 168, 30, 183, 172, 189, 176, 163, 168, 100, 197, 203, 210, 20, 114, 20, 211, 66, 199, 251, 172, 107, 33, 129, 20, 196, 155, 186, 62, 48, 61, 246, 105, 122, 129, 175, 195, 191, 97, 163, 238, 68, 156, 67, 221, 86, 51, 148, 150, 12, 43, 194, 153, 15, 44, 41, 56, 97, 106, 132, 56, 179, 75, 2, 180, 125, 23, 141, 202, 136, 12, 229, 59, 219, 182, 165, 70, 40, 40, 180, 40, 83, 205, 83, 175, 246, 188, 171, 214, 69, 41, 40, 156, 189, 186, 15, 90, 215, 24, 9, 85, 6, 204, 23, 32, 209, 108, 126, 194, 95, 35, 152, 51, 169, 144, 102, 153, 88, 207, 218, 38, 52, 77, 30, 46, 65, 61, 88, 165, 127, 218, 205, 222, 62, 1, 204, 29, 0, 131, 53, 50, 169, 251, 221, 105, 122, 89, 11, 168, 13, 31, 96, 249, 109, 83, 248, 94, 120, 253, 117, 56, 124, 188, 191, 27, 14, 253, 240, 227, 215, 96, 56, 252, 230, 190, 95, 7, 222, 8, 121, 210, 11, 218, 211, 211, 136, 139, 38, 52, 31, 126, 224, 114, 209, 228, 31, 21, 101, 94, 248, 219, 132, 51, 24, 161, 85, 76, 75, 216, 157, 218, 145, 67, 33, 41, 242, 141, 205, 249, 104, 246, 254, 85, 41, 216, 151, 243, 36, 141, 212, 27, 254, 113, 214, 36, 48, 116, 159, 190, 101, 166, 169, 115, 93, 124, 132, 45, 253, 142, 128, 141, 68, 145, 77, 161, 25, 205, 200, 244, 57, 74, 205, 136, 233, 21, 153, 128, 80, 129, 84, 190, 163, 19, 244, 73, 136, 17, 83, 178, 63, 254, 29, 161, 212, 180, 192, 200, 148, 142, 250, 105, 75, 40, 132, 13, 224, 6, 173, 155, 185, 17, 37, 170, 158, 94, 27, 210, 214, 107, 168, 211, 147, 235, 61, 166, 192, 150, 42, 67, 115, 116, 211, 111, 135, 26, 169, 251, 247, 8, 172, 31, 194, 14, 225, 88, 55, 35, 242, 77, 243, 239, 250, 5, 249, 218, 223, 38, 85, 157, 22, 61, 64, 245, 158, 11, 192, 165, 144, 208, 185, 212, 213, 100, 91, 107, 152, 142, 8, 190, 156, 5, 216, 157, 206, 201, 137, 71, 187, 171, 246, 95, 151, 205, 96, 125, 195, 232, 154, 157, 117, 92, 237, 181, 99, 175, 14, 250, 240, 49, 215, 29, 125, 219, 249, 176, 173, 113, 245, 9, 24, 27, 196, 48, 227, 82, 237, 38, 191, 222, 70, 79, 163, 86, 0, 119, 153, 152, 160, 31, 63, 71, 237, 187, 65, 24, 81, 39, 103, 186, 17, 55, 225, 94, 207, 129, 102, 60, 30, 156, 44, 190, 23, 193, 74, 95, 145, 164, 158, 109, 174, 16, 131, 238, 177, 109, 79, 23, 199, 206, 100, 200, 88, 117, 150, 64, 40, 11, 170, 217, 122, 255, 121, 221, 37, 30, 230, 113, 225, 219, 49, 210, 73, 229, 56, 210, 34, 214, 92, 100, 29, 233, 63, 15, 223, 31, 33, 22, 56, 251, 203, 106, 45, 96, 207, 129, 96, 90, 220, 97, 153, 163, 200, 247, 64, 8, 46, 188, 158, 205, 105, 164, 46, 12, 195, 138, 83, 61, 146, 140, 125, 59, 226, 5, 51, 253, 130, 25, 229, 145, 196, 155, 152, 116, 72, 248, 131, 169, 35, 207, 250, 73, 16, 180, 23, 92, 43, 210, 70, 3, 221, 234, 107, 229, 181, 131, 187, 163, 60, 62, 6, 220, 92, 134, 87, 117, 225, 85, 151, 225, 173, 187, 240, 214, 151, 225, 101, 93, 120, 217, 101, 120, 184, 51, 129, 248, 194, 12, 226, 206, 20, 226, 254, 57, 220, 117, 31, 5, 61, 26, 54, 37, 84, 191, 101, 249, 246, 53, 72, 247, 172, 187, 131, 159, 63, 17, 119, 103, 106, 223, 77, 172, 250, 2, 123, 226, 22, 247, 158, 120, 191, 177, 63, 141, 204, 21, 115, 126, 165, 95, 45, 205, 123, 237, 255, 36, 41, 195, 187, 222, 14, 0, 0};
-                            server.sendGzip(index, 4851);
+                            static const uint8_t index[1408] = {31, 139, 8, 0, 0, 0, 0, 0, 2, 3, 157, 88, 109, 111, 219, 54, 16, 254, 238, 95, 65, 24, 89, 37, 53, 150, 148, 180, 253, 80, 120, 118, 134, 110, 107, 247, 130, 182, 41, 146, 21, 24, 16, 116, 136, 44, 157, 44, 38, 122, 27, 73, 199, 22, 92, 253, 247, 29, 73, 41, 150, 19, 89, 146, 39, 32, 145, 125, 188, 123, 248, 240, 94, 200, 163, 103, 145, 72, 226, 139, 17, 193, 103, 22, 129, 23, 232, 143, 234, 171, 160, 34, 134, 139, 15, 151, 159, 46, 201, 181, 96, 224, 37, 228, 26, 216, 3, 176, 153, 171, 71, 118, 154, 220, 103, 52, 23, 132, 51, 127, 62, 142, 132, 200, 249, 212, 117, 253, 32, 117, 132, 71, 227, 53, 77, 3, 159, 115, 199, 207, 146, 241, 197, 204, 213, 170, 213, 132, 238, 110, 198, 217, 34, 11, 10, 178, 177, 3, 79, 120, 243, 241, 187, 60, 55, 173, 49, 241, 99, 143, 243, 249, 56, 140, 97, 67, 168, 128, 132, 219, 62, 164, 2, 24, 185, 91, 113, 65, 195, 162, 250, 58, 110, 80, 9, 232, 67, 109, 198, 32, 246, 4, 125, 128, 198, 176, 82, 161, 201, 146, 76, 21, 215, 144, 121, 9, 140, 137, 251, 68, 1, 103, 202, 209, 20, 144, 78, 152, 177, 249, 120, 177, 200, 112, 254, 148, 200, 55, 240, 49, 153, 222, 67, 161, 165, 14, 13, 158, 160, 215, 36, 158, 75, 213, 72, 94, 147, 243, 22, 60, 139, 87, 56, 7, 77, 99, 154, 130, 189, 136, 51, 255, 158, 172, 237, 55, 36, 194, 191, 69, 198, 2, 96, 246, 171, 250, 131, 151, 44, 240, 255, 155, 179, 51, 98, 11, 230, 165, 92, 178, 179, 55, 246, 185, 251, 170, 41, 40, 148, 128, 101, 171, 52, 128, 192, 14, 87, 113, 140, 92, 185, 40, 98, 152, 143, 183, 49, 132, 98, 74, 110, 79, 182, 138, 183, 191, 41, 127, 184, 157, 16, 145, 229, 13, 89, 129, 178, 82, 6, 41, 239, 99, 31, 209, 32, 128, 148, 180, 47, 66, 115, 62, 188, 134, 131, 164, 90, 56, 21, 74, 180, 166, 129, 136, 118, 194, 181, 18, 70, 64, 151, 81, 195, 58, 234, 96, 63, 115, 159, 133, 4, 179, 184, 10, 115, 35, 123, 180, 90, 123, 98, 187, 238, 42, 205, 239, 151, 50, 145, 93, 47, 206, 113, 189, 119, 152, 11, 1, 132, 192, 158, 228, 117, 195, 116, 127, 78, 215, 37, 88, 71, 1, 17, 17, 144, 79, 127, 126, 121, 255, 27, 225, 186, 176, 114, 143, 9, 178, 40, 212, 123, 66, 120, 70, 192, 243, 35, 162, 210, 147, 224, 124, 192, 159, 194, 172, 169, 136, 20, 76, 0, 2, 124, 65, 179, 148, 75, 197, 28, 131, 17, 144, 44, 197, 106, 33, 166, 2, 149, 21, 6, 140, 91, 123, 0, 178, 38, 179, 181, 243, 233, 46, 135, 101, 85, 218, 115, 18, 174, 82, 5, 100, 66, 26, 228, 25, 77, 145, 72, 150, 126, 144, 20, 44, 178, 125, 230, 81, 17, 81, 238, 240, 218, 214, 227, 69, 234, 239, 16, 218, 12, 228, 227, 35, 77, 129, 46, 224, 210, 100, 237, 33, 201, 16, 132, 31, 61, 206, 104, 117, 90, 201, 133, 160, 33, 154, 59, 114, 179, 112, 150, 32, 174, 148, 208, 236, 178, 11, 192, 207, 180, 97, 10, 107, 242, 23, 108, 196, 175, 90, 114, 192, 42, 6, 140, 196, 42, 12, 31, 77, 190, 34, 177, 183, 239, 24, 243, 10, 243, 204, 26, 117, 204, 132, 171, 184, 12, 127, 215, 254, 70, 91, 244, 194, 252, 226, 128, 35, 228, 131, 91, 11, 49, 229, 108, 20, 149, 207, 126, 196, 215, 41, 121, 77, 102, 213, 228, 78, 12, 233, 82, 68, 40, 62, 61, 181, 14, 98, 200, 135, 134, 196, 212, 54, 55, 244, 27, 153, 207, 231, 228, 252, 53, 121, 241, 130, 212, 50, 132, 61, 175, 228, 103, 79, 228, 175, 14, 232, 191, 174, 245, 187, 103, 150, 15, 3, 177, 98, 152, 111, 163, 81, 143, 134, 125, 222, 170, 81, 182, 27, 174, 35, 26, 3, 49, 5, 91, 129, 213, 225, 67, 237, 248, 109, 144, 165, 48, 33, 15, 94, 188, 130, 242, 49, 181, 116, 194, 56, 242, 101, 90, 135, 233, 73, 247, 73, 251, 238, 165, 234, 69, 140, 122, 136, 36, 192, 150, 88, 127, 207, 242, 102, 47, 164, 232, 95, 197, 180, 250, 218, 65, 77, 195, 57, 28, 68, 133, 96, 13, 81, 85, 224, 147, 253, 52, 58, 108, 248, 152, 234, 26, 225, 48, 153, 129, 17, 217, 43, 7, 132, 109, 22, 69, 87, 24, 234, 80, 72, 171, 25, 25, 144, 120, 11, 12, 236, 253, 104, 0, 15, 185, 3, 34, 145, 106, 31, 112, 244, 187, 14, 9, 95, 45, 60, 93, 218, 19, 73, 213, 178, 6, 2, 234, 221, 65, 110, 207, 88, 227, 166, 148, 56, 137, 39, 183, 50, 25, 249, 43, 88, 190, 223, 228, 230, 237, 63, 39, 91, 169, 82, 78, 137, 233, 188, 180, 78, 240, 204, 50, 18, 106, 88, 22, 249, 254, 157, 220, 124, 179, 110, 176, 44, 241, 147, 97, 12, 152, 179, 74, 157, 185, 60, 33, 56, 252, 145, 10, 83, 179, 48, 141, 95, 50, 108, 129, 82, 97, 127, 84, 26, 136, 222, 239, 99, 202, 63, 123, 159, 205, 42, 51, 250, 130, 185, 151, 36, 79, 189, 38, 163, 117, 74, 222, 244, 71, 11, 87, 33, 104, 186, 130, 78, 197, 114, 52, 112, 163, 171, 43, 105, 70, 42, 2, 248, 215, 151, 232, 71, 231, 141, 60, 28, 171, 82, 254, 57, 206, 22, 230, 77, 189, 248, 152, 250, 80, 175, 124, 242, 156, 193, 183, 9, 217, 138, 34, 135, 41, 49, 104, 226, 45, 193, 149, 64, 70, 217, 19, 151, 62, 23, 55, 86, 216, 137, 35, 88, 49, 32, 160, 213, 193, 110, 74, 106, 19, 82, 167, 210, 223, 182, 146, 218, 215, 240, 175, 97, 169, 19, 96, 55, 242, 235, 99, 159, 81, 13, 255, 212, 58, 136, 3, 184, 110, 163, 59, 12, 37, 241, 101, 173, 96, 177, 99, 242, 149, 163, 195, 233, 48, 76, 186, 47, 41, 27, 221, 220, 160, 166, 172, 106, 134, 240, 202, 209, 108, 130, 218, 202, 162, 58, 201, 218, 221, 155, 72, 95, 98, 55, 42, 239, 63, 120, 253, 57, 217, 86, 184, 216, 18, 123, 18, 209, 137, 50, 46, 202, 233, 219, 115, 247, 118, 210, 10, 160, 186, 61, 233, 188, 246, 97, 125, 249, 152, 226, 198, 49, 105, 207, 0, 154, 82, 97, 246, 31, 150, 143, 61, 155, 76, 236, 70, 7, 104, 170, 142, 46, 209, 25, 81, 37, 198, 174, 185, 236, 233, 101, 228, 243, 245, 234, 35, 30, 182, 15, 217, 61, 92, 46, 238, 208, 12, 191, 107, 76, 181, 176, 238, 140, 216, 233, 33, 49, 9, 228, 35, 37, 209, 0, 146, 124, 6, 64, 104, 39, 169, 221, 190, 102, 222, 91, 11, 14, 207, 99, 244, 156, 241, 221, 232, 223, 60, 112, 147, 207, 77, 121, 213, 233, 119, 199, 190, 215, 113, 219, 246, 18, 94, 119, 6, 87, 31, 175, 193, 99, 126, 244, 69, 73, 21, 96, 79, 89, 55, 247, 64, 141, 37, 219, 95, 211, 0, 198, 50, 102, 88, 214, 32, 227, 70, 14, 75, 86, 89, 12, 142, 178, 111, 71, 28, 29, 1, 183, 29, 60, 191, 65, 3, 99, 186, 59, 197, 154, 51, 227, 136, 101, 77, 134, 35, 109, 16, 232, 28, 175, 196, 47, 53, 220, 135, 56, 243, 246, 1, 55, 199, 225, 21, 125, 120, 197, 113, 120, 235, 62, 188, 245, 113, 120, 81, 31, 94, 116, 28, 158, 223, 235, 64, 255, 72, 15, 250, 189, 46, 244, 135, 251, 176, 236, 213, 42, 7, 20, 108, 72, 99, 129, 135, 148, 250, 9, 7, 107, 86, 189, 229, 101, 71, 253, 142, 64, 46, 186, 58, 205, 174, 35, 91, 239, 162, 213, 5, 248, 192, 77, 242, 255, 158, 84, 51, 87, 94, 111, 47, 70, 51, 87, 253, 54, 247, 31, 199, 159, 24, 167, 162, 19, 0, 0};
+                            server.sendGzip(index, 1408);
                         });
                     }
 
 
                         /**
-                         * 
+                         * Run FOMO on its own task, so MJPEG
+                         * clients never wait for inference.
+                         * Each broadcast frame waits for the results computed
+                         * on it, so the page draws them on the right picture
                          */
-                        void onEventStream() {
-                            server.onStream("/events", [this](WebServer *web, WiFiClient *client) {
+                        void annotate() {
+                            mjpeg.broadcaster.annotate([this](uint32_t frameSeq, String& annotation) {
+                                return annotations.annotationOf(frameSeq, annotation);
+                            });
+
+                            annotations.begin([](String& annotation) -> uint32_t {
                                 if (!fomo.run().isOk()) {
-                                    delay(100);
-                                    client->print("err=");
-                                    client->print(fomo.exception.toString());
-                                    return;
+                                    annotation += "err=";
+                                    annotation += fomo.exception.toString();
+                                    return 0;
                                 }
 
                                 if (!fomo.found()) {
-                                    client->print("status=No objects found");
-                                    return;
+                                    annotation += "status=No objects found";
+                                    return fomo.seq;
                                 }
 
-                                fomo.forEach([client](int i, eloq::ei::bbox_t bbox) {
-                                    ESP_LOGI(
-                                        "FOMO", 
-                                        "id=%d,x=%d,y=%d,w=%d,h=%d,cx=%d,cy=%d",
-                                        i, 
-                                        bbox.x, 
-                                        bbox.y, 
-                                        bbox.width, 
-                                        bbox.height,
-                                        bbox.cx,
-                                        bbox.cy
-                                    );
-                                    client->print("id=");
-                                    client->print(i);
-                                    client->print("&x=");
-                                    client->print(((float) bbox.x) / EI_CLASSIFIER_INPUT_WIDTH);
-                                    client->print("&y=");
-                                    client->print(((float) bbox.y) / EI_CLASSIFIER_INPUT_HEIGHT);
-                                    client->print("&w=");
-                                    client->print(((float) bbox.width) / EI_CLASSIFIER_INPUT_WIDTH);
-                                    client->print("&h=");
-                                    client->print(((float) bbox.height) / EI_CLASSIFIER_INPUT_HEIGHT);
-                                    client->print("&cx=");
-                                    client->print(((float) bbox.cx) / EI_CLASSIFIER_INPUT_WIDTH);
-                                    client->print("&cy=");
-                                    client->print(((float) bbox.cy) / EI_CLASSIFIER_INPUT_HEIGHT);
-                                    client->print("|");
+                                fomo.forEach([&annotation](int i, eloq::ei::bbox_t bbox) {
+                                    // track id stays the same across frames
+                                    annotation += "id=";
+                                    annotation += fomo.isTracking() ? (int) bbox.id : i;
+                                    annotation += "&x=";
+                                    annotation += ((float) bbox.x) / EI_CLASSIFIER_INPUT_WIDTH;
+                                    annotation += "&y=";
+                                    annotation += ((float) bbox.y) / EI_CLASSIFIER_INPUT_HEIGHT;
+                                    annotation += "&w=";
+                                    annotation += ((float) bbox.width) / EI_CLASSIFIER_INPUT_WIDTH;
+                                    annotation += "&h=";
+                                    annotation += ((float) bbox.height) / EI_CLASSIFIER_INPUT_HEIGHT;
+                                    annotation += "&cx=";
+                                    annotation += ((float) bbox.cx) / EI_CLASSIFIER_INPUT_WIDTH;
+                                    annotation += "&cy=";
+                                    annotation += ((float) bbox.cy) / EI_CLASSIFIER_INPUT_HEIGHT;
+                                    annotation += "|";
                                 });
-                            }, 7000);
+
+                                return fomo.seq;
+                            });
+                        }
+
+                        /**
+                         * Push the latest results as soon as they're
+                         * available, whether or not anyone is
+                         * watching the MJPEG stream
+                         * (no inference happens here)
+                         */
+                        void onEventStream() {
+                            server.onStreamOnChange("/events", [this]() {
+                                return annotations.seq();
+                            }, [this](WebServer *web, WiFiClient *client) {
+                                client->print(annotations.latest());
+                            });
                         }
                 };
             }
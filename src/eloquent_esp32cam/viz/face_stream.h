@@ -7,13 +7,17 @@
 #include "../extra/esp32/http/server.h"
 #include "../face/detection.h"
 #include "./mjpeg.h"
+#include "./stream/annotation_daemon.h"
 
 using eloq::viz::mjpeg;
 using eloq::face::detection;
 using eloq::face_t;
 using Eloquent::Error::Exception;
 using Eloquent::Extra::Esp32::Http::HttpServer;
+using Eloquent::Extra::Serialize::Encoding;
+using Eloquent::Extra::Serialize::Envelope;
 using Eloquent::Esp32cam::Face::FaceDetection;
+using Eloquent::Esp32cam::Viz::Stream::AnnotationDaemon;
 
 
 namespace Eloquent {
@@ -26,13 +30,15 @@ namespace Eloquent {
                 public:
                     Exception exception;
                     HttpServer server;
+                    AnnotationDaemon annotations;
 
                     /**
                      * Constructor
                      */
                     FaceDetectionStream() :
                         exception("FaceDetectionStream"),
-                        server("FaceDetectionStream") {
+                        server("FaceDetectionStream"),
+                        annotations("FaceDetectionStream") {
 
                         }
 
@@ -47,90 +53,118 @@ namespace Eloquent {
                      * Start server
                      */
                     Exception& begin() {
+                        annotate();
+
                         if (!mjpeg.begin().isOk())
                             return exception.propagate(mjpeg);
 
                         onIndex();
                         onEventStream();
+                        onTelemetry();
 
                         return server.beginInThread(exception);
                     }
 
                 protected:
 
+                    /**
+                     * Latest results with frame metadata.
+                     * MessagePack by default, ?format=json for text
+                     */
+                    void onTelemetry() {
+                        server.onGET("/telemetry", [this](WebServer *web) {
+                            Envelope<FaceDetection> envelope(detection);
+
+                            server.sendEncoded(envelope, Encoding::MSGPACK);
+                        });
+                    }
+
                     /**
                      * Display main page
                      */
                     void onIndex() {
                         server.onGET("/", [this](WebServer *web) {
-                            static const uint8_t index[5264] = {31, 139, 8, 0, 0, 0, 0, 0, 0, 19, 173, 88, 109, 111, 219, 54, 16, 254, 158, 95, 193, 217, 5, 36, 181, 182, 148, 22, 251, 48, 184, 182, 139, 1, 109, 128, 2, 3, 54, 36, 221, 167, 34, 104, 100, 233, 100, 49, 161, 40, 130, 164, 98, 27, 142, 254, 251, 248, 34, 249, 45, 146, 37, 15, 57, 160, 149, 69, 221, 61, 119, 207, 145, 119, 36, 51, 77, 101, 70, 230, 87, 72, 201, 52, 133, 48, 182, 63, 205, 171, 196, 146, 192, 252, 38, 140, 0, 125, 5, 9, 145, 196, 57, 69, 119, 192, 159, 129, 79, 3, 251, 113, 175, 44, 34, 142, 153, 68, 130, 71, 179, 65, 42, 37, 19, 147, 32, 136, 98, 234, 203, 16, 147, 21, 166, 113, 36, 132, 31, 229, 217, 96, 62, 13, 172, 106, 229, 51, 216, 59, 157, 46, 242, 120, 131, 214, 227, 56, 148, 225, 108, 240, 39, 99, 174, 55, 64, 17, 9, 133, 152, 13, 18, 2, 107, 132, 37, 100, 98, 28, 1, 149, 192, 209, 99, 33, 36, 78, 54, 213, 235, 224, 32, 148, 24, 63, 215, 102, 28, 72, 40, 241, 51, 28, 124, 54, 42, 56, 91, 162, 137, 137, 53, 123, 100, 176, 28, 160, 224, 68, 65, 121, 98, 202, 20, 84, 56, 73, 206, 103, 131, 197, 34, 87, 254, 41, 210, 79, 16, 3, 52, 121, 130, 141, 29, 245, 113, 124, 130, 126, 26, 132, 214, 106, 80, 49, 106, 172, 86, 10, 23, 34, 39, 133, 114, 136, 41, 193, 20, 198, 11, 146, 71, 79, 104, 145, 243, 88, 113, 181, 143, 241, 167, 250, 71, 152, 45, 212, 255, 191, 95, 95, 171, 64, 132, 220, 16, 152, 13, 182, 4, 18, 57, 65, 15, 239, 182, 38, 168, 117, 201, 214, 15, 35, 36, 115, 182, 31, 219, 216, 177, 21, 142, 101, 186, 31, 93, 217, 209, 20, 240, 50, 61, 0, 72, 245, 112, 169, 167, 139, 181, 132, 126, 154, 162, 39, 86, 39, 200, 87, 201, 97, 57, 166, 82, 180, 208, 238, 69, 125, 185, 167, 137, 86, 227, 143, 40, 85, 255, 120, 94, 208, 24, 226, 113, 82, 16, 210, 196, 253, 137, 157, 50, 87, 35, 155, 78, 42, 65, 205, 165, 97, 34, 3, 53, 147, 39, 139, 163, 65, 189, 82, 107, 174, 135, 32, 40, 40, 123, 90, 234, 245, 31, 132, 132, 41, 142, 143, 106, 9, 197, 144, 0, 63, 41, 135, 3, 211, 99, 159, 186, 132, 242, 149, 255, 3, 214, 242, 134, 135, 25, 220, 73, 14, 97, 134, 102, 40, 41, 168, 41, 76, 23, 104, 108, 114, 62, 66, 57, 53, 42, 30, 218, 190, 98, 35, 83, 44, 124, 241, 202, 182, 73, 85, 11, 1, 137, 22, 69, 162, 226, 84, 218, 142, 115, 213, 168, 148, 128, 140, 210, 157, 123, 175, 117, 194, 125, 153, 2, 117, 57, 8, 52, 155, 183, 248, 171, 37, 202, 169, 144, 72, 69, 25, 27, 207, 202, 198, 215, 189, 193, 95, 130, 188, 53, 131, 110, 187, 155, 189, 125, 12, 81, 110, 1, 40, 172, 144, 78, 221, 87, 59, 210, 203, 154, 67, 101, 120, 11, 203, 111, 107, 230, 58, 254, 251, 47, 195, 225, 221, 223, 55, 195, 161, 235, 127, 248, 226, 13, 135, 223, 236, 239, 247, 158, 51, 66, 142, 112, 188, 230, 244, 212, 98, 217, 248, 250, 225, 122, 54, 23, 117, 254, 17, 43, 50, 230, 110, 227, 156, 194, 8, 61, 135, 164, 128, 178, 109, 70, 14, 5, 39, 200, 213, 54, 231, 217, 236, 253, 203, 130, 211, 207, 231, 131, 212, 82, 77, 248, 135, 89, 157, 64, 223, 62, 93, 19, 153, 10, 61, 87, 139, 15, 211, 165, 219, 65, 88, 75, 16, 152, 20, 234, 142, 142, 116, 109, 163, 68, 23, 112, 47, 102, 28, 124, 9, 66, 186, 54, 28, 175, 79, 66, 180, 232, 37, 251, 243, 215, 8, 37, 186, 4, 70, 122, 233, 200, 123, 179, 132, 124, 88, 67, 84, 163, 117, 71, 174, 69, 242, 77, 79, 175, 117, 208, 198, 171, 175, 210, 147, 169, 57, 38, 64, 151, 50, 69, 115, 116, 221, 111, 134, 106, 169, 234, 247, 8, 172, 31, 66, 137, 162, 80, 21, 35, 114, 117, 241, 151, 253, 72, 238, 234, 91, 167, 170, 211, 162, 7, 168, 154, 115, 14, 81, 193, 5, 116, 170, 218, 53, 217, 84, 26, 186, 34, 188, 207, 103, 1, 202, 246, 156, 180, 124, 42, 175, 154, 223, 46, 235, 193, 234, 96, 210, 213, 59, 43, 94, 205, 107, 199, 156, 56, 212, 222, 164, 79, 73, 234, 144, 244, 110, 91, 225, 170, 93, 47, 212, 136, 126, 154, 11, 89, 78, 254, 248, 24, 60, 140, 26, 1, 236, 25, 100, 130, 126, 222, 143, 154, 103, 3, 83, 44, 91, 123, 186, 22, 221, 225, 114, 2, 202, 229, 210, 117, 190, 43, 237, 115, 205, 203, 182, 195, 221, 166, 81, 247, 210, 131, 109, 200, 117, 2, 120, 86, 199, 48, 225, 84, 117, 215, 221, 225, 205, 70, 100, 137, 232, 100, 106, 163, 206, 213, 226, 11, 70, 20, 49, 231, 197, 233, 174, 6, 63, 11, 153, 107, 58, 78, 103, 40, 199, 60, 89, 168, 98, 17, 21, 207, 127, 111, 255, 186, 131, 144, 71, 233, 63, 102, 212, 0, 246, 236, 29, 186, 27, 88, 44, 189, 107, 185, 14, 112, 158, 115, 167, 103, 29, 107, 169, 214, 80, 61, 85, 198, 190, 25, 241, 130, 246, 127, 73, 59, 139, 39, 232, 208, 29, 142, 29, 15, 189, 188, 160, 235, 230, 69, 217, 36, 235, 99, 132, 245, 197, 0, 155, 99, 128, 205, 197, 0, 171, 99, 128, 213, 197, 0, 233, 49, 64, 122, 49, 192, 238, 40, 172, 234, 245, 162, 93, 64, 203, 246, 36, 131, 4, 126, 237, 146, 120, 154, 28, 245, 173, 206, 79, 217, 63, 188, 54, 79, 252, 140, 39, 254, 166, 158, 72, 118, 134, 83, 246, 166, 156, 206, 120, 226, 111, 234, 137, 30, 56, 58, 245, 68, 255, 175, 163, 251, 139, 180, 253, 4, 19, 117, 47, 118, 213, 173, 76, 117, 64, 125, 47, 66, 191, 205, 208, 181, 118, 172, 175, 68, 230, 229, 178, 99, 137, 105, 169, 22, 206, 173, 8, 11, 248, 78, 165, 171, 193, 189, 58, 163, 187, 161, 141, 87, 246, 61, 181, 116, 159, 58, 122, 52, 252, 138, 175, 185, 168, 171, 16, 237, 221, 86, 209, 60, 203, 179, 60, 211, 61, 237, 142, 87, 221, 150, 90, 174, 12, 175, 67, 239, 119, 198, 152, 6, 250, 62, 51, 191, 154, 6, 230, 207, 47, 255, 1, 168, 34, 35, 70, 133, 17, 0, 0};
-                            server.sendGzip(index, 5264);
+                            static const uint8_t index[1496] = {31, 139, 8, 0, 0, 0, 0, 0, 2, 3, 173, 88, 109, 111, 219, 54, 16, 254, 238, 95, 193, 25, 65, 37, 45, 182, 148, 180, 253, 80, 120, 118, 134, 110, 109, 183, 14, 125, 67, 178, 2, 3, 130, 108, 145, 165, 179, 197, 88, 111, 35, 233, 216, 130, 171, 255, 190, 35, 41, 217, 178, 43, 75, 114, 87, 1, 137, 172, 211, 221, 115, 239, 228, 81, 227, 64, 68, 225, 85, 143, 224, 53, 14, 192, 245, 245, 79, 245, 40, 168, 8, 225, 234, 141, 235, 1, 121, 5, 2, 60, 65, 147, 152, 220, 0, 123, 4, 54, 118, 244, 203, 29, 51, 247, 24, 77, 5, 225, 204, 155, 244, 3, 33, 82, 62, 114, 28, 207, 143, 109, 225, 210, 112, 69, 99, 223, 227, 220, 246, 146, 168, 127, 53, 118, 52, 107, 161, 211, 217, 41, 29, 79, 19, 63, 35, 235, 161, 239, 10, 119, 210, 127, 153, 166, 166, 213, 39, 94, 232, 114, 62, 233, 207, 66, 88, 19, 42, 32, 226, 67, 15, 98, 1, 140, 60, 44, 185, 160, 179, 172, 120, 236, 87, 76, 241, 233, 99, 41, 198, 32, 116, 5, 125, 132, 202, 107, 197, 66, 163, 57, 25, 41, 91, 103, 204, 141, 160, 79, 156, 3, 6, 212, 148, 162, 40, 160, 57, 179, 132, 77, 250, 211, 105, 130, 250, 99, 34, 239, 192, 251, 100, 180, 128, 76, 83, 109, 234, 31, 160, 31, 26, 33, 185, 106, 88, 20, 91, 90, 50, 185, 83, 158, 132, 75, 84, 72, 227, 144, 198, 48, 156, 134, 137, 183, 32, 211, 132, 249, 232, 171, 190, 13, 159, 150, 63, 220, 104, 138, 255, 159, 95, 92, 160, 33, 92, 100, 33, 76, 250, 155, 16, 102, 98, 68, 238, 207, 54, 202, 168, 117, 158, 174, 239, 7, 68, 36, 233, 142, 150, 105, 218, 138, 250, 34, 216, 81, 87, 154, 26, 0, 157, 7, 21, 128, 64, 146, 115, 153, 174, 244, 136, 233, 135, 33, 90, 164, 101, 128, 108, 12, 78, 154, 208, 88, 240, 35, 110, 119, 114, 125, 190, 115, 147, 172, 134, 151, 36, 192, 63, 150, 44, 99, 31, 252, 225, 108, 25, 134, 117, 190, 47, 210, 67, 207, 145, 146, 181, 186, 226, 148, 190, 212, 36, 210, 193, 76, 30, 20, 71, 13, 123, 193, 86, 223, 15, 142, 179, 140, 211, 197, 92, 214, 191, 227, 134, 41, 250, 248, 128, 37, 228, 195, 12, 216, 65, 59, 84, 68, 247, 117, 58, 14, 97, 216, 40, 68, 4, 64, 222, 255, 241, 233, 245, 111, 132, 11, 36, 68, 36, 117, 153, 32, 211, 76, 221, 7, 132, 39, 4, 92, 47, 32, 170, 170, 9, 234, 3, 126, 8, 179, 162, 34, 80, 48, 126, 217, 211, 92, 50, 166, 152, 0, 159, 96, 131, 83, 65, 76, 5, 42, 27, 19, 24, 183, 246, 0, 100, 43, 39, 43, 251, 253, 67, 10, 243, 27, 109, 193, 132, 204, 150, 177, 2, 50, 33, 246, 85, 222, 7, 8, 244, 70, 154, 96, 145, 205, 87, 17, 21, 1, 229, 54, 47, 101, 93, 158, 197, 222, 14, 161, 78, 64, 94, 30, 154, 41, 48, 4, 92, 138, 172, 92, 52, 114, 6, 194, 11, 182, 26, 173, 70, 41, 233, 8, 10, 162, 184, 45, 215, 24, 123, 14, 226, 90, 17, 205, 38, 57, 31, 188, 68, 11, 198, 176, 34, 127, 194, 90, 188, 210, 148, 35, 82, 33, 96, 38, 150, 179, 217, 86, 228, 51, 26, 246, 226, 37, 99, 110, 102, 94, 88, 189, 6, 77, 232, 197, 199, 217, 239, 58, 222, 40, 139, 81, 152, 92, 29, 9, 132, 188, 176, 221, 136, 41, 181, 81, 100, 190, 248, 9, 111, 231, 228, 25, 25, 23, 202, 237, 16, 226, 185, 8, 144, 124, 126, 110, 29, 197, 144, 23, 157, 17, 83, 203, 220, 210, 59, 50, 153, 76, 200, 229, 51, 242, 228, 9, 41, 105, 8, 123, 89, 208, 47, 14, 232, 79, 143, 240, 63, 43, 249, 155, 53, 203, 139, 129, 88, 50, 172, 183, 94, 175, 133, 99, 120, 89, 203, 145, 215, 11, 174, 2, 26, 2, 49, 5, 91, 130, 213, 16, 67, 29, 248, 141, 159, 196, 48, 32, 143, 110, 184, 132, 124, 91, 90, 186, 96, 108, 121, 51, 173, 227, 230, 201, 240, 73, 249, 102, 87, 181, 19, 189, 22, 67, 34, 96, 115, 236, 191, 175, 234, 102, 47, 165, 24, 95, 101, 105, 241, 216, 96, 154, 134, 179, 57, 136, 2, 193, 234, 194, 170, 192, 7, 251, 101, 116, 92, 112, 91, 234, 26, 225, 184, 49, 29, 51, 178, 215, 14, 8, 91, 109, 138, 166, 52, 148, 169, 144, 82, 99, 210, 161, 240, 166, 152, 216, 69, 175, 131, 29, 114, 5, 68, 67, 138, 117, 192, 214, 247, 50, 37, 124, 57, 117, 117, 107, 15, 164, 169, 150, 213, 17, 80, 175, 14, 114, 121, 198, 30, 55, 37, 197, 142, 92, 185, 148, 201, 204, 95, 195, 252, 245, 58, 53, 239, 255, 62, 219, 72, 150, 124, 68, 76, 251, 71, 235, 12, 247, 51, 35, 162, 134, 101, 145, 47, 95, 200, 237, 157, 117, 139, 109, 137, 191, 12, 163, 131, 206, 162, 116, 38, 114, 135, 224, 240, 54, 22, 166, 182, 194, 52, 126, 77, 112, 114, 138, 197, 240, 157, 226, 64, 244, 246, 24, 83, 254, 193, 253, 96, 22, 149, 209, 150, 204, 189, 34, 57, 140, 154, 204, 214, 57, 121, 222, 158, 45, 244, 66, 208, 120, 9, 141, 140, 121, 175, 227, 66, 87, 118, 210, 152, 20, 6, 224, 95, 91, 161, 159, 92, 55, 114, 115, 44, 90, 249, 151, 48, 153, 154, 183, 165, 243, 33, 245, 160, 244, 124, 240, 181, 5, 119, 3, 178, 17, 89, 10, 35, 98, 208, 200, 157, 131, 35, 129, 140, 188, 37, 47, 109, 33, 174, 120, 216, 136, 35, 88, 214, 33, 161, 197, 198, 110, 74, 211, 6, 164, 44, 165, 191, 134, 138, 58, 188, 129, 127, 13, 75, 237, 0, 187, 55, 219, 179, 3, 47, 94, 255, 92, 251, 18, 95, 160, 223, 70, 115, 26, 114, 226, 201, 94, 193, 102, 199, 226, 203, 123, 199, 203, 161, 27, 117, 159, 146, 87, 166, 185, 78, 67, 89, 49, 12, 225, 73, 165, 58, 4, 213, 181, 69, 177, 147, 213, 135, 55, 146, 177, 196, 97, 85, 30, 155, 240, 212, 116, 182, 41, 112, 113, 12, 118, 37, 162, 29, 36, 92, 228, 163, 23, 151, 206, 253, 160, 22, 64, 77, 123, 50, 120, 245, 175, 245, 153, 101, 132, 11, 199, 160, 190, 2, 104, 76, 133, 217, 182, 89, 38, 33, 238, 59, 201, 220, 52, 222, 34, 183, 97, 181, 109, 104, 219, 1, 79, 118, 65, 101, 92, 52, 213, 248, 23, 233, 242, 41, 170, 104, 55, 137, 182, 12, 62, 242, 250, 124, 253, 14, 119, 230, 199, 100, 1, 31, 167, 15, 40, 134, 207, 26, 83, 69, 161, 185, 124, 118, 124, 104, 152, 4, 242, 208, 36, 81, 1, 146, 246, 116, 128, 208, 17, 85, 91, 67, 105, 121, 107, 227, 216, 60, 13, 49, 204, 198, 23, 163, 125, 165, 193, 29, 33, 53, 229, 89, 168, 61, 28, 251, 81, 199, 53, 222, 141, 120, 57, 70, 92, 191, 187, 1, 151, 121, 193, 39, 69, 85, 128, 45, 107, 64, 117, 193, 212, 88, 114, 86, 54, 13, 96, 44, 97, 134, 101, 117, 18, 174, 20, 124, 89, 56, 74, 190, 30, 177, 119, 2, 220, 166, 179, 126, 234, 143, 72, 85, 29, 245, 13, 181, 121, 94, 12, 58, 67, 172, 247, 17, 214, 39, 3, 100, 251, 0, 217, 201, 0, 171, 125, 128, 213, 201, 0, 193, 62, 64, 112, 50, 192, 246, 32, 143, 171, 71, 103, 161, 242, 218, 28, 68, 48, 132, 127, 182, 65, 60, 12, 14, 190, 43, 227, 147, 15, 254, 183, 38, 214, 160, 137, 125, 87, 77, 97, 212, 224, 83, 244, 93, 125, 106, 208, 196, 190, 171, 166, 184, 162, 232, 80, 83, 252, 173, 138, 238, 78, 226, 182, 103, 52, 20, 56, 33, 44, 82, 185, 2, 202, 175, 58, 228, 7, 60, 234, 74, 197, 242, 131, 142, 122, 176, 78, 67, 148, 75, 170, 134, 51, 11, 135, 245, 52, 44, 193, 173, 50, 162, 91, 82, 102, 229, 29, 87, 187, 188, 149, 43, 239, 176, 224, 23, 254, 170, 207, 140, 104, 162, 186, 203, 147, 181, 250, 66, 135, 238, 54, 250, 219, 52, 33, 234, 125, 184, 248, 222, 114, 228, 195, 197, 183, 14, 70, 99, 71, 126, 77, 185, 234, 141, 29, 245, 17, 249, 63, 15, 162, 213, 104, 75, 22, 0, 0};
+                            server.sendGzip(index, 1496);
                         });
                     }
 
                     /**
-                     * Send face recognitions
+                     * Run face detection on its own task, so MJPEG
+                     * clients never wait for inference.
+                     * Each broadcast frame waits for the results computed
+                     * on it, so the page draws them on the right picture
                      */
-                    void onEventStream() {
-                        server.onStream("/events", [this](WebServer *web, WiFiClient *client) {
+                    void annotate() {
+                        mjpeg.broadcaster.annotate([this](uint32_t frameSeq, String& annotation) {
+                            return annotations.annotationOf(frameSeq, annotation);
+                        });
+
+                        annotations.begin([](String& annotation) -> uint32_t {
                             if (!detection.run().isOk()) {
-                                delay(100);
-                                client->print("error=");
-                                client->print(detection.exception.toString());
-                                return;
+                                annotation += "error=";
+                                annotation += detection.exception.toString();
+                                return 0;
                             }
 
-                            if (detection.notFound()) 
-                                return;
-
-                            detection.forEach([client](int i, face_t face) {
-                                ESP_LOGI(
-                                    "FACE", 
-                                    "id=%d,x=%d,y=%d,w=%d,h=%d",
-                                    i, 
-                                    face.x, 
-                                    face.y, 
-                                    face.width, 
-                                    face.height
-                                );
-
-                                client->print("id=");
-                                client->print(i);
-                                client->print("&x=");
-                                client->print(face.x);
-                                client->print("&y=");
-                                client->print(face.y);
-                                client->print("&w=");
-                                client->print(face.width);
-                                client->print("&h=");
-                                client->print(face.height);
+                            if (detection.notFound())
+                                return detection.seq;
+
+                            detection.forEach([&annotation](int i, face_t face) {
+                                // track id stays the same across frames
+                                annotation += "id=";
+                                annotation += detection.isTracking() ? (int) face.id : i;
+                                annotation += "&x=";
+                                annotation += face.x;
+                                annotation += "&y=";
+                                annotation += face.y;
+                                annotation += "&w=";
+                                annotation += face.width;
+                                annotation += "&h=";
+                                annotation += face.height;
 
                                 if (face.hasKeypoints()) {
-                                    client->print("&le_x=");
-                                    client->print(face.leftEye.x);
-                                    client->print("&le_y=");
-                                    client->print(face.leftEye.y);
-                                    client->print("&re_x=");
-                                    client->print(face.rightEye.x);
-                                    client->print("&re_y=");
-                                    client->print(face.rightEye.y);
-                                    client->print("&n_x=");
-                                    client->print(face.nose.x);
-                                    client->print("&n_y=");
-                                    client->print(face.nose.y);
-                                    client->print("&lm_x=");
-                                    client->print(face.leftMouth.x);
-                                    client->print("&lm_y=");
-                                    client->print(face.leftMouth.y);
-                                    client->print("&rm_x=");
-                                    client->print(face.rightMouth.x);
-                                    client->print("&rm_y=");
-                                    client->print(face.rightMouth.y);
+                                    annotation += "&le_x=";
+                                    annotation += face.leftEye.x;
+                                    annotation += "&le_y=";
+                                    annotation += face.leftEye.y;
+                                    annotation += "&re_x=";
+                                    annotation += face.rightEye.x;
+                                    annotation += "&re_y=";
+                                    annotation += face.rightEye.y;
+                                    annotation += "&n_x=";
+                                    annotation += face.nose.x;
+                                    annotation += "&n_y=";
+                                    annotation += face.nose.y;
+                                    annotation += "&lm_x=";
+                                    annotation += face.leftMouth.x;
+                                    annotation += "&lm_y=";
+                                    annotation += face.leftMouth.y;
+                                    annotation += "&rm_x=";
+                                    annotation += face.rightMouth.x;
+                                    annotation += "&rm_y=";
+                                    annotation += face.rightMouth.y;
                                 }
 
-                                client->print("|");
+                                annotation += "|";
                             });
-                        }, 8000);
+
+                            return detection.seq;
+                        });
+                    }
+
+                    /**
+                     * Push the latest face detections as soon as
+                     * they're available, whether or not anyone is
+                     * watching the MJPEG stream
+                     * (no inference happens here)
+                     */
+                    void onEventStream() {
+                        server.onStreamOnChange("/events", [this]() {
+                            return annotations.seq();
+                        }, [this](WebServer *web, WiFiClient *client) {
+                            client->print(annotations.latest());
+                        });
                     }
             };
         }
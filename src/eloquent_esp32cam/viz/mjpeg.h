@@ -5,11 +5,13 @@
 #include "../extra/exception.h"
 #include "../extra/esp32/wifi/sta.h"
 #include "../extra/esp32/http/server.h"
+#include "./stream/broadcaster.h"
 
 using eloq::camera;
 using eloq::wifi;
 using Eloquent::Error::Exception;
 using Eloquent::Extra::Esp32::Http::HttpServer;
+using Eloquent::Esp32cam::Viz::Stream::Broadcaster;
 
 namespace Eloquent {
     namespace Esp32cam {
@@ -21,6 +23,7 @@ namespace Eloquent {
                 public:
                     Exception exception;
                     HttpServer server;
+                    Broadcaster broadcaster;
 
                     /**
                      * Constructor
@@ -29,8 +32,12 @@ namespace Eloquent {
                         exception("Mjpeg"),
                         server("Mjpeg", MJPEG_HTTP_PORT),
                         _paused(false),
-                        _stopped(false) {
-
+                        _stopped(false),
+                        _maxStaleness(1000) {
+                            _snapshot.buf = NULL;
+                            _snapshot.length = 0;
+                            _snapshot.capacity = 0;
+                            _snapshot.seq = 0;
                         }
 
                     /**
@@ -51,20 +58,29 @@ namespace Eloquent {
                         onMjpeg();
                         onHtml();
 
-                        // run in thread
-                        server.thread.withStackSize(5000);
-
                         if (!server.begin().isOk())
                             return exception.propagate(server);
 
+                        if (!broadcaster.begin().isOk())
+                            return exception.propagate(broadcaster);
+
                         return exception.clear();
                     }
 
+                    /**
+                     * Max age (in millis) of the frame served by /jpeg.
+                     * Older frames trigger a new capture
+                     */
+                    void maxStaleness(size_t ms) {
+                        _maxStaleness = ms;
+                    }
+
                     /**
                      * Pause stream
                      */
                     void pause() {
                         _paused = true;
+                        broadcaster.pause();
                     }
 
                     /**
@@ -73,6 +89,7 @@ namespace Eloquent {
                     void play() {
                         _paused = false;
                         _stopped = false;
+                        broadcaster.play();
                     }
 
                     /**
@@ -80,11 +97,19 @@ namespace Eloquent {
                      */
                     void stop() {
                         _stopped = true;
+                        broadcaster.disconnectAll();
                     }
 
                 protected:
                     bool _paused;
                     bool _stopped;
+                    size_t _maxStaleness;
+                    struct {
+                        uint8_t *buf;
+                        size_t length;
+                        size_t capacity;
+                        uint32_t seq;
+                    } _snapshot;
 
                     /**
                      * Register / endpoint to get Mjpeg stream
@@ -96,62 +121,128 @@ namespace Eloquent {
                                 return;
                             }
 
-                            WiFiClient client = web->client();
+                            // the broadcaster owns the connection from now on,
+                            // so the server is free to handle other requests
+                            if (!broadcaster.subscribe(web->client()))
+                                web->send(503, "text/plain", "Too many clients");
+                        });
+                    }
 
-                            client.println(F("HTTP/1.1 200 OK"));
-                            client.println(F("Content-Type: multipart/x-mixed-replace;boundary=frame"));
-                            client.println(F("Access-Control-Allow-Origin: *"));
-                            client.println(F("\r\n--frame"));
+                    /**
+                     * Register /jpeg endpoint to get a single Jpeg.
+                     * Serves the latest frame captured by anyone
+                     * (stream, detectors, user code) and only captures
+                     * when it is older than maxStaleness.
+                     * If the camera rate limit refuses the capture,
+                     * the latest frame is served anyway
+                     */
+                    void onJpeg() {
+                        server.collectHeader("If-None-Match");
+                        server.onGET("/jpeg", [this](WebServer *web) {
+                            if (_stopped) {
+                                web->send(500, "text/plain", "Server is stopped");
+                                return;
+                            }
 
-                            while (true) {
-                                delay(1);
-                                yield();
+                            if (!camera.hasFrame() || millis() - camera.capturedAt > _maxStaleness) {
+                                // checked before capture() touches it
+                                const bool isThrottled = !camera.rateLimit;
 
-                                if (_paused)
-                                    continue;
+                                if (!camera.capture().isOk() && !(isThrottled && hasSnapshot()))
+                                    return server.serverError(camera.exception.toString());
+                            }
 
-                                if (_stopped)
-                                    break;
+                            if (!snapshot())
+                                return server.serverError("Cannot copy frame");
 
-                                if (!client.connected())
-                                    break;
+                            char etag[24];
 
-                                if (!camera.capture().isOk())
-                                    continue;
+                            snprintf(etag, sizeof(etag), "\"%08x-%u\"", (unsigned int) bootId(), (unsigned int) _snapshot.seq);
 
-                                client.print("Content-Type: image/jpeg\r\nContent-Length: ");
-                                client.println(camera.frame->len);
-                                client.println();
-                                client.write((const char *) camera.frame->buf, camera.frame->len);
-                                client.println(F("\r\n--frame"));
-                                client.flush();
+                            if (web->header("If-None-Match") == etag) {
+                                web->sendHeader("ETag", etag);
+                                web->send(304);
+                                return;
                             }
+
+                            char header[192];
+
+                            snprintf(
+                                header,
+                                sizeof(header),
+                                "HTTP/1.1 200 OK\r\n"
+                                "Content-Type: image/jpeg\r\n"
+                                "Access-Control-Allow-Origin: *\r\n"
+                                "Cache-Control: no-cache\r\n"
+                                "ETag: %s\r\n"
+                                "Content-Length: %u\r\n\r\n",
+                                etag,
+                                (unsigned int) _snapshot.length
+                            );
+
+                            if (!eloq::http::multiplexer.send(web->client(), header, _snapshot.buf, _snapshot.length))
+                                web->send(503, "text/plain", "Too many pending responses");
                         });
                     }
 
                     /**
-                     * Register /jpeg endpoint to get a single Jpeg
+                     * Test if there is any frame to serve
                      */
-                    void onJpeg() {
-                        server.onGET("/jpeg", [this](WebServer *web) {
-                            if (_stopped) {
-                                web->send(500, "text/plain", "Server is stopped");
+                    bool hasSnapshot() {
+                        return camera.hasFrame() || _snapshot.buf != NULL;
+                    }
+
+                    /**
+                     * Copy current frame, if it changed since last request.
+                     * The copy is only accessed from the server task,
+                     * so slow clients never hold the camera.
+                     * While a response still references it, it's reused.
+                     * Without a current frame, the last copy is kept
+                     */
+                    bool snapshot() {
+                        bool isOk = false;
+
+                        camera.mutex.threadsafe([this, &isOk]() {
+                            if (!camera.hasFrame()) {
+                                isOk = _snapshot.buf != NULL;
+                                return;
+                            }
+
+                            // a pending response still sends the current copy:
+                            // serve it as is
+                            if ((_snapshot.seq == camera.seq || eloq::http::multiplexer.isSending(_snapshot.buf)) && _snapshot.buf != NULL) {
+                                isOk = true;
                                 return;
                             }
 
-                            if (!camera.capture().isOk())
-                                return server.serverError(camera.exception.toString());
+                            if (camera.frame->len > _snapshot.capacity) {
+                                ::free(_snapshot.buf);
+                                _snapshot.capacity = camera.frame->len * 5 / 4;
+                                _snapshot.buf = (uint8_t*) (psramFound() ? ps_malloc(_snapshot.capacity) : malloc(_snapshot.capacity));
+                            }
+
+                            if (_snapshot.buf == NULL) {
+                                _snapshot.capacity = 0;
+                                return;
+                            }
 
-                            WiFiClient client = web->client();
+                            memcpy(_snapshot.buf, camera.frame->buf, camera.frame->len);
+                            _snapshot.length = camera.frame->len;
+                            _snapshot.seq = camera.seq;
+                            isOk = true;
+                        }, 1000);
 
-                            client.println(F("HTTP/1.1 200 OK"));
-                            client.println(F("Content-Type: image/jpeg"));
-                            client.println(F("Access-Control-Allow-Origin: *"));
-                            client.print(F("Content-Length: "));
-                            client.println((unsigned int) camera.frame->len);
-                            client.println();
-                            client.write((const char *) camera.frame->buf, camera.frame->len);
-                        });
+                        return isOk;
+                    }
+
+                    /**
+                     * Random id that makes ETags unique across reboots
+                     * (frame seq restarts from 0)
+                     */
+                    static uint32_t bootId() {
+                        static const uint32_t id = esp_random();
+
+                        return id;
                     }
 
                     /**
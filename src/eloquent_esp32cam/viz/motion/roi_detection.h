@@ -68,8 +68,7 @@ namespace Eloquent {
                             onIndex();
                             onRoIs();
 
-                            // run in thread
-                            server.thread.withStackSize(7000);
+                            server.reserveStack(7000);
 
                             if (!server.begin().isOk())
                                 return exception.propagate(server);
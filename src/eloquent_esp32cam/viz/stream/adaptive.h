@@ -0,0 +1,418 @@
+#ifndef ELOQUENT_ESP32CAM_VIZ_STREAM_ADAPTIVE_H
+#define ELOQUENT_ESP32CAM_VIZ_STREAM_ADAPTIVE_H
+
+#include "../../camera/camera.h"
+#include "../../extra/exception.h"
+#include "../../extra/serialize/writer.h"
+#include "../../extra/esp32/multiprocessing/mutex.h"
+
+#ifndef ADAPTIVE_MAX_CLIENTS
+#define ADAPTIVE_MAX_CLIENTS 8
+#endif
+
+#define ADAPTIVE_FRAMESIZES 8
+
+using eloq::camera;
+using Eloquent::Error::Exception;
+using Eloquent::Extra::Serialize::Writer;
+using Eloquent::Extra::Esp32::Multiprocessing::Mutex;
+
+
+namespace Eloquent {
+    namespace Esp32cam {
+        namespace Viz {
+            namespace Stream {
+                /**
+                 * Adapt stream resolution and JPEG quality to the network.
+                 * Streams report, for each client, every delivered frame
+                 * (size and send latency) and every skipped frame.
+                 * Once per window the slowest client is evaluated:
+                 *  - saturated (many drops or slow sends) for a few
+                 *    windows in a row: step down
+                 *  - healthy (almost no drops, fast sends) for longer:
+                 *    step up
+                 * Each framesize has two levels, high and low quality,
+                 * so quality changes before the sensor is reconfigured.
+                 * No step happens before dwell() millis passed since
+                 * the last one.
+                 * esp32-camera sizes its frame buffers at init, so by
+                 * default the controller never goes above the framesize
+                 * the camera was initialized with; use range() to allow
+                 * larger ones (only if the buffers fit them)
+                 */
+                class Adaptive {
+                    public:
+                        Exception exception;
+                        struct {
+                            uint32_t stepsUp;
+                            uint32_t stepsDown;
+                            float throughput;
+                            float latency;
+                            float dropRatio;
+                        } stats;
+
+                        /**
+                         * Constructor
+                         */
+                        Adaptive() :
+                            exception("Adaptive"),
+                            _mutex("Adaptive"),
+                            _isEnabled(false),
+                            _level(0),
+                            _minLevel(0),
+                            _maxLevel(2 * ADAPTIVE_FRAMESIZES - 1),
+                            _highQuality(12),
+                            _lowQuality(25),
+                            _window(1000),
+                            _dwell(5000),
+                            _maxLatency(300),
+                            _windowStartedAt(0),
+                            _changedAt(0),
+                            _badWindows(0),
+                            _goodWindows(0),
+                            _slots(0),
+                            _isRangeSet(false) {
+                                memset(&stats, 0, sizeof(stats));
+                                memset(_clients, 0, sizeof(_clients));
+                            }
+
+                        /**
+                         * Limit framesizes to the given range.
+                         * Max can exceed the init framesize only if the
+                         * camera frame buffers are large enough for it
+                         */
+                        void range(framesize_t min, framesize_t max) {
+                            _minLevel = 2 * indexOf(min);
+                            _maxLevel = 2 * indexOf(max) + 1;
+                            _isRangeSet = true;
+                        }
+
+                        /**
+                         * JPEG quality of high and low levels
+                         * (lower is better)
+                         */
+                        void quality(uint8_t high, uint8_t low) {
+                            _highQuality = constrain(high, 10, 63);
+                            _lowQuality = constrain(low, _highQuality, 63);
+                        }
+
+                        /**
+                         * Min time between two changes
+                         */
+                        void dwell(size_t ms) {
+                            _dwell = ms;
+                        }
+
+                        /**
+                         * Send latency above which a client is saturated
+                         */
+                        void maxLatency(size_t ms) {
+                            _maxLatency = ms;
+                        }
+
+                        /**
+                         * Start adapting from the current camera config
+                         */
+                        Exception& begin() {
+                            // larger framesizes overflow the frame buffers
+                            if (!_isRangeSet)
+                                _maxLevel = max<uint8_t>(_minLevel, 2 * indexOf(camera.resolution.framesize) + 1);
+
+                            _level = constrain(2 * indexOf(camera.resolution.framesize) + (camera.quality.quality <= _highQuality ? 1 : 0), _minLevel, _maxLevel);
+                            _isEnabled = true;
+                            _windowStartedAt = millis();
+                            _changedAt = millis();
+                            apply();
+
+                            return exception.clear();
+                        }
+
+                        /**
+                         * Stop adapting (config is left as is)
+                         */
+                        void end() {
+                            _isEnabled = false;
+                        }
+
+                        /**
+                         * Test if controller is running
+                         */
+                        bool isEnabled() const {
+                            return _isEnabled;
+                        }
+
+                        /**
+                         * Reserve client slots for a stream.
+                         * Returns the id of the first one: the stream
+                         * reports its client #i as (first + i)
+                         */
+                        uint8_t attach(uint8_t clients) {
+                            const uint8_t first = _slots;
+
+                            _slots += clients;
+
+                            if (_slots > ADAPTIVE_MAX_CLIENTS)
+                                ESP_LOGW("Adaptive", "More clients than ADAPTIVE_MAX_CLIENTS (%d), some will share stats", ADAPTIVE_MAX_CLIENTS);
+
+                            return first;
+                        }
+
+                        /**
+                         * Report a frame delivered to client
+                         */
+                        void sent(uint8_t client, size_t bytes, size_t latency) {
+                            if (!_isEnabled)
+                                return;
+
+                            _mutex.threadsafe([this, client, bytes, latency]() {
+                                client_t &c = _clients[client % ADAPTIVE_MAX_CLIENTS];
+
+                                c.frames += 1;
+                                c.bytes += bytes;
+                                c.latency += latency;
+                            }, 100);
+                        }
+
+                        /**
+                         * Report frames the client could not absorb
+                         */
+                        void dropped(uint8_t client, uint32_t count = 1) {
+                            if (!_isEnabled || count == 0)
+                                return;
+
+                            _mutex.threadsafe([this, client, count]() {
+                                _clients[client % ADAPTIVE_MAX_CLIENTS].dropped += count;
+                            }, 100);
+                        }
+
+                        /**
+                         * Evaluate window, if elapsed.
+                         * Streams call this from their own task
+                         */
+                        void update() {
+                            if (!_isEnabled || millis() - _windowStartedAt < _window)
+                                return;
+
+                            bool isChanged = false;
+
+                            // several streams may call this concurrently
+                            _mutex.threadsafe([this, &isChanged]() {
+                                // someone else just evaluated this window
+                                if (millis() - _windowStartedAt < _window)
+                                    return;
+
+                                const int8_t step = evaluate();
+
+                                if (step == 0 || millis() - _changedAt < _dwell)
+                                    return;
+
+                                const uint8_t level = constrain(_level + step, _minLevel, _maxLevel);
+
+                                _badWindows = 0;
+                                _goodWindows = 0;
+
+                                if (level == _level)
+                                    return;
+
+                                if (level < _level)
+                                    stats.stepsDown += 1;
+                                else
+                                    stats.stepsUp += 1;
+
+                                _level = level;
+                                _changedAt = millis();
+                                isChanged = true;
+                            }, 100);
+
+                            if (isChanged)
+                                apply();
+                        }
+
+                        /**
+                         * Current framesize
+                         */
+                        framesize_t framesize() const {
+                            return framesizeAt(_level / 2);
+                        }
+
+                        /**
+                         * Nearest framesize the controller may use
+                         */
+                        framesize_t constrainFramesize(framesize_t size) const {
+                            return framesizeAt(constrain(2 * indexOf(size), _minLevel, _maxLevel) / 2);
+                        }
+
+                        /**
+                         * Nearest JPEG quality the controller may use
+                         */
+                        uint8_t constrainQuality(int quality) const {
+                            return constrain(quality, _highQuality, _lowQuality);
+                        }
+
+                        /**
+                         * Serialize state
+                         */
+                        void serializeTo(Writer& writer) {
+                            writer.beginObject(7);
+                            writer.kv("framesize", (int) framesize());
+                            writer.kv("quality", (_level % 2) ? _highQuality : _lowQuality);
+                            writer.kv("steps_up", stats.stepsUp);
+                            writer.kv("steps_down", stats.stepsDown);
+                            writer.kv("throughput", stats.throughput);
+                            writer.kv("latency_ms", stats.latency);
+                            writer.kv("drop_ratio", stats.dropRatio);
+                            writer.endObject();
+                        }
+
+                    protected:
+                        struct client_t {
+                            uint32_t frames;
+                            uint32_t dropped;
+                            uint32_t bytes;
+                            uint32_t latency;
+                        };
+
+                        Mutex _mutex;
+                        bool _isEnabled;
+                        uint8_t _level;
+                        uint8_t _minLevel;
+                        uint8_t _maxLevel;
+                        uint8_t _highQuality;
+                        uint8_t _lowQuality;
+                        size_t _window;
+                        size_t _dwell;
+                        size_t _maxLatency;
+                        size_t _windowStartedAt;
+                        size_t _changedAt;
+                        uint8_t _badWindows;
+                        uint8_t _goodWindows;
+                        uint8_t _slots;
+                        bool _isRangeSet;
+                        client_t _clients[ADAPTIVE_MAX_CLIENTS];
+
+                        /**
+                         * Rate the slowest client in the window.
+                         * Returns the step to take (-1, 0, +1).
+                         * Good/bad thresholds are far apart (hysteresis)
+                         */
+                        int8_t evaluate() {
+                            const float elapsed = millis() - _windowStartedAt;
+                            float worstDrops = 0;
+                            float worstLatency = 0;
+                            float worstThroughput = -1;
+                            bool isActive = false;
+
+                            for (uint8_t i = 0; i < ADAPTIVE_MAX_CLIENTS; i++) {
+                                client_t &c = _clients[i];
+
+                                if (c.frames + c.dropped == 0)
+                                    continue;
+
+                                const float drops = ((float) c.dropped) / (c.frames + c.dropped);
+                                const float latency = c.frames > 0 ? ((float) c.latency) / c.frames : _maxLatency;
+                                const float throughput = c.bytes * 1000.0f / elapsed;
+
+                                isActive = true;
+                                worstDrops = max(worstDrops, drops);
+                                worstLatency = max(worstLatency, latency);
+
+                                if (worstThroughput < 0 || throughput < worstThroughput)
+                                    worstThroughput = throughput;
+                            }
+
+                            memset(_clients, 0, sizeof(_clients));
+                            _windowStartedAt = millis();
+
+                            // no one is watching: keep current config
+                            if (!isActive)
+                                return 0;
+
+                            stats.dropRatio = worstDrops;
+                            stats.latency = worstLatency;
+                            stats.throughput = worstThroughput;
+
+                            if (worstDrops > 0.25f || worstLatency > _maxLatency) {
+                                _goodWindows = 0;
+                                _badWindows += 1;
+
+                                return _badWindows >= 2 ? -1 : 0;
+                            }
+
+                            if (worstDrops < 0.05f && worstLatency < _maxLatency / 3) {
+                                _badWindows = 0;
+                                _goodWindows += 1;
+
+                                return _goodWindows >= 5 ? 1 : 0;
+                            }
+
+                            // in between: stay
+                            _badWindows = 0;
+                            _goodWindows = 0;
+
+                            return 0;
+                        }
+
+                        /**
+                         * Configure camera for current level
+                         */
+                        void apply() {
+                            const framesize_t size = framesize();
+                            const uint8_t quality = (_level % 2) ? _highQuality : _lowQuality;
+
+                            ESP_LOGI("Adaptive", "Switching to framesize %d, quality %d", (int) size, (int) quality);
+
+                            camera.mutex.threadsafe([this, size, quality]() {
+                                camera.quality.set(quality);
+                                camera.sensor.configure([quality](sensor_t *sensor) {
+                                    sensor->set_quality(sensor, quality);
+                                });
+
+                                // sensor reconfiguration is slow: skip if not needed
+                                if (camera.resolution.framesize != size)
+                                    camera.resolution.set(size);
+                            }, 1000);
+                        }
+
+                        /**
+                         * Framesizes the controller moves across
+                         */
+                        static framesize_t framesizeAt(uint8_t i) {
+                            static const framesize_t framesizes[ADAPTIVE_FRAMESIZES] = {
+                                FRAMESIZE_QQVGA,
+                                FRAMESIZE_QVGA,
+                                FRAMESIZE_CIF,
+                                FRAMESIZE_HVGA,
+                                FRAMESIZE_VGA,
+                                FRAMESIZE_SVGA,
+                                FRAMESIZE_XGA,
+                                FRAMESIZE_HD
+                            };
+
+                            return framesizes[min<uint8_t>(i, ADAPTIVE_FRAMESIZES - 1)];
+                        }
+
+                        /**
+                         * Nearest supported framesize not larger than the given one
+                         */
+                        static uint8_t indexOf(framesize_t framesize) {
+                            uint8_t index = 0;
+
+                            for (uint8_t i = 0; i < ADAPTIVE_FRAMESIZES; i++)
+                                if (framesizeAt(i) <= framesize)
+                                    index = i;
+
+                            return index;
+                        }
+                };
+            }
+        }
+    }
+}
+
+namespace eloq {
+    namespace viz {
+        static Eloquent::Esp32cam::Viz::Stream::Adaptive adaptive;
+    }
+}
+
+#endif
@@ -0,0 +1,190 @@
+#ifndef ELOQUENT_ESP32CAM_VIZ_STREAM_ANNOTATION_DAEMON_H
+#define ELOQUENT_ESP32CAM_VIZ_STREAM_ANNOTATION_DAEMON_H
+
+#include <functional>
+#include "../../camera/camera.h"
+#include "../../extra/exception.h"
+#include "../../extra/esp32/multiprocessing/thread.h"
+#include "../../extra/esp32/multiprocessing/mutex.h"
+
+#ifndef ANNOTATION_DAEMON_IDLE_CAPTURE
+#define ANNOTATION_DAEMON_IDLE_CAPTURE 200
+#endif
+
+using eloq::camera;
+using Eloquent::Error::Exception;
+using Eloquent::Extra::Esp32::Multiprocessing::Thread;
+using Eloquent::Extra::Esp32::Multiprocessing::Mutex;
+
+
+namespace Eloquent {
+    namespace Esp32cam {
+        namespace Viz {
+            namespace Stream {
+                /**
+                 * Run a detector on its own task and keep a compact,
+                 * single line description of its latest results,
+                 * tagged with the seq of the frame they refer to.
+                 * Streams read it without waiting for inference.
+                 * The detector runs on the newest camera frame: frames
+                 * captured by someone else (e.g. the MJPEG broadcaster)
+                 * are reused; if none arrives within
+                 * ANNOTATION_DAEMON_IDLE_CAPTURE millis, it captures
+                 * by itself, so results keep flowing with no viewer
+                 */
+                class AnnotationDaemon {
+                    public:
+                        /**
+                         * Run detection on the current camera frame and
+                         * append its description to the string.
+                         * Returns the seq of the frame the results
+                         * refer to (0 on failure)
+                         */
+                        using Describe = std::function<uint32_t(String&)>;
+
+                        Exception exception;
+                        Thread thread;
+
+                        /**
+                         * Constructor
+                         */
+                        AnnotationDaemon(const char *name) :
+                            exception("AnnotationDaemon"),
+                            thread(name),
+                            _mutex("AnnotationDaemon"),
+                            _isRunning(false),
+                            _seq(0) {
+
+                            }
+
+                        /**
+                         * Start detection task (once)
+                         */
+                        Exception& begin(Describe describe, uint16_t stackSize = 8000) {
+                            if (_isRunning)
+                                return exception.clear();
+
+                            _describe = describe;
+                            _isRunning = true;
+
+                            thread
+                                .withArgs((void*) this)
+                                .withStackSize(stackSize)
+                                .withPriority(1)
+                                .run([](void *args) {
+                                    AnnotationDaemon *self = (AnnotationDaemon*) args;
+                                    uint32_t lastSeq = 0;
+                                    size_t waitingSince = millis();
+
+                                    while (true) {
+                                        yield();
+                                        delay(1);
+
+                                        // wait for someone else's frame, for a while
+                                        if (camera.seq == lastSeq) {
+                                            if (millis() - waitingSince < ANNOTATION_DAEMON_IDLE_CAPTURE)
+                                                continue;
+
+                                            if (!camera.capture().isOk())
+                                                continue;
+                                        }
+
+                                        lastSeq = camera.seq;
+                                        waitingSince = millis();
+                                        self->update(lastSeq);
+                                    }
+                                });
+
+                            return exception.clear();
+                        }
+
+                        /**
+                         * Seq of the frame the latest results refer to
+                         * (0 if none yet)
+                         */
+                        uint32_t seq() {
+                            uint32_t seq = 0;
+
+                            _mutex.threadsafe([this, &seq]() {
+                                seq = _seq;
+                            }, 1000);
+
+                            return seq;
+                        }
+
+                        /**
+                         * Append latest description to the string.
+                         * Returns the seq of the frame it refers to
+                         */
+                        uint32_t latest(String& annotation) {
+                            uint32_t seq = 0;
+
+                            _mutex.threadsafe([this, &annotation, &seq]() {
+                                annotation += _annotation;
+                                seq = _seq;
+                            }, 1000);
+
+                            return seq;
+                        }
+
+                        /**
+                         * Append the description of the given frame,
+                         * if it is the one the latest results refer to.
+                         * Returns the seq of the latest results
+                         */
+                        uint32_t annotationOf(uint32_t frameSeq, String& annotation) {
+                            uint32_t seq = 0;
+
+                            _mutex.threadsafe([this, frameSeq, &annotation, &seq]() {
+                                if (_seq == frameSeq)
+                                    annotation += _annotation;
+
+                                seq = _seq;
+                            }, 1000);
+
+                            return seq;
+                        }
+
+                        /**
+                         * Get latest description
+                         */
+                        String latest() {
+                            String annotation;
+
+                            latest(annotation);
+
+                            return annotation;
+                        }
+
+                    protected:
+                        Mutex _mutex;
+                        bool _isRunning;
+                        Describe _describe;
+                        uint32_t _seq;
+                        String _annotation;
+
+                        /**
+                         * Run detector and publish its description.
+                         * Failures are tagged with the frame they happened on
+                         * (runs in detection task)
+                         */
+                        void update(uint32_t frameSeq) {
+                            String annotation;
+                            const uint32_t seq = _describe(annotation);
+
+                            // must fit in a single header line
+                            annotation.replace("\r", "");
+                            annotation.replace("\n", " ");
+
+                            _mutex.threadsafe([this, &annotation, seq]() {
+                                _annotation = annotation;
+                                _seq = seq > 0 ? seq : frameSeq;
+                            }, 1000);
+                        }
+                };
+            }
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,657 @@
+#ifndef ELOQUENT_ESP32CAM_VIZ_STREAM_BROADCASTER_H
+#define ELOQUENT_ESP32CAM_VIZ_STREAM_BROADCASTER_H
+
+#include <functional>
+#include <WiFi.h>
+#include <lwip/sockets.h>
+#include "../../camera/camera.h"
+#include "../../extra/exception.h"
+#include "../../extra/time/rate_limit.h"
+#include "../../extra/serialize/writer.h"
+#include "../../extra/esp32/multiprocessing/thread.h"
+#include "../../extra/esp32/multiprocessing/mutex.h"
+#include "../../extra/esp32/http/gather.h"
+#include "./adaptive.h"
+
+#ifndef MJPEG_MAX_CLIENTS
+#define MJPEG_MAX_CLIENTS 4
+#endif
+
+#ifndef MJPEG_FRAME_POOL
+#define MJPEG_FRAME_POOL (MJPEG_MAX_CLIENTS + 1)
+#endif
+
+// part headers, including detections
+#ifndef MJPEG_PART_HEADER_SIZE
+#define MJPEG_PART_HEADER_SIZE 1024
+#endif
+
+// max wait for the detections of a frame
+#ifndef MJPEG_ANNOTATION_TIMEOUT
+#define MJPEG_ANNOTATION_TIMEOUT 2000
+#endif
+
+#define MJPEG_PREAMBLE "HTTP/1.1 200 OK\r\nContent-Type: multipart/x-mixed-replace;boundary=frame\r\nAccess-Control-Allow-Origin: *\r\n\r\n\r\n--frame\r\n"
+
+using eloq::camera;
+using Eloquent::Error::Exception;
+using Eloquent::Extra::Time::RateLimit;
+using Eloquent::Extra::Serialize::Writer;
+using Eloquent::Extra::Esp32::Multiprocessing::Thread;
+using Eloquent::Extra::Esp32::Multiprocessing::Mutex;
+using Eloquent::Extra::Esp32::Http::Gather;
+using Eloquent::Esp32cam::Viz::Stream::Adaptive;
+
+
+namespace Eloquent {
+    namespace Esp32cam {
+        namespace Viz {
+            namespace Stream {
+                /**
+                 * Capture once per frame interval and
+                 * send the same JPEG to every subscribed client.
+                 * Each client has its own non-blocking send state:
+                 * a slow client finishes the frame it's on, then jumps
+                 * to the newest one, skipping what it couldn't absorb.
+                 * Frames live in a small pool so slow sockets never hold
+                 * the camera nor the fast clients.
+                 * With an annotator, each captured frame is held until the
+                 * detections computed on it are available, then broadcast
+                 * together with them in the part headers (X-Frame-Seq,
+                 * X-Detections, X-Detections-Seq), so overlays always
+                 * match the picture. Frames the detector skipped are
+                 * dropped; frames whose detections don't come within
+                 * MJPEG_ANNOTATION_TIMEOUT millis are sent without.
+                 * The annotator must be cheap (e.g. copy the results of
+                 * a detector running on its own task): it runs on the
+                 * broadcasting task, so it delays every client
+                 */
+                class Broadcaster {
+                    public:
+                        using Annotator = std::function<uint32_t(uint32_t, String&)>;
+
+                        struct client_stats_t {
+                            uint32_t frames;
+                            uint32_t dropped;
+                            uint32_t bytes;
+                            float fps;
+                        };
+
+                        Exception exception;
+                        Thread thread;
+                        RateLimit rate;
+                        struct {
+                            uint32_t frames;
+                            uint32_t disconnects;
+                        } stats;
+
+                        /**
+                         * Constructor
+                         */
+                        Broadcaster() :
+                            exception("Broadcaster"),
+                            thread("MJPEG broadcaster"),
+                            _mutex("Broadcaster"),
+                            _isRunning(false),
+                            _paused(false),
+                            _stackSize(5000),
+                            _seq(0),
+                            _latest(NULL),
+                            _held(NULL),
+                            _heldAt(0),
+                            _adaptive(NULL),
+                            _adaptiveId(0) {
+                                stats.frames = 0;
+                                stats.disconnects = 0;
+
+                                for (uint8_t i = 0; i < MJPEG_FRAME_POOL; i++) {
+                                    _pool[i].buf = NULL;
+                                    _pool[i].length = 0;
+                                    _pool[i].capacity = 0;
+                                    _pool[i].readers = 0;
+                                    _pool[i].frameSeq = 0;
+                                }
+
+                                for (uint8_t i = 0; i < MJPEG_MAX_CLIENTS; i++)
+                                    _clients[i].active = false;
+                            }
+
+                        /**
+                         * Start broadcasting task (once)
+                         */
+                        Exception& begin() {
+                            if (_isRunning)
+                                return exception.clear();
+
+                            _isRunning = true;
+
+                            thread
+                                .withArgs((void*) this)
+                                .withStackSize(_stackSize)
+                                .withPriority(1)
+                                .run([](void *args) {
+                                    Broadcaster *self = (Broadcaster*) args;
+
+                                    while (true) {
+                                        self->tick();
+                                        yield();
+                                    }
+                                });
+
+                            return exception.clear();
+                        }
+
+                        /**
+                         * Make sure broadcasting task has at least this stack.
+                         * Only effective before begin()
+                         */
+                        void reserveStack(uint16_t stackSize) {
+                            _stackSize = max(_stackSize, stackSize);
+                        }
+
+                        /**
+                         * Run function on each held frame, with its camera seq.
+                         * If detections for that frame are available, it must
+                         * append a compact, single line description of them
+                         * to the given string (sent as X-Detections).
+                         * It always returns the seq of the frame the latest
+                         * detections refer to (0 if none yet).
+                         * Don't run inference in here
+                         */
+                        void annotate(Annotator annotator) {
+                            _annotator = annotator;
+                        }
+
+                        /**
+                         * Report clients' throughput to the given
+                         * controller, that adapts resolution and quality
+                         */
+                        void adapt(Adaptive& adaptive) {
+                            _adaptive = &adaptive;
+                            _adaptiveId = adaptive.attach(MJPEG_MAX_CLIENTS);
+                        }
+
+                        /**
+                         * Camera seq of the latest broadcast frame (0 if none)
+                         */
+                        uint32_t latestSeq() {
+                            uint32_t seq = 0;
+
+                            _mutex.threadsafe([this, &seq]() {
+                                if (_latest != NULL)
+                                    seq = _latest->frameSeq;
+                            }, 1000);
+
+                            return seq;
+                        }
+
+                        /**
+                         * Annotation of the latest broadcast frame
+                         */
+                        String latestAnnotation() {
+                            String annotation;
+
+                            _mutex.threadsafe([this, &annotation]() {
+                                if (_latest != NULL)
+                                    annotation = _latest->annotation;
+                            }, 1000);
+
+                            return annotation;
+                        }
+
+                        /**
+                         * Add client to the broadcast.
+                         * The multipart header leaves with the first frame,
+                         * without blocking; the connection is kept open
+                         * by the stored WiFiClient copy
+                         */
+                        bool subscribe(WiFiClient client) {
+                            bool isSubscribed = false;
+
+                            _mutex.threadsafe([this, &client, &isSubscribed]() {
+                                for (uint8_t i = 0; i < MJPEG_MAX_CLIENTS; i++) {
+                                    client_t &c = _clients[i];
+
+                                    if (c.active)
+                                        continue;
+
+                                    client.setNoDelay(true);
+
+                                    c.socket = client;
+                                    c.active = true;
+                                    c.isStarted = false;
+                                    c.frame = NULL;
+                                    c.lastSeq = 0;
+                                    c.lastFrameAt = 0;
+                                    memset(&c.stats, 0, sizeof(c.stats));
+                                    isSubscribed = true;
+                                    ESP_LOGI("Broadcaster", "Client #%d subscribed", i);
+                                    break;
+                                }
+                            }, 1000);
+
+                            if (!isSubscribed)
+                                ESP_LOGW("Broadcaster", "Max number of clients reached (%d)", MJPEG_MAX_CLIENTS);
+
+                            return isSubscribed;
+                        }
+
+                        /**
+                         * Count connected clients
+                         */
+                        uint8_t count() {
+                            uint8_t count = 0;
+
+                            for (uint8_t i = 0; i < MJPEG_MAX_CLIENTS; i++)
+                                if (_clients[i].active)
+                                    count++;
+
+                            return count;
+                        }
+
+                        /**
+                         * Run function on each connected client's stats
+                         */
+                        template<typename Callback>
+                        void forEach(Callback callback) {
+                            _mutex.threadsafe([this, &callback]() {
+                                for (uint8_t i = 0; i < MJPEG_MAX_CLIENTS; i++)
+                                    if (_clients[i].active)
+                                        callback(i, (const client_stats_t&) _clients[i].stats);
+                            }, 1000);
+                        }
+
+                        /**
+                         * Serialize per-client stats
+                         */
+                        void serializeTo(Writer& writer) {
+                            writer.beginArray(count());
+
+                            forEach([&writer](uint8_t i, const client_stats_t& stats) {
+                                writer.beginObject(5);
+                                writer.kv("client", i);
+                                writer.kv("frames", stats.frames);
+                                writer.kv("dropped", stats.dropped);
+                                writer.kv("bytes", stats.bytes);
+                                writer.kv("fps", stats.fps);
+                                writer.endObject();
+                            });
+
+                            writer.endArray();
+                        }
+
+                        /**
+                         * Pause stream (clients stay connected)
+                         */
+                        void pause() {
+                            _paused = true;
+                        }
+
+                        /**
+                         * Resume stream
+                         */
+                        void play() {
+                            _paused = false;
+                        }
+
+                        /**
+                         * Disconnect all clients
+                         */
+                        void disconnectAll() {
+                            _mutex.threadsafe([this]() {
+                                for (uint8_t i = 0; i < MJPEG_MAX_CLIENTS; i++)
+                                    if (_clients[i].active)
+                                        drop(_clients[i]);
+                            }, 1000);
+                        }
+
+                    protected:
+                        struct frame_t {
+                            uint8_t *buf;
+                            size_t length;
+                            size_t capacity;
+                            uint32_t seq;
+                            uint32_t frameSeq;
+                            uint8_t readers;
+                            String annotation;
+                            char header[MJPEG_PART_HEADER_SIZE];
+                        };
+
+                        struct client_t {
+                            WiFiClient socket;
+                            bool active;
+                            bool isStarted;
+                            frame_t *frame;
+                            size_t offset;
+                            uint32_t lastSeq;
+                            size_t lastFrameAt;
+                            size_t startedAt;
+                            client_stats_t stats;
+                        };
+
+                        Mutex _mutex;
+                        bool _isRunning;
+                        bool _paused;
+                        uint16_t _stackSize;
+                        uint32_t _seq;
+                        Annotator _annotator;
+                        Adaptive *_adaptive;
+                        uint8_t _adaptiveId;
+                        frame_t *_latest;
+                        frame_t *_held;
+                        size_t _heldAt;
+                        frame_t _pool[MJPEG_FRAME_POOL];
+                        client_t _clients[MJPEG_MAX_CLIENTS];
+
+                        /**
+                         * Capture a new frame when due, then
+                         * push as many bytes as sockets accept
+                         */
+                        void tick() {
+                            if (_paused || count() == 0) {
+                                delay(20);
+                                return;
+                            }
+
+                            if (_held != NULL)
+                                release();
+                            else if (rate && grab())
+                                rate.touch();
+
+                            bool isProgress = false;
+
+                            _mutex.threadsafe([this, &isProgress]() {
+                                for (uint8_t i = 0; i < MJPEG_MAX_CLIENTS; i++)
+                                    if (_clients[i].active)
+                                        isProgress |= service(_clients[i]);
+                            }, 1000);
+
+                            if (_adaptive != NULL)
+                                _adaptive->update();
+
+                            // every socket is full (or idle), don't spin
+                            if (!isProgress)
+                                delay(1);
+                        }
+
+                        /**
+                         * Capture new frame and copy it to a free pool slot.
+                         * With an annotator, the frame is held until
+                         * its detections are available
+                         */
+                        bool grab() {
+                            frame_t *frame = reserve();
+
+                            // every slot is being read
+                            if (frame == NULL)
+                                return false;
+
+                            if (!camera.capture().isOk())
+                                return false;
+
+                            bool isOk = false;
+
+                            camera.mutex.threadsafe([this, frame, &isOk]() {
+                                if (!camera.hasFrame())
+                                    return;
+
+                                if (camera.frame->len > frame->capacity) {
+                                    ::free(frame->buf);
+                                    frame->capacity = camera.frame->len * 5 / 4;
+                                    frame->buf = (uint8_t*) (psramFound() ? ps_malloc(frame->capacity) : malloc(frame->capacity));
+                                }
+
+                                if (frame->buf == NULL) {
+                                    frame->capacity = 0;
+                                    return;
+                                }
+
+                                memcpy(frame->buf, camera.frame->buf, camera.frame->len);
+                                frame->length = camera.frame->len;
+                                frame->frameSeq = camera.seq;
+                                isOk = true;
+                            }, 1000);
+
+                            if (!isOk)
+                                return false;
+
+                            frame->annotation = "";
+
+                            if (_annotator) {
+                                _held = frame;
+                                _heldAt = millis();
+                                release();
+
+                                return true;
+                            }
+
+                            publish(frame, 0);
+
+                            return true;
+                        }
+
+                        /**
+                         * Broadcast held frame once its detections are available
+                         */
+                        void release() {
+                            frame_t *frame = _held;
+
+                            frame->annotation = "";
+
+                            const uint32_t annotationSeq = _annotator(frame->frameSeq, frame->annotation);
+
+                            if (annotationSeq == frame->frameSeq) {
+                                publish(frame, annotationSeq);
+                                return;
+                            }
+
+                            // the detector moved on to a newer frame:
+                            // this one will never be annotated
+                            if (annotationSeq > frame->frameSeq) {
+                                ESP_LOGD("Broadcaster", "Frame %u was not annotated, dropping", (unsigned int) frame->frameSeq);
+                                _held = NULL;
+                                return;
+                            }
+
+                            if (millis() - _heldAt > MJPEG_ANNOTATION_TIMEOUT) {
+                                ESP_LOGW("Broadcaster", "No detections for frame %u within %d ms", (unsigned int) frame->frameSeq, MJPEG_ANNOTATION_TIMEOUT);
+                                frame->annotation = "";
+                                publish(frame, 0);
+                            }
+                        }
+
+                        /**
+                         * Make frame the newest one
+                         */
+                        void publish(frame_t *frame, uint32_t annotationSeq) {
+                            // must fit in a single header line
+                            frame->annotation.replace("\r", "");
+                            frame->annotation.replace("\n", " ");
+                            header(frame, annotationSeq);
+
+                            _mutex.threadsafe([this, frame]() {
+                                frame->seq = ++_seq;
+                                _latest = frame;
+                            }, 1000);
+
+                            _held = NULL;
+                            stats.frames += 1;
+                        }
+
+                        /**
+                         * Write part headers of frame
+                         */
+                        void header(frame_t *frame, uint32_t annotationSeq) {
+                            const size_t size = sizeof(frame->header) - 2;
+                            int length = snprintf(
+                                frame->header,
+                                size,
+                                "Content-Type: image/jpeg\r\n"
+                                "Content-Length: %u\r\n"
+                                "X-Frame-Seq: %u\r\n",
+                                (unsigned int) frame->length,
+                                (unsigned int) frame->frameSeq
+                            );
+
+                            if (frame->annotation.length() > 0) {
+                                const int extra = snprintf(
+                                    frame->header + length,
+                                    size - length,
+                                    "X-Detections: %s\r\n"
+                                    "X-Detections-Seq: %u\r\n",
+                                    frame->annotation.c_str(),
+                                    (unsigned int) annotationSeq
+                                );
+
+                                // a truncated line would corrupt the stream: leave it out
+                                if (extra > 0 && (size_t) (length + extra) < size)
+                                    length += extra;
+                                else
+                                    ESP_LOGW("Broadcaster", "Detections don't fit MJPEG_PART_HEADER_SIZE, skipping");
+                            }
+
+                            frame->header[length++] = '\r';
+                            frame->header[length++] = '\n';
+                            frame->header[length] = '\0';
+                        }
+
+                        /**
+                         * Get a pool slot nobody is reading.
+                         * Slots that were never used come last,
+                         * so memory is only allocated when needed
+                         */
+                        frame_t* reserve() {
+                            frame_t *empty = NULL;
+
+                            for (uint8_t i = 0; i < MJPEG_FRAME_POOL; i++) {
+                                frame_t *frame = &_pool[i];
+
+                                if (frame == _latest || frame == _held || frame->readers > 0)
+                                    continue;
+
+                                if (frame->buf != NULL)
+                                    return frame;
+
+                                if (empty == NULL)
+                                    empty = frame;
+                            }
+
+                            return empty;
+                        }
+
+                        /**
+                         * Advance client's send state.
+                         * Returns true if any byte was sent
+                         */
+                        bool service(client_t& client) {
+                            bool isProgress = false;
+
+                            if (client.frame == NULL && !start(client))
+                                return false;
+
+                            // (multipart header), part header, JPEG and boundary leave
+                            // in as few segments as the socket allows; offset spans all
+                            Gather gather;
+
+                            if (!client.isStarted)
+                                gather.add(MJPEG_PREAMBLE);
+
+                            gather
+                                .add(client.frame->header)
+                                .add(client.frame->buf, client.frame->length)
+                                .add("\r\n--frame\r\n", 11)
+                                .consume(client.offset);
+
+                            while (!gather.isEmpty()) {
+                                const int sent = gather.send(client.socket.fd(), MSG_DONTWAIT);
+
+                                if (sent == 0)
+                                    return isProgress;
+
+                                if (sent < 0) {
+                                    drop(client);
+                                    return isProgress;
+                                }
+
+                                isProgress = true;
+                                client.offset += sent;
+                                client.stats.bytes += sent;
+                            }
+
+                            finish(client);
+
+                            return true;
+                        }
+
+                        /**
+                         * Attach the newest frame to an idle client
+                         */
+                        bool start(client_t& client) {
+                            if (_latest == NULL || _latest->seq == client.lastSeq)
+                                return false;
+
+                            if (!client.socket.connected()) {
+                                drop(client);
+                                return false;
+                            }
+
+                            if (client.lastSeq > 0) {
+                                const uint32_t dropped = _latest->seq - client.lastSeq - 1;
+
+                                client.stats.dropped += dropped;
+
+                                if (_adaptive != NULL)
+                                    _adaptive->dropped(_adaptiveId + (&client - _clients), dropped);
+                            }
+
+                            client.frame = _latest;
+                            client.frame->readers += 1;
+                            client.offset = 0;
+                            client.startedAt = millis();
+
+                            return true;
+                        }
+
+                        /**
+                         * Release frame and update client's rate
+                         */
+                        void finish(client_t& client) {
+                            const size_t now = millis();
+
+                            if (client.lastFrameAt > 0 && now > client.lastFrameAt) {
+                                const float fps = 1000.0f / (now - client.lastFrameAt);
+
+                                client.stats.fps = client.stats.fps > 0 ? 0.9f * client.stats.fps + 0.1f * fps : fps;
+                            }
+
+                            if (_adaptive != NULL)
+                                _adaptive->sent(_adaptiveId + (&client - _clients), client.offset, now - client.startedAt);
+
+                            client.isStarted = true;
+                            client.lastSeq = client.frame->seq;
+                            client.lastFrameAt = now;
+                            client.stats.frames += 1;
+                            client.frame->readers -= 1;
+                            client.frame = NULL;
+                        }
+
+                        /**
+                         * Close client's connection
+                         */
+                        void drop(client_t& client) {
+                            if (client.frame != NULL)
+                                client.frame->readers -= 1;
+
+                            ESP_LOGI("Broadcaster", "Client disconnected after %u frames (%u dropped)", (unsigned int) client.stats.frames, (unsigned int) client.stats.dropped);
+                            client.socket.stop();
+                            client.frame = NULL;
+                            client.active = false;
+                            stats.disconnects += 1;
+                        }
+                };
+            }
+        }
+    }
+}
+
+#endif
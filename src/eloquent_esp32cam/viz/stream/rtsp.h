@@ -0,0 +1,663 @@
+#ifndef ELOQUENT_ESP32CAM_VIZ_STREAM_RTSP_H
+#define ELOQUENT_ESP32CAM_VIZ_STREAM_RTSP_H
+
+#include <WiFi.h>
+#include <WiFiUdp.h>
+#include "../../camera/camera.h"
+#include "../../extra/exception.h"
+#include "../../extra/time/rate_limit.h"
+#include "../../extra/esp32/wifi/sta.h"
+#include "../../extra/esp32/multiprocessing/thread.h"
+
+#ifndef RTSP_PORT
+#define RTSP_PORT 554
+#endif
+
+#ifndef RTSP_RTP_PORT
+#define RTSP_RTP_PORT 5004
+#endif
+
+#ifndef RTSP_MAX_SESSIONS
+#define RTSP_MAX_SESSIONS 2
+#endif
+
+#ifndef RTSP_MTU
+#define RTSP_MTU 1400
+#endif
+
+#ifndef RTSP_SESSION_TIMEOUT
+#define RTSP_SESSION_TIMEOUT 60
+#endif
+
+using eloq::camera;
+using eloq::wifi;
+using Eloquent::Error::Exception;
+using Eloquent::Extra::Time::RateLimit;
+using Eloquent::Extra::Esp32::Multiprocessing::Thread;
+
+
+namespace Eloquent {
+    namespace Esp32cam {
+        namespace Viz {
+            namespace Stream {
+                /**
+                 * RTSP server for NVRs and media players.
+                 * Camera JPEGs are packetized as RTP/JPEG (RFC 2435)
+                 * over UDP or interleaved in the RTSP connection (TCP).
+                 * Frames captured by other pipelines are reused:
+                 * a new capture only happens when no fresh frame
+                 * appeared within the frame interval.
+                 *
+                 * Try it with
+                 * ffprobe rtsp://<ip>:554/mjpeg
+                 * ffplay -rtsp_transport tcp rtsp://<ip>:554/mjpeg
+                 */
+                class RtspServer {
+                    public:
+                        Exception exception;
+                        Thread thread;
+                        RateLimit rate;
+                        struct {
+                            uint32_t frames;
+                            uint32_t packets;
+                            uint32_t unsupported;
+                        } stats;
+
+                        /**
+                         * Constructor
+                         */
+                        RtspServer() :
+                            exception("RTSP"),
+                            thread("RTSP"),
+                            _server(RTSP_PORT),
+                            _isRunning(false),
+                            _ssrc(0),
+                            _lastSeq(0),
+                            _buf(NULL),
+                            _length(0),
+                            _capacity(0),
+                            _timestamp(0) {
+                                memset(&stats, 0, sizeof(stats));
+
+                                for (uint8_t i = 0; i < RTSP_MAX_SESSIONS; i++)
+                                    _sessions[i].active = false;
+                            }
+
+                        /**
+                         * Debug self address
+                         */
+                        String address() const {
+                            return String("RTSP stream is available at rtsp://") + wifi.ip() + ":" + String(RTSP_PORT) + "/mjpeg";
+                        }
+
+                        /**
+                         * Start server
+                         */
+                        Exception& begin() {
+                            if (!wifi.isConnected())
+                                return exception.set("WiFi not connected");
+
+                            if (_isRunning)
+                                return exception.clear();
+
+                            _isRunning = true;
+                            _ssrc = esp_random();
+                            _server.begin();
+                            _udp.begin(RTSP_RTP_PORT);
+
+                            thread
+                                .withArgs((void*) this)
+                                .withStackSize(5000)
+                                .withPriority(1)
+                                .run([](void *args) {
+                                    RtspServer *self = (RtspServer*) args;
+
+                                    while (true) {
+                                        self->tick();
+                                        yield();
+                                    }
+                                });
+
+                            return exception.clear();
+                        }
+
+                        /**
+                         * Count sessions that are playing
+                         */
+                        uint8_t countPlaying() const {
+                            uint8_t count = 0;
+
+                            for (uint8_t i = 0; i < RTSP_MAX_SESSIONS; i++)
+                                if (_sessions[i].active && _sessions[i].isPlaying)
+                                    count++;
+
+                            return count;
+                        }
+
+                    protected:
+                        struct session_t {
+                            WiFiClient client;
+                            bool active;
+                            bool isPlaying;
+                            bool isTcp;
+                            uint32_t id;
+                            uint16_t rtpPort;
+                            uint8_t channel;
+                            uint16_t rtpSeq;
+                            size_t lastActivityAt;
+                            String request;
+                        };
+
+                        struct jpeg_t {
+                            uint16_t width;
+                            uint16_t height;
+                            uint8_t type;
+                            uint16_t dri;
+                            const uint8_t *tables[2];
+                            uint8_t numTables;
+                            const uint8_t *scan;
+                            size_t scanLength;
+                        };
+
+                        WiFiServer _server;
+                        WiFiUDP _udp;
+                        bool _isRunning;
+                        uint32_t _ssrc;
+                        uint32_t _lastSeq;
+                        uint8_t *_buf;
+                        size_t _length;
+                        size_t _capacity;
+                        uint32_t _timestamp;
+                        uint8_t _packet[RTSP_MTU + 4];
+                        session_t _sessions[RTSP_MAX_SESSIONS];
+
+                        /**
+                         * Accept clients, handle requests, stream
+                         */
+                        void tick() {
+                            accept();
+
+                            for (uint8_t i = 0; i < RTSP_MAX_SESSIONS; i++)
+                                if (_sessions[i].active)
+                                    read(_sessions[i]);
+
+                            if (countPlaying() == 0 || !grab()) {
+                                delay(5);
+                                return;
+                            }
+
+                            jpeg_t jpeg;
+
+                            if (!parse(jpeg)) {
+                                stats.unsupported += 1;
+                                ESP_LOGW("RTSP", "Frame is not a baseline JPEG RTP can carry");
+                                return;
+                            }
+
+                            stats.frames += 1;
+
+                            for (uint8_t i = 0; i < RTSP_MAX_SESSIONS; i++)
+                                if (_sessions[i].active && _sessions[i].isPlaying)
+                                    send(_sessions[i], jpeg);
+                        }
+
+                        /**
+                         * Accept new RTSP connection
+                         */
+                        void accept() {
+                            WiFiClient client = _server.available();
+
+                            if (!client)
+                                return;
+
+                            for (uint8_t i = 0; i < RTSP_MAX_SESSIONS; i++) {
+                                session_t &session = _sessions[i];
+
+                                if (session.active)
+                                    continue;
+
+                                session.client = client;
+                                session.active = true;
+                                session.isPlaying = false;
+                                session.isTcp = false;
+                                session.id = esp_random();
+                                session.rtpSeq = esp_random();
+                                session.lastActivityAt = millis();
+                                session.request = "";
+                                ESP_LOGI("RTSP", "Client connected from %s", client.remoteIP().toString().c_str());
+
+                                return;
+                            }
+
+                            ESP_LOGW("RTSP", "Max number of sessions reached (%d)", RTSP_MAX_SESSIONS);
+                            client.print("RTSP/1.0 503 Service Unavailable\r\n\r\n");
+                            client.stop();
+                        }
+
+                        /**
+                         * Read available request bytes (non blocking)
+                         */
+                        void read(session_t& session) {
+                            WiFiClient &client = session.client;
+
+                            if (!client.connected() || millis() - session.lastActivityAt > RTSP_SESSION_TIMEOUT * 1000UL) {
+                                close(session);
+                                return;
+                            }
+
+                            while (client.available()) {
+                                // interleaved RTCP from client: skip
+                                if (session.request.length() == 0 && client.peek() == '$') {
+                                    if (client.available() < 4)
+                                        return;
+
+                                    uint8_t header[4];
+
+                                    client.read(header, 4);
+
+                                    for (uint16_t length = (header[2] << 8) | header[3]; length > 0 && client.available(); length--)
+                                        client.read();
+
+                                    session.lastActivityAt = millis();
+                                    continue;
+                                }
+
+                                session.request += (char) client.read();
+
+                                if (session.request.endsWith("\r\n\r\n")) {
+                                    session.lastActivityAt = millis();
+                                    handle(session, session.request);
+                                    session.request = "";
+
+                                    if (!session.active)
+                                        return;
+                                }
+                                else if (session.request.length() > 2048) {
+                                    ESP_LOGW("RTSP", "Request too long");
+                                    close(session);
+                                    return;
+                                }
+                            }
+                        }
+
+                        /**
+                         * Handle RTSP request
+                         */
+                        void handle(session_t& session, const String& request) {
+                            const String method = request.substring(0, request.indexOf(' '));
+                            const String cseq = header(request, "CSeq");
+                            const String url = request.substring(request.indexOf(' ') + 1, request.indexOf(' ', request.indexOf(' ') + 1));
+
+                            ESP_LOGD("RTSP", "%s %s", method.c_str(), url.c_str());
+
+                            if (method == "OPTIONS")
+                                reply(session, cseq, "200 OK", "Public: OPTIONS, DESCRIBE, SETUP, PLAY, TEARDOWN, GET_PARAMETER\r\n");
+                            else if (method == "DESCRIBE")
+                                describe(session, cseq, url);
+                            else if (method == "SETUP")
+                                setup(session, cseq, header(request, "Transport"));
+                            else if (method == "PLAY") {
+                                session.isPlaying = true;
+                                reply(session, cseq, "200 OK", sessionHeader(session) + "Range: npt=0.000-\r\n");
+                            }
+                            else if (method == "GET_PARAMETER")
+                                reply(session, cseq, "200 OK", sessionHeader(session));
+                            else if (method == "TEARDOWN") {
+                                reply(session, cseq, "200 OK", sessionHeader(session));
+                                close(session);
+                            }
+                            else
+                                reply(session, cseq, "501 Not Implemented");
+                        }
+
+                        /**
+                         * Reply with SDP of the MJPEG track
+                         */
+                        void describe(session_t& session, const String& cseq, const String& url) {
+                            String sdp;
+
+                            sdp += "v=0\r\n";
+                            sdp += String("o=- ") + session.id + " 1 IN IP4 " + wifi.ip() + "\r\n";
+                            sdp += "s=ESP32 camera\r\n";
+                            sdp += "c=IN IP4 0.0.0.0\r\n";
+                            sdp += "t=0 0\r\n";
+                            sdp += "m=video 0 RTP/AVP 26\r\n";
+                            sdp += "a=control:track1\r\n";
+
+                            reply(session, cseq, "200 OK", String("Content-Base: ") + url + "/\r\n", "application/sdp", sdp);
+                        }
+
+                        /**
+                         * Negotiate transport: UDP or TCP interleaved
+                         */
+                        void setup(session_t& session, const String& cseq, const String& transport) {
+                            String transportHeader;
+
+                            if (transport.indexOf("RTP/AVP/TCP") >= 0) {
+                                const int ix = transport.indexOf("interleaved=");
+
+                                session.isTcp = true;
+                                session.channel = ix >= 0 ? transport.substring(ix + 12).toInt() : 0;
+                                transportHeader = String("Transport: RTP/AVP/TCP;unicast;interleaved=") + session.channel + "-" + (session.channel + 1) + "\r\n";
+                            }
+                            else {
+                                const int ix = transport.indexOf("client_port=");
+
+                                if (ix < 0) {
+                                    reply(session, cseq, "461 Unsupported Transport");
+                                    return;
+                                }
+
+                                session.isTcp = false;
+                                session.rtpPort = transport.substring(ix + 12).toInt();
+                                transportHeader = String("Transport: RTP/AVP;unicast;client_port=") + session.rtpPort + "-" + (session.rtpPort + 1) + ";server_port=" + RTSP_RTP_PORT + "-" + (RTSP_RTP_PORT + 1) + ";ssrc=" + String(_ssrc, HEX) + "\r\n";
+                            }
+
+                            reply(session, cseq, "200 OK", transportHeader + sessionHeader(session));
+                        }
+
+                        /**
+                         * Send RTSP response
+                         */
+                        void reply(session_t& session, const String& cseq, const char *status, const String& headers = "", const char *contentType = NULL, const String& body = "") {
+                            String response = String("RTSP/1.0 ") + status + "\r\nCSeq: " + cseq + "\r\n" + headers;
+
+                            if (contentType != NULL)
+                                response += String("Content-Type: ") + contentType + "\r\nContent-Length: " + body.length() + "\r\n";
+
+                            response += "\r\n";
+                            response += body;
+                            session.client.print(response);
+                        }
+
+                        /**
+                         *
+                         */
+                        String sessionHeader(session_t& session) {
+                            return String("Session: ") + String(session.id, HEX) + ";timeout=" + RTSP_SESSION_TIMEOUT + "\r\n";
+                        }
+
+                        /**
+                         * Get request header value (case insensitive name)
+                         */
+                        static String header(const String& request, const char *name) {
+                            String lower = request;
+                            String key = String("\n") + name + ":";
+
+                            lower.toLowerCase();
+                            key.toLowerCase();
+
+                            const int start = lower.indexOf(key);
+
+                            if (start < 0)
+                                return "";
+
+                            const int end = request.indexOf('\r', start + key.length());
+                            String value = request.substring(start + key.length(), end);
+
+                            value.trim();
+
+                            return value;
+                        }
+
+                        /**
+                         * Stop session
+                         */
+                        void close(session_t& session) {
+                            ESP_LOGI("RTSP", "Session %08x closed", (unsigned int) session.id);
+                            session.client.stop();
+                            session.active = false;
+                            session.isPlaying = false;
+                            session.request = "";
+                        }
+
+                        /**
+                         * Copy a frame newer than the last one sent
+                         */
+                        bool grab() {
+                            if (camera.seq == _lastSeq || !camera.hasFrame()) {
+                                if (!rate)
+                                    return false;
+
+                                if (!camera.capture().isOk())
+                                    return false;
+                            }
+
+                            bool isOk = false;
+
+                            camera.mutex.threadsafe([this, &isOk]() {
+                                if (!camera.hasFrame())
+                                    return;
+
+                                if (camera.frame->len > _capacity) {
+                                    ::free(_buf);
+                                    _capacity = camera.frame->len * 5 / 4;
+                                    _buf = (uint8_t*) (psramFound() ? ps_malloc(_capacity) : malloc(_capacity));
+                                }
+
+                                if (_buf == NULL) {
+                                    _capacity = 0;
+                                    return;
+                                }
+
+                                memcpy(_buf, camera.frame->buf, camera.frame->len);
+                                _length = camera.frame->len;
+                                _lastSeq = camera.seq;
+                                // RTP clock for video is 90 kHz
+                                _timestamp = camera.capturedAt * 90;
+                                isOk = true;
+                            }, 1000);
+
+                            if (isOk)
+                                rate.touch();
+
+                            return isOk;
+                        }
+
+                        /**
+                         * Locate quantization tables and entropy coded
+                         * data in the JPEG, as required by RFC 2435
+                         */
+                        bool parse(jpeg_t& jpeg) {
+                            const uint8_t *buf = _buf;
+                            size_t i = 2;
+
+                            jpeg.numTables = 0;
+                            jpeg.dri = 0;
+                            jpeg.width = 0;
+
+                            if (_length < 4 || buf[0] != 0xFF || buf[1] != 0xD8)
+                                return false;
+
+                            while (i + 4 <= _length) {
+                                if (buf[i] != 0xFF)
+                                    return false;
+
+                                const uint8_t marker = buf[i + 1];
+
+                                // fill byte
+                                if (marker == 0xFF) {
+                                    i += 1;
+                                    continue;
+                                }
+
+                                const uint16_t length = (buf[i + 2] << 8) | buf[i + 3];
+                                const uint8_t *segment = buf + i + 4;
+
+                                if (i + 2 + length > _length)
+                                    return false;
+
+                                switch (marker) {
+                                    // quantization tables
+                                    case 0xDB:
+                                        for (uint16_t j = 0; j + 65 <= length - 2; j += 65) {
+                                            // only 8 bit precision
+                                            if ((segment[j] >> 4) != 0)
+                                                return false;
+
+                                            if ((segment[j] & 0x0F) < 2 && jpeg.numTables < 2)
+                                                jpeg.tables[jpeg.numTables++] = segment + j + 1;
+                                        }
+                                        break;
+                                    // baseline frame
+                                    case 0xC0: {
+                                        const uint8_t sampling = segment[7];
+
+                                        jpeg.height = (segment[1] << 8) | segment[2];
+                                        jpeg.width = (segment[3] << 8) | segment[4];
+
+                                        if (sampling == 0x21)
+                                            jpeg.type = 0;
+                                        else if (sampling == 0x22)
+                                            jpeg.type = 1;
+                                        else
+                                            return false;
+
+                                        // size is sent in 8px units, in a byte
+                                        if (jpeg.width > 2040 || jpeg.height > 2040)
+                                            return false;
+                                        break;
+                                    }
+                                    // progressive and other encodings
+                                    case 0xC1: case 0xC2: case 0xC3: case 0xC5: case 0xC6: case 0xC7:
+                                    case 0xC9: case 0xCA: case 0xCB: case 0xCD: case 0xCE: case 0xCF:
+                                        return false;
+                                    // restart interval
+                                    case 0xDD:
+                                        jpeg.dri = (segment[0] << 8) | segment[1];
+                                        break;
+                                    // start of scan: the rest is entropy coded data
+                                    case 0xDA:
+                                        jpeg.scan = buf + i + 2 + length;
+                                        jpeg.scanLength = _length - (i + 2 + length);
+
+                                        // drop EOI (and padding) at end
+                                        while (jpeg.scanLength >= 2 && !(jpeg.scan[jpeg.scanLength - 2] == 0xFF && jpeg.scan[jpeg.scanLength - 1] == 0xD9))
+                                            jpeg.scanLength -= 1;
+
+                                        if (jpeg.scanLength >= 2)
+                                            jpeg.scanLength -= 2;
+
+                                        return jpeg.width > 0 && jpeg.numTables > 0 && jpeg.scanLength > 0;
+                                }
+
+                                i += 2 + length;
+                            }
+
+                            return false;
+                        }
+
+                        /**
+                         * Packetize frame for session
+                         */
+                        void send(session_t& session, const jpeg_t& jpeg) {
+                            // TCP packets are prefixed by the interleaved header
+                            const uint8_t prefix = session.isTcp ? 4 : 0;
+                            size_t offset = 0;
+
+                            while (offset < jpeg.scanLength) {
+                                uint8_t *p = _packet + prefix;
+                                uint8_t *rtp = p;
+
+                                // RTP header
+                                p[0] = 0x80;
+                                p[1] = 26;
+                                p[2] = session.rtpSeq >> 8;
+                                p[3] = session.rtpSeq & 0xFF;
+                                p[4] = _timestamp >> 24;
+                                p[5] = _timestamp >> 16;
+                                p[6] = _timestamp >> 8;
+                                p[7] = _timestamp;
+                                p[8] = _ssrc >> 24;
+                                p[9] = _ssrc >> 16;
+                                p[10] = _ssrc >> 8;
+                                p[11] = _ssrc;
+                                p += 12;
+
+                                // JPEG header
+                                p[0] = 0;
+                                p[1] = offset >> 16;
+                                p[2] = offset >> 8;
+                                p[3] = offset;
+                                p[4] = jpeg.type + (jpeg.dri > 0 ? 64 : 0);
+                                p[5] = 255;
+                                p[6] = (jpeg.width + 7) / 8;
+                                p[7] = (jpeg.height + 7) / 8;
+                                p += 8;
+
+                                // restart marker header
+                                if (jpeg.dri > 0) {
+                                    p[0] = jpeg.dri >> 8;
+                                    p[1] = jpeg.dri & 0xFF;
+                                    p[2] = 0xFF;
+                                    p[3] = 0xFF;
+                                    p += 4;
+                                }
+
+                                // quantization tables go in the first packet only
+                                if (offset == 0) {
+                                    p[0] = 0;
+                                    p[1] = 0;
+                                    p[2] = 0;
+                                    p[3] = 64 * jpeg.numTables;
+                                    p += 4;
+
+                                    for (uint8_t t = 0; t < jpeg.numTables; t++, p += 64)
+                                        memcpy(p, jpeg.tables[t], 64);
+                                }
+
+                                const size_t room = RTSP_MTU - (p - rtp);
+                                const size_t chunk = min(room, jpeg.scanLength - offset);
+
+                                memcpy(p, jpeg.scan + offset, chunk);
+                                p += chunk;
+                                offset += chunk;
+
+                                // marker bit on last packet of frame
+                                if (offset >= jpeg.scanLength)
+                                    rtp[1] |= 0x80;
+
+                                if (!write(session, p - rtp))
+                                    return;
+
+                                session.rtpSeq += 1;
+                                stats.packets += 1;
+                            }
+                        }
+
+                        /**
+                         * Write RTP packet (already in _packet)
+                         */
+                        bool write(session_t& session, size_t length) {
+                            if (session.isTcp) {
+                                _packet[0] = '$';
+                                _packet[1] = session.channel;
+                                _packet[2] = length >> 8;
+                                _packet[3] = length & 0xFF;
+
+                                if (session.client.write(_packet, length + 4) != length + 4) {
+                                    close(session);
+                                    return false;
+                                }
+
+                                return true;
+                            }
+
+                            _udp.beginPacket(session.client.remoteIP(), session.rtpPort);
+                            _udp.write(_packet, length);
+
+                            return _udp.endPacket();
+                        }
+                };
+            }
+        }
+    }
+}
+
+namespace eloq {
+    namespace viz {
+        static Eloquent::Esp32cam::Viz::Stream::RtspServer rtsp;
+    }
+}
+
+#endif
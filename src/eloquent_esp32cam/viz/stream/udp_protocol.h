@@ -0,0 +1,82 @@
+#ifndef ELOQUENT_ESP32CAM_VIZ_STREAM_UDP_PROTOCOL_H
+#define ELOQUENT_ESP32CAM_VIZ_STREAM_UDP_PROTOCOL_H
+
+#ifndef UDP_STREAM_MTU
+#define UDP_STREAM_MTU 1400
+#endif
+
+#define UDP_STREAM_HEADER_SIZE 20
+#define UDP_STREAM_PAYLOAD_SIZE (UDP_STREAM_MTU - UDP_STREAM_HEADER_SIZE)
+
+
+namespace Eloquent {
+    namespace Esp32cam {
+        namespace Viz {
+            namespace Stream {
+                /**
+                 * Header of each JPEG fragment sent over UDP
+                 * (big endian on the wire):
+                 *  - uint32 frame seq
+                 *  - uint32 offset of fragment in frame
+                 *  - uint32 frame size
+                 *  - uint32 capture time (sender millis)
+                 *  - uint16 fragment index
+                 *  - uint16 fragment count
+                 */
+                struct udp_fragment_t {
+                    uint32_t seq;
+                    uint32_t offset;
+                    uint32_t size;
+                    uint32_t capturedAt;
+                    uint16_t index;
+                    uint16_t count;
+
+                    /**
+                     * Write header to buffer
+                     */
+                    void pack(uint8_t *dest) const {
+                        write32(dest, seq);
+                        write32(dest + 4, offset);
+                        write32(dest + 8, size);
+                        write32(dest + 12, capturedAt);
+                        dest[16] = index >> 8;
+                        dest[17] = index & 0xFF;
+                        dest[18] = count >> 8;
+                        dest[19] = count & 0xFF;
+                    }
+
+                    /**
+                     * Read header from buffer
+                     */
+                    void unpack(const uint8_t *src) {
+                        seq = read32(src);
+                        offset = read32(src + 4);
+                        size = read32(src + 8);
+                        capturedAt = read32(src + 12);
+                        index = (src[16] << 8) | src[17];
+                        count = (src[18] << 8) | src[19];
+                    }
+
+                    /**
+                     *
+                     */
+                    static void write32(uint8_t *dest, uint32_t value) {
+                        dest[0] = value >> 24;
+                        dest[1] = value >> 16;
+                        dest[2] = value >> 8;
+                        dest[3] = value;
+                    }
+
+                    /**
+                     *
+                     */
+                    static uint32_t read32(const uint8_t *src) {
+                        return (((uint32_t) src[0]) << 24) | (((uint32_t) src[1]) << 16) | (((uint32_t) src[2]) << 8) | src[3];
+                    }
+                };
+            }
+        }
+    }
+}
+
+#endif
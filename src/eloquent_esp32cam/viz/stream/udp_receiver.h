@@ -0,0 +1,255 @@
+#ifndef ELOQUENT_ESP32CAM_VIZ_STREAM_UDP_RECEIVER_H
+#define ELOQUENT_ESP32CAM_VIZ_STREAM_UDP_RECEIVER_H
+
+#include <functional>
+#include <WiFi.h>
+#include <WiFiUdp.h>
+#include "../../extra/exception.h"
+#include "../../extra/time/rate_limit.h"
+#include "./udp_protocol.h"
+
+#ifndef UDP_RECEIVER_MAX_FRAME
+#define UDP_RECEIVER_MAX_FRAME 128000
+#endif
+
+#ifndef UDP_RECEIVER_RESYNC_TIMEOUT
+#define UDP_RECEIVER_RESYNC_TIMEOUT 1000
+#endif
+
+#define UDP_RECEIVER_MAX_FRAGMENTS ((UDP_RECEIVER_MAX_FRAME + UDP_STREAM_PAYLOAD_SIZE - 1) / UDP_STREAM_PAYLOAD_SIZE)
+
+using Eloquent::Error::Exception;
+using Eloquent::Extra::Time::RateLimit;
+
+
+namespace Eloquent {
+    namespace Esp32cam {
+        namespace Viz {
+            namespace Stream {
+                /**
+                 * Reassemble frames sent by UdpStream.
+                 * A frame is delivered only when all its fragments
+                 * arrived; as soon as a newer frame starts, any
+                 * incomplete one is dropped (no waiting, no retransmission)
+                 */
+                class UdpReceiver {
+                    public:
+                        using FrameCallback = std::function<void(const uint8_t*, size_t, uint32_t)>;
+
+                        Exception exception;
+                        struct {
+                            uint32_t frames;
+                            uint32_t dropped;
+                            uint32_t stale;
+                            uint32_t invalid;
+                            size_t assemblyMs;
+                        } stats;
+
+                        /**
+                         * Constructor
+                         */
+                        UdpReceiver() :
+                            exception("UdpReceiver"),
+                            _buf(NULL),
+                            _seq(0),
+                            _received(0),
+                            _expected(0),
+                            _size(0),
+                            _firstAt(0),
+                            _staleSince(0),
+                            _isComplete(false) {
+                                memset(&stats, 0, sizeof(stats));
+                                _subscription.atMostOnceEvery(1000);
+                            }
+
+                        /**
+                         * Run function on each complete frame
+                         * (jpeg, length, seq)
+                         */
+                        void onFrame(FrameCallback callback) {
+                            _onFrame = callback;
+                        }
+
+                        /**
+                         * Listen on local port.
+                         * If a sender is given, subscribe to it
+                         * (and keep the subscription alive in poll())
+                         */
+                        Exception& begin(uint16_t localPort, IPAddress sender = IPAddress(), uint16_t senderPort = 5000) {
+                            if (_buf == NULL)
+                                _buf = (uint8_t*) (psramFound() ? ps_malloc(UDP_RECEIVER_MAX_FRAME) : malloc(UDP_RECEIVER_MAX_FRAME));
+
+                            if (_buf == NULL)
+                                return exception.set("Cannot allocate frame buffer");
+
+                            _sender = sender;
+                            _senderPort = senderPort;
+                            _udp.begin(localPort);
+
+                            return exception.clear();
+                        }
+
+                        /**
+                         * Read all pending fragments.
+                         * Call it in loop()
+                         */
+                        void poll() {
+                            if (_sender != IPAddress() && _subscription) {
+                                _subscription.touch();
+                                _udp.beginPacket(_sender, _senderPort);
+                                _udp.write((const uint8_t*) "sub", 3);
+                                _udp.endPacket();
+                            }
+
+                            while (_udp.parsePacket() > 0)
+                                receive();
+                        }
+
+                    protected:
+                        WiFiUDP _udp;
+                        IPAddress _sender;
+                        uint16_t _senderPort;
+                        RateLimit _subscription;
+                        FrameCallback _onFrame;
+                        uint8_t *_buf;
+                        uint8_t _packet[UDP_STREAM_MTU];
+                        uint8_t _mask[(UDP_RECEIVER_MAX_FRAGMENTS + 7) / 8];
+                        uint32_t _seq;
+                        uint16_t _received;
+                        uint16_t _expected;
+                        uint32_t _size;
+                        size_t _firstAt;
+                        size_t _staleSince;
+                        bool _isComplete;
+
+                        /**
+                         * Handle one datagram
+                         */
+                        void receive() {
+                            const int length = _udp.read(_packet, sizeof(_packet));
+                            udp_fragment_t fragment;
+
+                            if (length <= UDP_STREAM_HEADER_SIZE) {
+                                stats.invalid += 1;
+                                return;
+                            }
+
+                            fragment.unpack(_packet);
+
+                            const size_t chunk = length - UDP_STREAM_HEADER_SIZE;
+
+                            if (!isValid(fragment, chunk)) {
+                                stats.invalid += 1;
+                                return;
+                            }
+
+                            // late fragment of an older frame, unless
+                            // the sender restarted its seq (e.g. reboot)
+                            if (_seq > 0 && fragment.seq < _seq && !isRestart(fragment)) {
+                                stats.stale += 1;
+                                return;
+                            }
+
+                            _staleSince = 0;
+
+                            if (fragment.seq != _seq)
+                                start(fragment);
+
+                            // same seq, different frame layout: forged or corrupted
+                            if (fragment.count != _expected || fragment.size != _size) {
+                                stats.invalid += 1;
+                                return;
+                            }
+
+                            if (_isComplete || isReceived(fragment.index))
+                                return;
+
+                            memcpy(_buf + fragment.offset, _packet + UDP_STREAM_HEADER_SIZE, chunk);
+                            _mask[fragment.index / 8] |= 1 << (fragment.index % 8);
+                            _received += 1;
+
+                            if (_received < _expected)
+                                return;
+
+                            _isComplete = true;
+                            stats.frames += 1;
+                            stats.assemblyMs = millis() - _firstAt;
+
+                            if (_onFrame)
+                                _onFrame(_buf, fragment.size, fragment.seq);
+                        }
+
+                        /**
+                         * Test if fragment header is consistent.
+                         * Any host can send datagrams, so nothing here
+                         * may overflow (size_t is 32 bit on the ESP32)
+                         */
+                        bool isValid(const udp_fragment_t& fragment, size_t chunk) const {
+                            if (fragment.size == 0 || fragment.size > UDP_RECEIVER_MAX_FRAME)
+                                return false;
+
+                            if (fragment.count == 0 || fragment.count > UDP_RECEIVER_MAX_FRAGMENTS || fragment.index >= fragment.count)
+                                return false;
+
+                            if (fragment.count != (fragment.size + UDP_STREAM_PAYLOAD_SIZE - 1) / UDP_STREAM_PAYLOAD_SIZE)
+                                return false;
+
+                            if (fragment.offset != ((uint32_t) fragment.index) * UDP_STREAM_PAYLOAD_SIZE)
+                                return false;
+
+                            return fragment.offset < fragment.size && chunk <= fragment.size - fragment.offset;
+                        }
+
+                        /**
+                         * New frame begins: drop the incomplete one
+                         */
+                        void start(const udp_fragment_t& fragment) {
+                            if (_seq > 0 && !_isComplete)
+                                stats.dropped += 1;
+
+                            _seq = fragment.seq;
+                            _expected = fragment.count;
+                            _size = fragment.size;
+                            _received = 0;
+                            _firstAt = millis();
+                            _isComplete = false;
+                            memset(_mask, 0, sizeof(_mask));
+                        }
+
+                        /**
+                         * Test if an older seq means a new stream:
+                         * either a large backwards jump, or only old
+                         * seqs for more than UDP_RECEIVER_RESYNC_TIMEOUT
+                         */
+                        bool isRestart(const udp_fragment_t& fragment) {
+                            if (_seq - fragment.seq > 1000) {
+                                ESP_LOGI("UdpReceiver", "Sender seq jumped back from %u to %u, resyncing", (unsigned int) _seq, (unsigned int) fragment.seq);
+                                return true;
+                            }
+
+                            if (_staleSince == 0) {
+                                _staleSince = millis();
+                                return false;
+                            }
+
+                            if (millis() - _staleSince < UDP_RECEIVER_RESYNC_TIMEOUT)
+                                return false;
+
+                            ESP_LOGI("UdpReceiver", "Only stale fragments for %d ms, resyncing", UDP_RECEIVER_RESYNC_TIMEOUT);
+
+                            return true;
+                        }
+
+                        /**
+                         *
+                         */
+                        bool isReceived(uint16_t index) const {
+                            return _mask[index / 8] & (1 << (index % 8));
+                        }
+                };
+            }
+        }
+    }
+}
+
+#endif
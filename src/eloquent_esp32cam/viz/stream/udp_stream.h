@@ -0,0 +1,306 @@
+#ifndef ELOQUENT_ESP32CAM_VIZ_STREAM_UDP_STREAM_H
+#define ELOQUENT_ESP32CAM_VIZ_STREAM_UDP_STREAM_H
+
+#include <WiFi.h>
+#include <WiFiUdp.h>
+#include "../../camera/camera.h"
+#include "../../extra/exception.h"
+#include "../../extra/time/rate_limit.h"
+#include "../../extra/esp32/wifi/sta.h"
+#include "../../extra/esp32/multiprocessing/thread.h"
+#include "./udp_protocol.h"
+
+#ifndef UDP_STREAM_PORT
+#define UDP_STREAM_PORT 5000
+#endif
+
+#ifndef UDP_STREAM_MAX_TARGETS
+#define UDP_STREAM_MAX_TARGETS 2
+#endif
+
+#ifndef UDP_STREAM_TARGET_TIMEOUT
+#define UDP_STREAM_TARGET_TIMEOUT 5000
+#endif
+
+using eloq::camera;
+using eloq::wifi;
+using Eloquent::Error::Exception;
+using Eloquent::Extra::Time::RateLimit;
+using Eloquent::Extra::Esp32::Multiprocessing::Thread;
+
+
+namespace Eloquent {
+    namespace Esp32cam {
+        namespace Viz {
+            namespace Stream {
+                /**
+                 * Low latency video over UDP.
+                 * Each JPEG is split in MTU-sized fragments
+                 * (see udp_fragment_t); receivers drop incomplete
+                 * frames instead of waiting for retransmissions,
+                 * so a lost packet never delays the next frame.
+                 *
+                 * Receivers either are set with to(), or subscribe by
+                 * sending any datagram to UDP_STREAM_PORT at least
+                 * every UDP_STREAM_TARGET_TIMEOUT millis
+                 */
+                class UdpStream {
+                    public:
+                        Exception exception;
+                        Thread thread;
+                        RateLimit rate;
+                        struct {
+                            uint32_t frames;
+                            uint32_t fragments;
+                            uint32_t errors;
+                        } stats;
+
+                        /**
+                         * Constructor
+                         */
+                        UdpStream() :
+                            exception("UdpStream"),
+                            thread("UdpStream"),
+                            _isRunning(false),
+                            _lastSeq(0),
+                            _buf(NULL),
+                            _length(0),
+                            _capacity(0),
+                            _capturedAt(0) {
+                                memset(&stats, 0, sizeof(stats));
+
+                                for (uint8_t i = 0; i < UDP_STREAM_MAX_TARGETS; i++)
+                                    _targets[i].active = false;
+                            }
+
+                        /**
+                         * Debug self address
+                         */
+                        String address() const {
+                            return String("UDP stream is available at ") + wifi.ip() + ":" + String(UDP_STREAM_PORT);
+                        }
+
+                        /**
+                         * Add a permanent receiver
+                         */
+                        bool to(IPAddress ip, uint16_t port) {
+                            return subscribe(ip, port, true);
+                        }
+
+                        /**
+                         * Start streaming task
+                         */
+                        Exception& begin() {
+                            if (!wifi.isConnected())
+                                return exception.set("WiFi not connected");
+
+                            if (_isRunning)
+                                return exception.clear();
+
+                            _isRunning = true;
+                            _udp.begin(UDP_STREAM_PORT);
+
+                            thread
+                                .withArgs((void*) this)
+                                .withStackSize(4000)
+                                .withPriority(2)
+                                .run([](void *args) {
+                                    UdpStream *self = (UdpStream*) args;
+
+                                    while (true) {
+                                        self->tick();
+                                        yield();
+                                    }
+                                });
+
+                            return exception.clear();
+                        }
+
+                        /**
+                         * Count active receivers
+                         */
+                        uint8_t count() const {
+                            uint8_t count = 0;
+
+                            for (uint8_t i = 0; i < UDP_STREAM_MAX_TARGETS; i++)
+                                if (_targets[i].active)
+                                    count++;
+
+                            return count;
+                        }
+
+                    protected:
+                        struct target_t {
+                            IPAddress ip;
+                            uint16_t port;
+                            bool active;
+                            bool isPermanent;
+                            size_t lastSeenAt;
+                        };
+
+                        WiFiUDP _udp;
+                        bool _isRunning;
+                        uint32_t _lastSeq;
+                        uint8_t *_buf;
+                        size_t _length;
+                        size_t _capacity;
+                        uint32_t _capturedAt;
+                        uint8_t _packet[UDP_STREAM_MTU];
+                        target_t _targets[UDP_STREAM_MAX_TARGETS];
+
+                        /**
+                         * Register subscriptions, then send new frame
+                         */
+                        void tick() {
+                            listen();
+
+                            if (count() == 0 || !grab()) {
+                                delay(1);
+                                return;
+                            }
+
+                            stats.frames += 1;
+
+                            for (uint8_t i = 0; i < UDP_STREAM_MAX_TARGETS; i++)
+                                if (_targets[i].active)
+                                    send(_targets[i]);
+                        }
+
+                        /**
+                         * Add (or refresh) receiver
+                         */
+                        bool subscribe(IPAddress ip, uint16_t port, bool isPermanent) {
+                            target_t *free = NULL;
+
+                            for (uint8_t i = 0; i < UDP_STREAM_MAX_TARGETS; i++) {
+                                target_t &target = _targets[i];
+
+                                if (target.active && target.ip == ip && target.port == port) {
+                                    target.lastSeenAt = millis();
+                                    return true;
+                                }
+
+                                if (!target.active && free == NULL)
+                                    free = &target;
+                            }
+
+                            if (free == NULL) {
+                                ESP_LOGW("UdpStream", "Max number of receivers reached (%d)", UDP_STREAM_MAX_TARGETS);
+                                return false;
+                            }
+
+                            free->ip = ip;
+                            free->port = port;
+                            free->active = true;
+                            free->isPermanent = isPermanent;
+                            free->lastSeenAt = millis();
+                            ESP_LOGI("UdpStream", "Streaming to %s:%d", ip.toString().c_str(), port);
+
+                            return true;
+                        }
+
+                        /**
+                         * Handle subscription datagrams and expire
+                         * receivers that stopped sending them
+                         */
+                        void listen() {
+                            while (_udp.parsePacket() > 0) {
+                                subscribe(_udp.remoteIP(), _udp.remotePort(), false);
+                                _udp.flush();
+                            }
+
+                            for (uint8_t i = 0; i < UDP_STREAM_MAX_TARGETS; i++) {
+                                target_t &target = _targets[i];
+
+                                if (target.active && !target.isPermanent && millis() - target.lastSeenAt > UDP_STREAM_TARGET_TIMEOUT) {
+                                    ESP_LOGI("UdpStream", "Receiver %s:%d timed out", target.ip.toString().c_str(), target.port);
+                                    target.active = false;
+                                }
+                            }
+                        }
+
+                        /**
+                         * Copy a frame newer than the last one sent.
+                         * Frames from other pipelines are reused
+                         */
+                        bool grab() {
+                            if (camera.seq == _lastSeq || !camera.hasFrame()) {
+                                if (!rate)
+                                    return false;
+
+                                if (!camera.capture().isOk())
+                                    return false;
+                            }
+
+                            bool isOk = false;
+
+                            camera.mutex.threadsafe([this, &isOk]() {
+                                if (!camera.hasFrame())
+                                    return;
+
+                                if (camera.frame->len > _capacity) {
+                                    ::free(_buf);
+                                    _capacity = camera.frame->len * 5 / 4;
+                                    _buf = (uint8_t*) (psramFound() ? ps_malloc(_capacity) : malloc(_capacity));
+                                }
+
+                                if (_buf == NULL) {
+                                    _capacity = 0;
+                                    return;
+                                }
+
+                                memcpy(_buf, camera.frame->buf, camera.frame->len);
+                                _length = camera.frame->len;
+                                _lastSeq = camera.seq;
+                                _capturedAt = camera.capturedAt;
+                                isOk = true;
+                            }, 1000);
+
+                            if (isOk)
+                                rate.touch();
+
+                            return isOk;
+                        }
+
+                        /**
+                         * Send frame as fragments
+                         */
+                        void send(target_t& target) {
+                            udp_fragment_t fragment;
+
+                            fragment.seq = _lastSeq;
+                            fragment.size = _length;
+                            fragment.capturedAt = _capturedAt;
+                            fragment.count = (_length + UDP_STREAM_PAYLOAD_SIZE - 1) / UDP_STREAM_PAYLOAD_SIZE;
+
+                            for (fragment.index = 0; fragment.index < fragment.count; fragment.index++) {
+                                fragment.offset = fragment.index * UDP_STREAM_PAYLOAD_SIZE;
+
+                                const size_t chunk = min<size_t>(UDP_STREAM_PAYLOAD_SIZE, _length - fragment.offset);
+
+                                fragment.pack(_packet);
+                                memcpy(_packet + UDP_STREAM_HEADER_SIZE, _buf + fragment.offset, chunk);
+
+                                _udp.beginPacket(target.ip, target.port);
+                                _udp.write(_packet, UDP_STREAM_HEADER_SIZE + chunk);
+
+                                // a lost fragment is fine, a blocked sender is not
+                                if (!_udp.endPacket())
+                                    stats.errors += 1;
+                                else
+                                    stats.fragments += 1;
+                            }
+                        }
+                };
+            }
+        }
+    }
+}
+
+namespace eloq {
+    namespace viz {
+        static Eloquent::Esp32cam::Viz::Stream::UdpStream udpStream;
+    }
+}
+
+#endif
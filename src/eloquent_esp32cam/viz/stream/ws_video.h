@@ -0,0 +1,471 @@
+#ifndef ELOQUENT_ESP32CAM_VIZ_STREAM_WS_VIDEO_H
+#define ELOQUENT_ESP32CAM_VIZ_STREAM_WS_VIDEO_H
+
+#include <functional>
+#include "../../camera/camera.h"
+#include "../../extra/exception.h"
+#include "../../extra/time/rate_limit.h"
+#include "../../extra/serialize/writer.h"
+#include "../../extra/esp32/wifi/sta.h"
+#include "../../extra/esp32/ws/threaded_ws.h"
+#include "./adaptive.h"
+
+#ifndef WS_VIDEO_PORT
+#define WS_VIDEO_PORT 82
+#endif
+
+#ifndef WS_VIDEO_MAX_CLIENTS
+#define WS_VIDEO_MAX_CLIENTS 4
+#endif
+
+#ifndef WS_VIDEO_MAX_IN_FLIGHT
+#define WS_VIDEO_MAX_IN_FLIGHT 4
+#endif
+
+#ifndef WS_VIDEO_ACK_TIMEOUT
+#define WS_VIDEO_ACK_TIMEOUT 2000
+#endif
+
+#define WS_VIDEO_HEADER_SIZE 14
+
+using eloq::camera;
+using eloq::wifi;
+using Eloquent::Error::Exception;
+using Eloquent::Extra::Time::RateLimit;
+using Eloquent::Extra::Serialize::Writer;
+using Eloquent::Extra::Esp32::Ws::ThreadedWs;
+using Eloquent::Esp32cam::Viz::Stream::Adaptive;
+
+
+namespace Eloquent {
+    namespace Esp32cam {
+        namespace Viz {
+            namespace Stream {
+                /**
+                 * Stream video over WebSocket, one binary message per frame.
+                 * Message layout (little endian):
+                 *  - uint32 frame seq
+                 *  - uint32 capture time (millis since boot)
+                 *  - uint32 JPEG size
+                 *  - uint16 detections length
+                 *  - detections (annotator output, ASCII)
+                 *  - JPEG
+                 *
+                 * Clients reply with text commands:
+                 *  - "ack <seq>": frame received (cumulative)
+                 *  - "quality <10-63>": set JPEG quality
+                 *  - "resolution <framesize_t>": set sensor resolution
+                 *    (up to the framesize at begin())
+                 *
+                 * At most window() frames are in flight for each client,
+                 * so a slow client is paced instead of buffered.
+                 * Frames captured by other pipelines are reused:
+                 * a new capture only happens when no fresh frame
+                 * appeared within the frame interval
+                 */
+                class WsVideo {
+                    public:
+                        using Annotator = std::function<void(String&)>;
+
+                        struct client_stats_t {
+                            uint32_t frames;
+                            uint32_t acked;
+                            uint32_t timeouts;
+                            uint8_t inFlight;
+                            float latency;
+                        };
+
+                        Exception exception;
+                        ThreadedWs ws;
+                        RateLimit rate;
+
+                        /**
+                         * Constructor
+                         */
+                        WsVideo() :
+                            exception("WsVideo"),
+                            ws("WsVideo", WS_VIDEO_PORT),
+                            _window(2),
+                            _lastSeq(0),
+                            _buf(NULL),
+                            _length(0),
+                            _capacity(0),
+                            _adaptive(NULL),
+                            _adaptiveId(0),
+                            _maxFramesize(FRAMESIZE_QQVGA) {
+                                for (uint8_t i = 0; i < WS_VIDEO_MAX_CLIENTS; i++)
+                                    _clients[i].active = false;
+                            }
+
+                        /**
+                         * Debug self address
+                         */
+                        String address() const {
+                            return String("WebSocket video is available at ws://") + wifi.ip() + ":" + String(WS_VIDEO_PORT);
+                        }
+
+                        /**
+                         * Max number of unacknowledged frames per client
+                         */
+                        void window(uint8_t frames) {
+                            _window = constrain(frames, 1, WS_VIDEO_MAX_IN_FLIGHT);
+                        }
+
+                        /**
+                         * Run function on each sent frame.
+                         * It must append a compact description of the
+                         * current camera frame (e.g. detections)
+                         */
+                        void annotate(Annotator annotator) {
+                            _annotator = annotator;
+                        }
+
+                        /**
+                         * Report clients' ack latency to the given
+                         * controller, that adapts resolution and quality
+                         */
+                        void adapt(Adaptive& adaptive) {
+                            _adaptive = &adaptive;
+                            _adaptiveId = adaptive.attach(WS_VIDEO_MAX_CLIENTS);
+                        }
+
+                        /**
+                         * Start WebSocket server
+                         */
+                        Exception& begin() {
+                            if (!wifi.isConnected())
+                                return exception.set("WiFi not connected");
+
+                            // frame buffers are sized for it
+                            _maxFramesize = camera.resolution.framesize;
+                            ws.withStackSize(_annotator ? 8000 : 5000);
+                            ws.onLoop([this]() {
+                                tick();
+                            });
+                            ws.begin([this](uint8_t num, WStype_t type, uint8_t *payload, size_t length) {
+                                onEvent(num, type, payload, length);
+                            });
+
+                            return exception.clear();
+                        }
+
+                        /**
+                         * Count connected clients
+                         */
+                        uint8_t count() const {
+                            uint8_t count = 0;
+
+                            for (uint8_t i = 0; i < WS_VIDEO_MAX_CLIENTS; i++)
+                                if (_clients[i].active)
+                                    count++;
+
+                            return count;
+                        }
+
+                        /**
+                         * Run function on each connected client's stats
+                         */
+                        template<typename Callback>
+                        void forEach(Callback callback) {
+                            for (uint8_t i = 0; i < WS_VIDEO_MAX_CLIENTS; i++)
+                                if (_clients[i].active)
+                                    callback(i, (const client_stats_t&) _clients[i].stats);
+                        }
+
+                        /**
+                         * Serialize per-client stats
+                         */
+                        void serializeTo(Writer& writer) {
+                            writer.beginArray(count());
+
+                            forEach([&writer](uint8_t i, const client_stats_t& stats) {
+                                writer.beginObject(6);
+                                writer.kv("client", i);
+                                writer.kv("frames", stats.frames);
+                                writer.kv("acked", stats.acked);
+                                writer.kv("timeouts", stats.timeouts);
+                                writer.kv("in_flight", stats.inFlight);
+                                writer.kv("latency_ms", stats.latency);
+                                writer.endObject();
+                            });
+
+                            writer.endArray();
+                        }
+
+                    protected:
+                        struct client_t {
+                            bool active;
+                            struct {
+                                uint32_t seq;
+                                size_t sentAt;
+                                size_t size;
+                            } pending[WS_VIDEO_MAX_IN_FLIGHT];
+                            client_stats_t stats;
+                        };
+
+                        uint8_t _window;
+                        uint32_t _lastSeq;
+                        uint8_t *_buf;
+                        size_t _length;
+                        size_t _capacity;
+                        Annotator _annotator;
+                        Adaptive *_adaptive;
+                        uint8_t _adaptiveId;
+                        framesize_t _maxFramesize;
+                        client_t _clients[WS_VIDEO_MAX_CLIENTS];
+
+                        /**
+                         * Handle WebSocket events (runs in WebSocket thread)
+                         */
+                        void onEvent(uint8_t num, WStype_t type, uint8_t *payload, size_t length) {
+                            if (num >= WS_VIDEO_MAX_CLIENTS)
+                                return;
+
+                            client_t &client = _clients[num];
+
+                            switch (type) {
+                                case WStype_CONNECTED:
+                                    client.active = true;
+                                    memset(&client.stats, 0, sizeof(client.stats));
+                                    ESP_LOGI("WsVideo", "Client #%d connected", num);
+                                    break;
+                                case WStype_DISCONNECTED:
+                                    client.active = false;
+                                    ESP_LOGI("WsVideo", "Client #%d disconnected", num);
+                                    break;
+                                case WStype_TEXT:
+                                    command(client, String((const char*) payload));
+                                    break;
+                                default:
+                                    break;
+                            }
+                        }
+
+                        /**
+                         * Parse client command
+                         */
+                        void command(client_t& client, String cmd) {
+                            const int space = cmd.indexOf(' ');
+                            const String name = cmd.substring(0, space);
+                            const long arg = space > 0 ? cmd.substring(space + 1).toInt() : 0;
+
+                            if (name == "ack")
+                                ack(client, arg);
+                            else if (name == "quality")
+                                setQuality(arg);
+                            else if (name == "resolution")
+                                setResolution(arg);
+                            else
+                                ESP_LOGW("WsVideo", "Unknown command: %s", cmd.c_str());
+                        }
+
+                        /**
+                         * Set JPEG quality requested by client,
+                         * within the adaptive range (if any)
+                         */
+                        void setQuality(long arg) {
+                            const uint8_t quality = _adaptive != NULL ? _adaptive->constrainQuality(arg) : constrain(arg, 10, 63);
+
+                            camera.mutex.threadsafe([quality]() {
+                                camera.quality.set(quality);
+                                camera.sensor.configure([quality](sensor_t *sensor) {
+                                    sensor->set_quality(sensor, quality);
+                                });
+                            }, 1000);
+                        }
+
+                        /**
+                         * Set framesize requested by client.
+                         * Frame buffers are sized at init, so it never
+                         * goes above the init framesize (or the adaptive
+                         * range, if any)
+                         */
+                        void setResolution(long arg) {
+                            const framesize_t size = _adaptive != NULL ?
+                                _adaptive->constrainFramesize((framesize_t) constrain(arg, 0, FRAMESIZE_INVALID - 1)) :
+                                (framesize_t) constrain(arg, 0, (long) _maxFramesize);
+
+                            camera.mutex.threadsafe([size]() {
+                                if (camera.resolution.framesize != size)
+                                    camera.resolution.set(size);
+                            }, 1000);
+                        }
+
+                        /**
+                         * Release frames up to seq and update latency
+                         */
+                        void ack(client_t& client, uint32_t seq) {
+                            const size_t now = millis();
+
+                            for (uint8_t i = 0; i < client.stats.inFlight; ) {
+                                if (client.pending[i].seq > seq) {
+                                    i++;
+                                    continue;
+                                }
+
+                                if (client.pending[i].seq == seq) {
+                                    const float latency = now - client.pending[i].sentAt;
+
+                                    client.stats.latency = client.stats.latency > 0 ? 0.9f * client.stats.latency + 0.1f * latency : latency;
+                                }
+
+                                if (_adaptive != NULL)
+                                    _adaptive->sent(_adaptiveId + (&client - _clients), client.pending[i].size, now - client.pending[i].sentAt);
+
+                                client.pending[i] = client.pending[--client.stats.inFlight];
+                                client.stats.acked += 1;
+                            }
+                        }
+
+                        /**
+                         * Send a new frame to clients that have room
+                         */
+                        void tick() {
+                            if (_adaptive != NULL)
+                                _adaptive->update();
+
+                            if (!hasRoom()) {
+                                delay(1);
+                                return;
+                            }
+
+                            // reuse frames from other pipelines; capture
+                            // ourselves only when none came in time
+                            if (camera.seq == _lastSeq || !camera.hasFrame()) {
+                                if (!rate) {
+                                    delay(1);
+                                    return;
+                                }
+
+                                if (!camera.capture().isOk())
+                                    return;
+                            }
+
+                            if (!pack())
+                                return;
+
+                            rate.touch();
+
+                            for (uint8_t i = 0; i < WS_VIDEO_MAX_CLIENTS; i++) {
+                                client_t &client = _clients[i];
+
+                                if (!client.active || client.stats.inFlight >= _window)
+                                    continue;
+
+                                if (!ws.webSocket.sendBIN(i, _buf, _length))
+                                    continue;
+
+                                client.pending[client.stats.inFlight].seq = _lastSeq;
+                                client.pending[client.stats.inFlight].sentAt = millis();
+                                client.pending[client.stats.inFlight].size = _length;
+                                client.stats.inFlight += 1;
+                                client.stats.frames += 1;
+                            }
+                        }
+
+                        /**
+                         * Test if any client can receive a frame.
+                         * Frames unacknowledged for too long are
+                         * considered lost
+                         */
+                        bool hasRoom() {
+                            bool hasRoom = false;
+                            const size_t now = millis();
+
+                            for (uint8_t i = 0; i < WS_VIDEO_MAX_CLIENTS; i++) {
+                                client_t &client = _clients[i];
+
+                                if (!client.active)
+                                    continue;
+
+                                for (uint8_t j = 0; j < client.stats.inFlight; j++) {
+                                    if (now - client.pending[j].sentAt > WS_VIDEO_ACK_TIMEOUT) {
+                                        client.stats.timeouts += client.stats.inFlight;
+
+                                        if (_adaptive != NULL)
+                                            _adaptive->dropped(_adaptiveId + i, client.stats.inFlight);
+
+                                        client.stats.inFlight = 0;
+                                        break;
+                                    }
+                                }
+
+                                hasRoom |= client.stats.inFlight < _window;
+                            }
+
+                            return hasRoom;
+                        }
+
+                        /**
+                         * Build message from current frame
+                         */
+                        bool pack() {
+                            const uint32_t seq = camera.seq;
+                            String annotation;
+                            bool isOk = false;
+
+                            if (_annotator)
+                                _annotator(annotation);
+
+                            // length must fit in uint16
+                            if (annotation.length() > 0xFFFF)
+                                annotation = annotation.substring(0, 0xFFFF);
+
+                            camera.mutex.threadsafe([this, seq, &annotation, &isOk]() {
+                                if (!camera.hasFrame())
+                                    return;
+
+                                // someone captured while annotating: results don't match
+                                if (camera.seq != seq)
+                                    annotation = "";
+
+                                const size_t length = WS_VIDEO_HEADER_SIZE + annotation.length() + camera.frame->len;
+
+                                if (length > _capacity) {
+                                    ::free(_buf);
+                                    _capacity = length * 5 / 4;
+                                    _buf = (uint8_t*) (psramFound() ? ps_malloc(_capacity) : malloc(_capacity));
+                                }
+
+                                if (_buf == NULL) {
+                                    _capacity = 0;
+                                    return;
+                                }
+
+                                _lastSeq = camera.seq;
+                                write32(_buf, camera.seq);
+                                write32(_buf + 4, camera.capturedAt);
+                                write32(_buf + 8, camera.frame->len);
+                                _buf[12] = annotation.length() & 0xFF;
+                                _buf[13] = annotation.length() >> 8;
+                                memcpy(_buf + WS_VIDEO_HEADER_SIZE, annotation.c_str(), annotation.length());
+                                memcpy(_buf + WS_VIDEO_HEADER_SIZE + annotation.length(), camera.frame->buf, camera.frame->len);
+                                _length = length;
+                                isOk = true;
+                            }, 1000);
+
+                            return isOk;
+                        }
+
+                        /**
+                         * Write little endian uint32
+                         */
+                        static void write32(uint8_t *dest, uint32_t value) {
+                            dest[0] = value;
+                            dest[1] = value >> 8;
+                            dest[2] = value >> 16;
+                            dest[3] = value >> 24;
+                        }
+                };
+            }
+        }
+    }
+}
+
+namespace eloq {
+    namespace viz {
+        static Eloquent::Esp32cam::Viz::Stream::WsVideo wsVideo;
+    }
+}
+
+#endif